@@ -43,6 +43,33 @@
 //! The maximum length of an MChat channel name
 #define MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE 64
 
+//! The maximum number of channels remembered from CDSC announcements (least recently announced are dropped first)
+#define MCHAT_LIMIT_MAX_CDSC_CHANNELS 256
+
+//! The maximum number of topic shards a channel can be split into
+#define MCHAT_LIMIT_MAX_CHANNEL_SHARDS 64
+
+//! The maximum length of a message topic
+#define MCHAT_LIMIT_MAX_TOPIC_SIZE 64
+
+//! The number of recently used channels whose receive sockets are kept open for fast switching
+#define MCHAT_LIMIT_MAX_WARM_CHANNELS 4
+
+//! The number of peer change events kept for ::mchatv1_get_peer_events before the oldest are dropped
+#define MCHAT_LIMIT_MAX_PEER_EVENTS 256
+
+//! The maximum number of parse workers for ::mchatv1_set_parse_workers
+#define MCHAT_LIMIT_MAX_PARSE_WORKERS 16
+
+//! The number of received messages queued for a virtual session before its delivery policy applies
+#define MCHAT_LIMIT_MAX_SESSION_QUEUE 256
+
+//! The number of received messages kept for ::mchatv1_reader_next before the oldest are overwritten (a power of two)
+#define MCHAT_LIMIT_MAX_BROADCAST_RING 1024
+
+//! The maximum size of the disk-backed overflow of ::MCHAT_DELIVERY_SPILL (64 MB), after which messages are dropped until it is read back
+#define MCHAT_LIMIT_MAX_SPILL_SIZE (1 << 26)
+
 //! @}
 
 
@@ -79,9 +106,18 @@
 #define MCHAT_PROTOCOL_DEFAULT_EXPIRE_INTERVAL \
     MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * 5
 
-/*! The time interval between sending cdsc messages */
+/*! The time interval between sending cdsc messages (each interval is randomly
+ * stretched or shortened by up to ::MCHAT_PROTOCOL_CDSC_JITTER) */
 #define MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER 10
 
+/*! The fraction of ::MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER used as random jitter, so peers
+ * announcing the same channel drift apart and can suppress each other's announcements */
+#define MCHAT_PROTOCOL_CDSC_JITTER 0.25
+
+/*! The largest CDSC datagram sent (bytes).  Channels that do not fit are announced in
+ * another datagram. */
+#define MCHAT_PROTOCOL_MAX_CDSC_SIZE 1400
+
 #define MCHAT_PROTOCOL_DEFAULT_CDSC_EXPIRE \
     MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER * 5
 
@@ -95,18 +131,60 @@
 typedef struct mchat_t mchat_t;
 #endif // _MCHAT_T_TYPEDEF_DEFINED
 
+/*!
+ * \brief MChat reactor object
+ * \see mchatv1_structs.h
+ */
+typedef struct mchat_reactor_t mchat_reactor_t;
+
+/*!
+ * \brief MChat runtime (reactor pool) object
+ * \see mchatv1_structs.h
+ */
+typedef struct mchat_runtime_t mchat_runtime_t;
+
+/*!
+ * \brief MChat virtual session object
+ * \see mchatv1_structs.h
+ */
+typedef struct mchat_session_t mchat_session_t;
+
+/*!
+ * \brief MChat broadcast reader object
+ * \see mchatv1_structs.h
+ */
+typedef struct mchat_reader_t mchat_reader_t;
+
 /*!
  * \brief MChat message object
  * \see mchatv1_structs.h
  */
 typedef struct mchat_message_t mchat_message_t;
 
+/*!
+ * \brief Function called when a received message is ready to be taken
+ * \see mchatv1_set_message_func
+ */
+typedef void (*mchat_message_func)(mchat_t *mchat, void *user_data);
+
+/*!
+ * \brief Function called when received messages back up past the high watermark
+ * \see mchatv1_set_delivery_watermark
+ */
+typedef void (*mchat_watermark_func)(mchat_t *mchat, mchat_session_t *session, unsigned int backlog, void *user_data);
+
 /*!
  * \brief MChat peerlist object
  * \see mchatv1_structs.h
  */
 typedef struct mchat_peerlist_t mchat_peerlist_t;
 
+/*!
+ * \brief MChat peer change event batch object
+ * \see mchatv1_structs.h
+ */
+typedef struct mchat_peer_events_t mchat_peer_events_t;
+
 /*!
  * \brief MChat chanlist object
  * \see mchatv1_structs.h
@@ -132,6 +210,48 @@ typedef struct mchat_chanlist_t mchat_chanlist_t;
  */
 mchat_t *mchatv1_init(char *cfg_filename);
 
+/*!
+ * \brief Create an mchat object whose work is done by a reactor
+ * \param cfg_filename As for ::mchatv1_init()
+ * \param reactor Reactor from ::mchatv1_reactor_new(), or NULL to use threads like ::mchatv1_init()
+ * \return An initialized mchat object or NULL on error
+ *
+ * \details
+ * Instead of starting up to five threads of its own, the mchat object registers its
+ * sockets and timers with \p reactor.  Any number of mchat objects may share one reactor.
+ * Messages are sent from the thread calling ::mchatv1_send_message().  When the received
+ * message has not been taken yet, the reactor stops reading that socket and leaves
+ * later messages queued in the kernel until ::mchatv1_recv_message() is called.
+ */
+mchat_t *mchatv1_init_reactor(char *cfg_filename, mchat_reactor_t *reactor);
+
+/*!
+ * \brief Set a function to call whenever a received message is ready to be taken
+ * \param mchat Pointer to an mchat object
+ * \param func Function to call, or NULL to go back to polling ::mchatv1_recv_message()
+ * \param user_data Passed to \p func
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * \p func runs on the thread (or reactor) that received the message.  With a reactor
+ * from ::mchatv1_reactor_new_for_context() that is the application's own main loop, so
+ * \p func can call ::mchatv1_recv_message() and update the UI directly.  The function
+ * can be replaced at any time; a call already running finishes with the old one.
+ */
+int mchatv1_set_message_func(mchat_t *mchat, mchat_message_func func, void *user_data);
+
+/*!
+ * \brief Create an mchat object run by the least busy reactor of a runtime
+ * \param cfg_filename As for ::mchatv1_init()
+ * \param runtime Runtime from ::mchatv1_runtime_new()
+ * \return An initialized mchat object or NULL on error
+ *
+ * \details
+ * This is ::mchatv1_init_reactor() with the reactor currently serving the fewest mchat
+ * objects.  The object stays on that reactor until it is destroyed.
+ */
+mchat_t *mchatv1_init_runtime(char *cfg_filename, mchat_runtime_t *runtime);
+
 /*!
  * \brief Cleanup an mchat object and gracefully shutdown any connections
  * \param mchat Reference to the mchat object pointer returned by ::mchatv1_init()
@@ -178,6 +298,59 @@ int mchatv1_set_stealth_mode(mchat_t *mchat, int stealth);
  */
 int mchatv1_connect(mchat_t *mchat, char *channel);
 
+/*!
+ * \brief Move the connection to another channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Name of the channel to switch to
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * Unlike ::mchatv1_disconnect followed by ::mchatv1_connect, this keeps the text send and
+ * receive threads running and retargets them to the new channel.  The receive sockets of
+ * the last ::MCHAT_LIMIT_MAX_WARM_CHANNELS channels stay open with their multicast
+ * memberships, so switching back to a recently used channel needs no socket setup or
+ * IGMP join.  Anything queued on a warm socket while it was unused is discarded.
+ * If \p mchat is not connected, this is the same as ::mchatv1_connect.
+ */
+int mchatv1_switch_channel(mchat_t *mchat, char *channel);
+
+/*!
+ * \brief Send a text message on the shard of the connected channel that carries \p topic
+ * \param mchat Pointer to an mchat object
+ * \param topic Topic (or thread key) of the message
+ * \param message Character pointer to a message buffer to send
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The message carries a Topic header.  On a sharded channel (see ::mchatv1_set_channel_shards)
+ * it is sent to the shard group for \p topic rather than to the channel address, so only
+ * peers subscribed to that shard receive it.  On other channels it goes to the channel address.
+ */
+int mchatv1_send_topic_message(mchat_t *mchat, char *topic, char *message);
+
+/*!
+ * \brief Receive the messages for \p topic on the connected channel
+ * \param mchat Pointer to an mchat object
+ * \param topic Topic (or thread key) to subscribe to
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * This joins the multicast group of the shard that carries \p topic, so messages for
+ * other shards are dropped by the NIC or kernel instead of by libmchat.  Other topics
+ * that hash to the same shard are received too; check ::mchatv1_message_get_topic if that
+ * matters.  Subscriptions are dropped when switching channels or disconnecting.  On a
+ * channel that is not sharded all topics are received anyway, and this does nothing.
+ */
+int mchatv1_subscribe_topic(mchat_t *mchat, char *topic);
+
+/*!
+ * \brief Stop receiving a topic subscribed to with ::mchatv1_subscribe_topic
+ * \param mchat Pointer to an mchat object
+ * \param topic Topic to unsubscribe from
+ * \return 0 on success or -1 if \p topic was not subscribed
+ */
+int mchatv1_unsubscribe_topic(mchat_t *mchat, char *topic);
+
 /*!
  * \brief Diconnect from the active MChat channel
  * \param mchat Pointer to an mchat object
@@ -192,6 +365,37 @@ int mchatv1_disconnect(mchat_t *mchat);
  */
 int mchatv1_is_connected(mchat_t *mchat);
 
+/*!
+ * \brief Join an added channel in addition to any connected channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Name of an added channel
+ * \return 0 on success or -1 on error (unknown channel, already joined or socket error)
+ *
+ * \details
+ * Joined channels are receive-only and are independent of ::mchatv1_connect.  A single
+ * receive thread serves every joined channel.  Channels that share a UDP port share one
+ * socket with a multicast membership for each channel.  Messages from joined channels
+ * are returned by ::mchatv1_recv_message; use ::mchatv1_message_get_channel to tell them
+ * apart.  Joined channels cannot be deleted until they are parted.
+ */
+int mchatv1_join_channel(mchat_t *mchat, char *channel);
+
+/*!
+ * \brief Stop receiving a channel joined with ::mchatv1_join_channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Name of a joined channel
+ * \return 0 on success or -1 if \p channel was not joined
+ */
+int mchatv1_part_channel(mchat_t *mchat, char *channel);
+
+/*!
+ * \brief Check if a channel has been joined with ::mchatv1_join_channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Name of the channel
+ * \return 1 if joined, 0 if not
+ */
+int mchatv1_is_joined(mchat_t *mchat, char *channel);
+
 /*!
  * \brief Send a text message to a connected mchat object
  * \param mchat Pointer to an mchat object
@@ -211,9 +415,34 @@ int mchatv1_send_message(mchat_t *mchat, char *message);
  * if no message is available or the mchat is not connected.  Use the mchatv1_message functions to
  * decode the message.
  *
+ * Messages from the connected channel and from joined channels (see ::mchatv1_join_channel)
+ * are both returned here; -1 is only returned when neither is active.
+ *
  */
 int mchatv1_recv_message(mchat_t *mchat, mchat_message_t** message);
 
+/*!
+ * \brief Get every message waiting in a connected mchat object, up to a limit
+ * \param mchat Pointer to an mchat object
+ * \param messages Array to store the messages in (free each with ::mchatv1_message_destroy())
+ * \param max Length of \p messages
+ * \return Number of messages stored, or -1 on error
+ *
+ * \details
+ * Like ::mchatv1_recv_message(), but takes the waiting message of the connected channel
+ * and of the joined channels together with the messages spilled behind them (see
+ * ::MCHAT_DELIVERY_SPILL) while locking and waking each receive thread only once.  Each
+ * message is allocated to the size of its body rather than ::MCHAT_LIMIT_MAX_MESSAGE_SIZE.
+ *
+ * \warning Each receive thread holds a single waiting message.  Only
+ * ::MCHAT_DELIVERY_SPILL queues more behind it, so with ::MCHAT_DELIVERY_BLOCK and the
+ * drop policies a call returns at most one message per receive thread (two in all with
+ * joined channels), however many are in flight.  Batching then saves nothing over
+ * ::mchatv1_recv_message(); use ::MCHAT_DELIVERY_SPILL, sessions or readers to take
+ * bursts in bulk.
+ */
+int mchatv1_recv_messages(mchat_t *mchat, mchat_message_t **messages, unsigned int max);
+
 /*!
  * \brief Start a file send job
  * \param mchat Pointer to an mchat object
@@ -280,6 +509,474 @@ int mchatv1_get_presence(mchat_t *mchat);
 
 //! @}
 
+/*!
+ * \name MChat Reactor API
+ * @{
+ */
+
+/*!
+ * \brief Create a reactor and start its thread
+ * \return A reactor or NULL on error
+ * \see mchatv1_init_reactor
+ */
+mchat_reactor_t *mchatv1_reactor_new(void);
+
+struct _GMainContext;	/* GMainContext, without making this header depend on glib.h */
+
+/*!
+ * \brief Create a reactor that runs on a main context of the application
+ * \param context GMainContext to attach every event source to, or NULL for the global default context
+ * \return A reactor or NULL on error
+ *
+ * \details
+ * No thread is started: sockets are read, keepalives sent and channels expired only
+ * while the application iterates \p context (with a GMainLoop or g_main_context_iteration()).
+ * A single threaded GLib client calling the MChat API from the same context never waits
+ * on another thread.  Destroy mchat objects using the reactor from that thread, or while
+ * \p context is still being iterated.
+ * \see mchatv1_set_message_func
+ */
+mchat_reactor_t *mchatv1_reactor_new_for_context(struct _GMainContext *context);
+
+/*!
+ * \brief Stop and free a reactor
+ * \param reactor Reference to the reactor pointer returned by ::mchatv1_reactor_new()
+ * \return 0 on success or -1 if an mchat object still uses the reactor
+ */
+int mchatv1_reactor_destroy(mchat_reactor_t **reactor);
+
+/*!
+ * \brief Create a runtime: a fixed pool of reactors for many mchat objects
+ * \param threads Number of reactors (threads), or 0 for one per processor
+ * \return A runtime or NULL on error
+ * \see mchatv1_init_runtime
+ */
+mchat_runtime_t *mchatv1_runtime_new(unsigned int threads);
+
+/*!
+ * \brief Stop and free a runtime and its reactors
+ * \param runtime Reference to the runtime pointer returned by ::mchatv1_runtime_new()
+ * \return 0 on success or -1 if an mchat object still uses the runtime
+ */
+int mchatv1_runtime_destroy(mchat_runtime_t **runtime);
+
+//! @}
+
+/*!
+ * \name MChat Virtual Session API
+ * \details
+ * A session is another identity (nickname) using the sockets and threads of an mchat
+ * object, so a gateway or bot can speak for many users without opening a socket set
+ * for each.  Received text is parsed once and a copy is queued for every session; the
+ * keepalive timer of the mchat object sends a PING for each session as well.
+ *
+ * While sessions are attached, the mchat object's own message buffer no longer holds
+ * back its sockets: a message arriving while it is full only reaches the sessions.
+ * Peers are still keyed by source address, so every identity from one host shares
+ * one peer list entry.
+ * @{
+ */
+
+/*!
+ * \brief Attach a new session to an mchat object
+ * \param mchat Pointer to an mchat object
+ * \param nickname Nickname of the session (shorter than ::MCHAT_LIMIT_MAX_NICKNAME_SIZE)
+ * \return A session or NULL on error
+ */
+mchat_session_t *mchatv1_session_new(mchat_t *mchat, char *nickname);
+
+/*!
+ * \brief Detach and free a session and any messages still queued for it
+ * \param session Reference to the session pointer returned by ::mchatv1_session_new()
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * ::mchatv1_destroy() frees the sessions of an mchat object that are still attached.
+ * If the watermark function is running for the session on another thread, the
+ * session is freed once it returns.
+ */
+int mchatv1_session_destroy(mchat_session_t **session);
+
+/*!
+ * \brief Send a message on the current channel as a session
+ * \param session Pointer to a session
+ * \param message Message text
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_session_send_message(mchat_session_t *session, char *message);
+
+/*!
+ * \brief Send a message with a topic on the current channel as a session
+ * \param session Pointer to a session
+ * \param topic Topic of the message
+ * \param message Message text
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_session_send_topic_message(mchat_session_t *session, char *topic, char *message);
+
+/*!
+ * \brief Take the oldest message queued for a session
+ * \param session Pointer to a session
+ * \param message Pointer to an mchat message pointer (free it with ::mchatv1_message_destroy())
+ * \return 1 if a message was returned, 0 if none is queued or -1 on error
+ *
+ * \details
+ * At most ::MCHAT_LIMIT_MAX_SESSION_QUEUE messages are queued; what happens to later ones
+ * is set by ::mchatv1_session_set_delivery_policy().
+ */
+int mchatv1_session_recv_message(mchat_session_t *session, mchat_message_t **message);
+
+/*!
+ * \brief Get the nickname of a session
+ * \param session Pointer to a session
+ * \param buf Character buffer to copy the nickname into
+ * \param buf_size Length of \p buf (Should be MCHAT_LIMIT_MAX_NICKNAME_SIZE)
+ * \return Number of bytes copied or -1 on error
+ */
+int mchatv1_session_get_nickname(mchat_session_t *session, char *buf, unsigned int buf_size);
+
+//! @}
+
+/*!
+ * \name MChat Broadcast Reader API
+ * \details
+ * ::mchatv1_recv_message() takes each message away from every other caller.  Readers
+ * instead each see every received text message: messages go into a ring of
+ * ::MCHAT_LIMIT_MAX_BROADCAST_RING shared, read-only entries and every reader keeps its
+ * own position in it.  Nothing is copied per reader and the receive threads never wait
+ * for a reader; a reader that falls a whole ring behind finds its next messages already
+ * overwritten and is told how many it missed.
+ *
+ * As with sessions, while readers are registered the mchat object's own message buffer
+ * no longer holds back its sockets.
+ * @{
+ */
+
+/*!
+ * \brief Register a reader of every text message received from now on
+ * \param mchat Pointer to an mchat object
+ * \return A reader or NULL on error
+ */
+mchat_reader_t *mchatv1_reader_new(mchat_t *mchat);
+
+/*!
+ * \brief Unregister and free a reader
+ * \param reader Reference to the reader pointer returned by ::mchatv1_reader_new()
+ * \return 0 on success or -1 on error
+ *
+ * \warning Readers must be destroyed before their mchat object.
+ */
+int mchatv1_reader_destroy(mchat_reader_t **reader);
+
+/*!
+ * \brief Get the next message for a reader
+ * \param reader Pointer to a reader
+ * \param message Set to the message, valid until the next call with \p reader or its destruction
+ * \param missed Set to the number of messages overwritten before \p reader got to them, or NULL
+ * \return 1 if a message was returned, 0 if there is none yet or -1 on error
+ *
+ * \details
+ * The message is shared with the other readers and must not be modified or destroyed.
+ * Each reader may only be used by one thread at a time.
+ */
+int mchatv1_reader_next(mchat_reader_t *reader, const mchat_message_t **message, unsigned int *missed);
+
+/*!
+ * \brief Wait for the next message for a reader
+ * \param reader Pointer to a reader
+ * \param message Set to the message, valid until the next call with \p reader or its destruction
+ * \param missed Set to the number of messages overwritten before \p reader got to them, or NULL
+ * \param timeout Longest time to wait in microseconds, or a negative value to wait until a message arrives
+ * \return 1 if a message was returned, 0 if none arrived in time or -1 on error
+ *
+ * \details
+ * As ::mchatv1_reader_next(), but sleeps until a message is published instead of
+ * returning 0 straight away.  Receive threads only pay for the wake up while a reader
+ * is actually waiting.
+ */
+int mchatv1_reader_wait(mchat_reader_t *reader, const mchat_message_t **message, unsigned int *missed, long timeout);
+
+//! @}
+
+/*!
+ * \name MChat Source Filter API
+ * \details
+ * Source filters make the kernel (and IGMPv3/MLDv2 capable switches and routers) drop
+ * traffic from unwanted senders before libmchat sees it.  While the allow list is not
+ * empty, only allowed senders are received (source-specific, or INCLUDE mode, membership).
+ * Otherwise everyone except blocked senders is received (EXCLUDE mode).  Filters apply
+ * to the connected channel, its topic shards and joined channels.  The common channel
+ * is never filtered, so filtered peers still show up in the peer list.
+ *
+ * Addresses are given as strings, as returned by ::mchatv1_peer_get_source_address.  These
+ * functions return -1 if the platform has no source filter support, or if the kernel
+ * refused the new filter on any membership.  The lists keep the change either way.
+ * @{
+ */
+
+/*!
+ * \brief Add a sender to the allow list
+ * \param mchat Pointer to an mchat object
+ * \param address IPv4 address of the sender
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_source_allow(mchat_t *mchat, char *address);
+
+/*!
+ * \brief Add a sender to the block list
+ * \param mchat Pointer to an mchat object
+ * \param address IPv4 address of the sender
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_source_block(mchat_t *mchat, char *address);
+
+/*!
+ * \brief Remove a sender from the allow and block lists
+ * \param mchat Pointer to an mchat object
+ * \param address IPv4 address of the sender
+ * \return 0 on success or -1 if \p address was in neither list
+ */
+int mchatv1_source_forget(mchat_t *mchat, char *address);
+
+/*!
+ * \brief Empty the allow and block lists
+ * \param mchat Pointer to an mchat object
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_source_clear(mchat_t *mchat);
+
+/*!
+ * \brief Kernel filter is off; every datagram on a channel port reaches libmchat
+ */
+#define MCHAT_KERNEL_FILTER_OFF 0
+/*!
+ * \brief Only MChat datagrams of the types a socket handles are let through
+ * (PING and CDSC on the common channel, TEXT and FILE on chat channels)
+ */
+#define MCHAT_KERNEL_FILTER_ON 1
+/*!
+ * \brief As ::MCHAT_KERNEL_FILTER_ON, and blocked senders are dropped on every socket,
+ * including the common channel, so they disappear from the peer list too
+ */
+#define MCHAT_KERNEL_FILTER_SOURCES 2
+
+/*!
+ * \brief Set the kernel socket filter mode
+ * \param mchat Pointer to an mchat object
+ * \param mode One of ::MCHAT_KERNEL_FILTER_OFF, ::MCHAT_KERNEL_FILTER_ON or ::MCHAT_KERNEL_FILTER_SOURCES
+ * \return 0 on success or -1 on error (or if the platform has no socket filters)
+ *
+ * \details
+ * The filter is a classic BPF program attached to every receive socket, so datagrams that
+ * libmchat would parse and throw away are dropped before they are copied to user space.
+ * Like the parser it ignores case, but it is stricter about spacing: a datagram must
+ * start with the message type, a single space and "MCHAT/".
+ */
+int mchatv1_set_kernel_filter(mchat_t *mchat, int mode);
+
+/*!
+ * \brief Get the kernel socket filter mode
+ * \param mchat Pointer to an mchat object
+ * \return One of ::MCHAT_KERNEL_FILTER_OFF, ::MCHAT_KERNEL_FILTER_ON or ::MCHAT_KERNEL_FILTER_SOURCES
+ */
+int mchatv1_get_kernel_filter(mchat_t *mchat);
+
+//! @}
+
+
+/*!
+ * \name MChat Thread Tuning API
+ * \details
+ * Each thread of an mchat object has a role.  CPU affinity and scheduling are set per
+ * role and applied to the role's thread right away if it is running, and whenever it
+ * is started again (text threads start on every ::mchatv1_connect()).  The threads are
+ * named after their role ("Text Recv", ...), as shown by top -H.
+ *
+ * These calls fail for mchat objects run by a reactor, which has no per-role threads,
+ * and on platforms other than Linux.
+ * @{
+ */
+
+#define MCHAT_THREAD_ROLE_TEXT_SEND 0		//!< Sends text messages and keepalives on the current channel
+#define MCHAT_THREAD_ROLE_TEXT_RECV 1		//!< Receives messages on the current channel
+#define MCHAT_THREAD_ROLE_COMM_SEND 2		//!< Sends keepalives and CDSC announcements on the common channel
+#define MCHAT_THREAD_ROLE_COMM_RECV 3		//!< Receives on the common channel and expires peers and channels
+#define MCHAT_THREAD_ROLE_FILEIO 4			//!< File transfers
+#define MCHAT_THREAD_ROLE_MULTI_RECV 5		//!< Receives messages on joined channels
+#define MCHAT_THREAD_ROLE_COUNT 6			//!< Number of thread roles
+
+/*!
+ * \brief Pin the thread of a role to a set of CPUs
+ * \param mchat Pointer to an mchat object
+ * \param role One of the MCHAT_THREAD_ROLE_* values
+ * \param cpus Array of CPU numbers
+ * \param count Number of entries in \p cpus, or 0 to let the thread run on any CPU
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_set_thread_affinity(mchat_t *mchat, int role, const int *cpus, unsigned int count);
+
+/*!
+ * \brief Set the scheduling of the thread of a role
+ * \param mchat Pointer to an mchat object
+ * \param role One of the MCHAT_THREAD_ROLE_* values
+ * \param nice Nice value (-20 to 19) used with the normal scheduler
+ * \param fifo_priority SCHED_FIFO priority (1 to 99), or 0 for the normal scheduler
+ * \return 0 on success or -1 on error (raising priority usually needs CAP_SYS_NICE)
+ */
+int mchatv1_set_thread_scheduling(mchat_t *mchat, int role, int nice, int fifo_priority);
+
+/*!
+ * \brief Busy poll the current channel instead of sleeping until a datagram arrives
+ * \param mchat Pointer to an mchat object
+ * \param usec How long to spin in microseconds, or 0 to turn busy polling off
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The text recv thread polls its socket for up to \p usec before blocking, and the
+ * socket gets SO_BUSY_POLL so the kernel polls the NIC queue as well.  This trades a
+ * CPU (best pinned with ::mchatv1_set_thread_affinity()) for receive latency.
+ */
+int mchatv1_set_busy_poll(mchat_t *mchat, unsigned int usec);
+
+/*!
+ * \brief Parse the current channel's datagrams on worker threads
+ * \param mchat Pointer to an mchat object
+ * \param workers Number of parse workers (up to ::MCHAT_LIMIT_MAX_PARSE_WORKERS), or 0 to parse on the text recv thread
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The text recv thread then only reads datagrams into a pool of buffers (16 per worker)
+ * and passes them to the workers, so a slow parse, a contended peer list or an unread
+ * message only holds it up once the pool is used up.  Datagrams are spread over the workers by sender, so each sender's
+ * messages keep their order.  PINGs bypass the workers through a control lane with
+ * its own thread, which keeps only the latest PING of each sender, so presence stays
+ * current while chat traffic backs up.  The workers start with the same CPU affinity and
+ * scheduling as the text recv thread.  Takes effect at the next ::mchatv1_connect().
+ *
+ * \warning With ::MCHAT_DELIVERY_BLOCK, once the application falls far enough behind
+ * to use up the whole pool the text recv thread only reads the PINGs at the head of
+ * the socket buffer, into a buffer reserved for them.  The next chat message stays
+ * there until the application takes one, and PINGs that arrived after it wait behind
+ * it.  Use another delivery policy if presence must stay current while messages go
+ * untaken.  Without parse workers there is no control lane at all.
+ */
+int mchatv1_set_parse_workers(mchat_t *mchat, unsigned int workers);
+
+/*!
+ * \brief Get the counters of the PING control lane of the parse workers
+ * \param mchat Pointer to an mchat object
+ * \param coalesced PINGs replaced by a newer PING from the same sender before being handled, or NULL
+ * \param dropped PINGs dropped because too many senders had a PING waiting, or NULL
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The counters are cumulative over the life of the object and wrap at UINT_MAX.  They
+ * stay 0 without parse workers.
+ */
+int mchatv1_get_control_counters(mchat_t *mchat, unsigned int *coalesced, unsigned int *dropped);
+
+//! @}
+
+
+/*!
+ * \name MChat Delivery Policy API
+ * \details
+ * A received text message waits in the mchat object (or a session's queue) until the
+ * application takes it.  The delivery policy decides what happens to messages arriving
+ * while it is full, and the counters show what each policy did.
+ * @{
+ */
+
+//! Wait for the application to take the message (default for mchat objects, not allowed for sessions)
+#define MCHAT_DELIVERY_BLOCK 0
+
+//! Drop the arriving message
+#define MCHAT_DELIVERY_DROP_NEWEST 1
+
+//! Drop the oldest waiting message to make room (default for sessions)
+#define MCHAT_DELIVERY_DROP_OLDEST 2
+
+//! Append the arriving message to a temporary file, read back as room is made
+#define MCHAT_DELIVERY_SPILL 3
+
+/*!
+ * \brief Set what happens to text messages arriving before the previous one was taken
+ * \param mchat Pointer to an mchat object
+ * \param policy One of MCHAT_DELIVERY_*
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * With ::MCHAT_DELIVERY_BLOCK the receive thread stops reading and the kernel drops
+ * whatever overflows its socket buffer; with a reactor the socket is no longer watched.
+ * The other policies keep reading, so the loss (or the spilling) is counted instead.
+ * Spilled messages are delivered in order before any newer message.  Space is reclaimed
+ * as they are read back, so the limit of ::MCHAT_LIMIT_MAX_SPILL_SIZE applies to the
+ * messages not taken yet, not to everything ever spilled.
+ */
+int mchatv1_set_delivery_policy(mchat_t *mchat, int policy);
+
+/*!
+ * \brief Set what happens to messages arriving for a full session queue
+ * \param session Pointer to a session
+ * \param policy One of MCHAT_DELIVERY_* except ::MCHAT_DELIVERY_BLOCK
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The queue holds ::MCHAT_LIMIT_MAX_SESSION_QUEUE messages.  Sessions cannot block,
+ * as one slow session would hold up the mchat object and every other session.
+ */
+int mchatv1_session_set_delivery_policy(mchat_session_t *session, int policy);
+
+/*!
+ * \brief Get the delivery counters of an mchat object
+ * \param mchat Pointer to an mchat object
+ * \param delivered Messages made ready to be taken, or NULL
+ * \param dropped Messages lost to the delivery policy, or NULL
+ * \param spilled Messages written to the overflow file, or NULL
+ * \param blocked Times a receive thread waited for a message to be taken, or NULL
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The counters are cumulative over the life of the object and wrap at UINT_MAX.
+ */
+int mchatv1_get_delivery_counters(mchat_t *mchat, unsigned int *delivered, unsigned int *dropped,
+                                  unsigned int *spilled, unsigned int *blocked);
+
+/*!
+ * \brief Get the delivery counters of a session
+ * \param session Pointer to a session
+ * \param delivered Messages queued, or NULL
+ * \param dropped Messages lost to the delivery policy, or NULL
+ * \param spilled Messages written to the overflow file, or NULL
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_session_get_delivery_counters(mchat_session_t *session, unsigned int *delivered,
+        unsigned int *dropped, unsigned int *spilled);
+
+/*!
+ * \brief Call a function when received messages back up
+ * \param mchat Pointer to an mchat object
+ * \param high Backlog at which \p func is called, or 0 to turn the callback off
+ * \param func Function to call
+ * \param user_data Passed to \p func
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The backlog of an mchat object counts the message waiting to be taken, the spilled
+ * messages behind it and, with ::MCHAT_DELIVERY_BLOCK, a receive thread about to wait
+ * (so it reaches at most 2 without spilling).  The backlog of a session counts its queue
+ * and spilled messages.  \p func is called with the session (NULL for the mchat object
+ * itself) on the receiving thread once the backlog reaches \p high, and again only after
+ * the backlog fell below \p high.  A watermark below the point where the policy starts
+ * dropping gives the application time to add consumers or shed load first.  The
+ * watermark can be replaced at any time; a call already in progress finishes with the
+ * old \p func and \p user_data.
+ */
+int mchatv1_set_delivery_watermark(mchat_t *mchat, unsigned int high, mchat_watermark_func func, void *user_data);
+
+//! @}
+
+
 /*!
  * \name MChat Channel API
  * @{
@@ -295,6 +992,8 @@ int mchatv1_get_presence(mchat_t *mchat);
  *
  * \details
  * Add a new named channel to MChat.  This allows a new channel to be defined on the fly.
+ * Fails if \p channel_address is a shard group of another added channel on the same port
+ * (see ::mchatv1_set_channel_shards()).
  * \note \p channel_address should be an IPv4 Multicast address (224.0.0.0/4)
  * \note \p channel_portno should be greater than 1024 (running as root is a bad idea, A REALLY BAD IDEA)
  */
@@ -310,6 +1009,33 @@ int mchatv1_add_channel(mchat_t *mchat, char *channel, char *channel_address, un
  */
 int mchatv1_del_channel(mchat_t *mchat, char *channel);
 
+/*!
+ * \brief Split an added channel's traffic over several multicast groups by topic
+ * \param mchat Pointer to an mchat object
+ * \param channel Channel name
+ * \param shard_count Number of shard groups (0 to turn sharding off, at most
+ *        ::MCHAT_LIMIT_MAX_CHANNEL_SHARDS)
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * Shard \e i of a channel uses the group \e i + 1 addresses after the channel address, on
+ * the same port.  The shard of a topic is a hash of the channel name and the topic
+ * modulo \p shard_count.  Every peer must use the same shard count for the channel.  The
+ * channel address itself still carries PINGs and messages without a topic.  The count
+ * cannot be changed while the channel is connected or joined.  It is also refused if a
+ * shard group would be the address or a shard group of another added channel on the same
+ * port, as the two channels would then receive each other's traffic.
+ */
+int mchatv1_set_channel_shards(mchat_t *mchat, char *channel, unsigned int shard_count);
+
+/*!
+ * \brief Get the number of topic shards of an added channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Channel name
+ * \return The shard count (0 if the channel is not sharded) or -1 on error
+ */
+int mchatv1_get_channel_shards(mchat_t *mchat, char *channel);
+
 /*!
  * \brief Get the current connected channel
  * \param mchat Pointer to an mchat object
@@ -333,77 +1059,116 @@ int mchatv1_get_channel(mchat_t *mchat, char *buf, unsigned int buf_size);
 int mchatv1_get_channel_count(mchat_t *mchat);
 
 /*!
- * \brief mchatv1_get_added_channels
- * \param mchat
- * \param channel_list
- * \return
+ * \brief Get the number of peers seen in a channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Name of the channel
+ * \return The number of peers whose last message named \p channel, or -1 on error
+ *
+ * \details
+ * Channel membership is taken from the CHANNEL header of the peers' PING and TEXT
+ * messages and is indexed as they arrive, so this does not scan the peer list.
+ * Peers that are not connected to a channel are counted under "<Not Connected>".
+ */
+int mchatv1_channel_member_count(mchat_t *mchat, char *channel);
+
+/*!
+ * \brief Returns the peers seen in a channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Name of the channel
+ * \param peerlist Double pointer to a mchat peerlist object
+ * \return 1 if a peerlist was returned, 0 if no peers are in \p channel, or -1 on error
+ *
+ * \details
+ * This works like ::mchatv1_get_peerlist, but only contains the members of \p channel.
+ * The list is built from the membership index, so the cost depends on the size of the
+ * channel rather than the whole peer list.  Free the list with ::mchatv1_peerlist_destroy.
+ */
+int mchatv1_get_channel_peerlist(mchat_t *mchat, char *channel, mchat_peerlist_t **peerlist);
+
+/*!
+ * \brief Get the list of channels added to an mchat object
+ * \param mchat Pointer to an mchat object
+ * \param channel_list Double pointer to an mchat chanlist object
+ * \return 1 if a list was returned, 0 if the list is empty, or -1 on error
+ *
+ * \details
+ * The returned list is a read-only snapshot shared with other callers; getting it does
+ * not lock or copy.  Free it with ::mchatv1_chanlist_destroy.
  */
 int mchatv1_get_added_channels(mchat_t *mchat, mchat_chanlist_t **channel_list);
 
 /*!
- * \brief mchatv1_get_cdsc_channels
- * \param mchat
- * \param channel_list
- * \return
+ * \brief Get the list of channels discovered through CDSC announcements
+ * \param mchat Pointer to an mchat object
+ * \param channel_list Double pointer to an mchat chanlist object
+ * \return 1 if a list was returned, 0 if the list is empty, or -1 on error
+ *
+ * \details
+ * Discovered channels are kept for ::MCHAT_PROTOCOL_DEFAULT_CDSC_EXPIRE seconds after they
+ * were last announced, and at most ::MCHAT_LIMIT_MAX_CDSC_CHANNELS are remembered.  The
+ * list is a read-only snapshot like the one from ::mchatv1_get_added_channels, but last
+ * seen times are published in batches and may lag by a fraction of a second.  A discovered
+ * channel can be added with ::mchatv1_add_channel by passing only its name.
  */
 int mchatv1_get_cdsc_channels(mchat_t *mchat, mchat_chanlist_t **channel_list);
 
 /*!
- * \brief mchatv1_chanlist_size
- * \param channel_list
- * \return
+ * \brief Return the number of channels in a channel list
+ * \param channel_list Pointer to an mchat chanlist object
+ * \return The length of the list (0 or greater) or -1 on error
  */
 int mchatv1_chanlist_size(mchat_chanlist_t *channel_list);
 
 /*!
- * \brief mchatv1_chanlist_get_channel_name
- * \param channel
- * \param index
- * \param buf
- * \param buf_size
- * \return
+ * \brief Get the name of a channel in a channel list
+ * \param channel Pointer to an mchat chanlist object
+ * \param index Index of the channel to inspect
+ * \param buf Pointer to a character buffer to place the channel name in
+ * \param buf_size Length of \p buf (Should be MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE)
+ * \return Number of bytes copied or -1 on error
  */
 int mchatv1_chanlist_get_channel_name(mchat_chanlist_t *channel, unsigned int index, char *buf, unsigned int buf_size);
 
 /*!
- * \brief mchatv1_chanlist_get_channel_address
- * \param channel
- * \param index
- * \param buf
- * \param buf_size
- * \return
+ * \brief Get the multicast address of a channel in a channel list
+ * \param channel Pointer to an mchat chanlist object
+ * \param index Index of the channel to inspect
+ * \param buf Pointer to a character buffer to place the address in
+ * \param buf_size Length of \p buf (46 is enough for any IPv4 or IPv6 address)
+ * \return Number of bytes copied or -1 on error
  */
 int mchatv1_chanlist_get_channel_address(mchat_chanlist_t *channel, unsigned int index, char *buf, unsigned int buf_size);
 
 /*!
- * \brief mchatv1_chanlist_get_channel_port
- * \param channel
- * \param index
- * \param port
- * \return
+ * \brief Get the UDP port number of a channel in a channel list
+ * \param channel Pointer to an mchat chanlist object
+ * \param index Index of the channel to inspect
+ * \param port Pointer to place the port number into
+ * \return 0 on success or -1 on error
  */
 int mchatv1_chanlist_get_channel_port(mchat_chanlist_t *channel, unsigned int index, unsigned short *port);
 
 /*!
- * \brief mchatv1_chanlist_get_channel_time
- * \param channel
- * \param index
- * \param time
- * \return
+ * \brief Get the last time a channel in a channel list was announced
+ * \param channel Pointer to an mchat chanlist object
+ * \param index Index of the channel to inspect
+ * \param time Pointer to a long to put the time into (UNIX epoch time in microseconds, 0 for
+ *        added channels)
+ * \return 0 on success or -1 on error
  */
 int mchatv1_chanlist_get_channel_time(mchat_chanlist_t *channel, unsigned int index, long *time);
 
 /*!
- * \brief mchatv1_chanlist_get_channel_info
- * \param channel
- * \param index
- * \param name_buf
- * \param name_buf_size
- * \param addr_buf
- * \param addr_buf_size
- * \param portno
- * \param time
- * \return
+ * \brief Get all the information about a channel in a channel list
+ * \param channel Pointer to an mchat chanlist object
+ * \param index Index of the channel to inspect
+ * \param name_buf Pointer to a character buffer to place the channel name in
+ * \param name_buf_size Length of \p name_buf
+ * \param addr_buf Pointer to a character buffer to place the address in
+ * \param addr_buf_size Length of \p addr_buf
+ * \param portno Pointer to place the port number into
+ * \param time Pointer to a long to put the last announced time into
+ * \return 0 on success, -1 on invalid index, -2 on \p name_buf too small, or -3 on \p addr_buf too small
  */
 int mchatv1_chanlist_get_channel_info(mchat_chanlist_t *channel, unsigned int index,
                                       char *name_buf, unsigned int name_buf_size,
@@ -411,9 +1176,9 @@ int mchatv1_chanlist_get_channel_info(mchat_chanlist_t *channel, unsigned int in
                                       unsigned short *portno, long *time);
 
 /*!
- * \brief mchatv1_chanlist_destroy
- * \param channel_list
- * \return
+ * \brief Free an mchat chanlist object
+ * \param channel_list Double pointer to an mchat chanlist object
+ * \return 0 on success or -1 on error
  */
 int mchatv1_chanlist_destroy(mchat_chanlist_t **channel_list);
 
@@ -461,6 +1226,24 @@ int mchatv1_message_get_nickname(mchat_message_t *packet, char *buf, unsigned in
  */
 int mchatv1_message_get_timestamp(mchat_message_t *packet, long *t);
 
+/*!
+ * \brief Copy the name of the channel a message was sent on
+ * \param packet Pointer to an mchat message object
+ * \param buf Pointer to a character buffer to place the channel name in
+ * \param len Length of \p buf (Should be MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE)
+ * \return Number of bytes copied or -1 on error
+ */
+int mchatv1_message_get_channel(mchat_message_t *packet, char *buf, unsigned int len);
+
+/*!
+ * \brief Copy the topic of a message
+ * \param packet Pointer to an mchat message object
+ * \param buf Pointer to a character buffer to place the topic in
+ * \param len Length of \p buf (Should be MCHAT_LIMIT_MAX_TOPIC_SIZE)
+ * \return Number of bytes copied (0 if the message has no topic) or -1 on error
+ */
+int mchatv1_message_get_topic(mchat_message_t *packet, char *buf, unsigned int len);
+
 /*!
  * \brief mchatv1_message_has_error
  * \param packet
@@ -520,9 +1303,33 @@ int mchatv1_peers_available(mchat_t *mchat);
  * This function returns a list of peers seen at the time of the function call.
  * This list does NOT update dynamically and does not necessarily represent the
  * the peer list right after the call completes.
+ *
+ * The returned list is a read-only snapshot shared with other callers, so this call
+ * neither locks nor copies.  Keepalive-only changes (last seen times) are published
+ * in batches, so timestamps may lag by a fraction of a second.  Free the list with
+ * ::mchatv1_peerlist_destroy when done.
  */
 int mchatv1_get_peerlist(mchat_t *mchat, mchat_peerlist_t **peerlist);
 
+/*!
+ * \brief Get the generation number of the most recently published peer list
+ * \param mchat Pointer to an mchat object
+ * \return The current peer list generation
+ *
+ * \details
+ * The generation changes every time a new peer list is published.  Compare it to
+ * ::mchatv1_peerlist_get_generation of a list you already have to find out whether
+ * fetching a new one is worth it.
+ */
+unsigned int mchatv1_peerlist_generation(mchat_t *mchat);
+
+/*!
+ * \brief Get the generation number of a peer list
+ * \param peerlist Pointer to an mchat peerlist object
+ * \return The generation the list was published as
+ */
+unsigned int mchatv1_peerlist_get_generation(mchat_peerlist_t *peerlist);
+
 /*!
  * \brief Return the total size of the peer list (The number of peers)
  * \param peerlist Pointer to an mchat peerlist object
@@ -559,6 +1366,72 @@ int mchatv1_peer_get_channel(mchat_peerlist_t *peerlist, unsigned int index, cha
  */
 int mchatv1_peer_get_timestamp(mchat_peerlist_t *peerlist, unsigned int index, long *t);
 
+/*!
+ * \brief Get the number of TEXT messages received from a peer
+ * \param peerlist Pointer to an mchat peerlist object
+ * \param index Index of the peer to inspect
+ * \param count Pointer to an unsigned long to put the count into
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_peer_get_message_count(mchat_peerlist_t *peerlist, unsigned int index, unsigned long *count);
+
+/*!
+ * \brief Get the number of PING messages received from a peer
+ * \param peerlist Pointer to an mchat peerlist object
+ * \param index Index of the peer to inspect
+ * \param count Pointer to an unsigned long to put the count into
+ * \return 0 on success or -1 on error
+ *
+ * \note PINGs are counted on both the common channel and the connected channel.
+ */
+int mchatv1_peer_get_ping_count(mchat_peerlist_t *peerlist, unsigned int index, unsigned long *count);
+
+/*!
+ * \brief Get the total number of bytes received from a peer
+ * \param peerlist Pointer to an mchat peerlist object
+ * \param index Index of the peer to inspect
+ * \param bytes Pointer to an unsigned long to put the byte count into
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_peer_get_byte_count(mchat_peerlist_t *peerlist, unsigned int index, unsigned long *bytes);
+
+/*!
+ * \brief Get the time of the last TEXT message received from a peer
+ * \param peerlist Pointer to an mchat peerlist object
+ * \param index Index of the peer to inspect
+ * \param t Pointer to a long to put the time into (UNIX epoch time in microseconds, 0 if the
+ *          peer has not sent any TEXT messages)
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_peer_get_last_text(mchat_peerlist_t *peerlist, unsigned int index, long *t);
+
+/*!
+ * \brief Get the keepalive inter-arrival jitter of a peer
+ * \param peerlist Pointer to an mchat peerlist object
+ * \param index Index of the peer to inspect
+ * \param jitter Pointer to a long to put the jitter into (in microseconds)
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * The jitter is a smoothed estimate (as in RFC 3550) of how far apart the peer's keepalives on
+ * the common channel arrive from the keepalive interval.
+ */
+int mchatv1_peer_get_jitter(mchat_peerlist_t *peerlist, unsigned int index, long *jitter);
+
+/*!
+ * \brief Get the estimated packet loss from a peer
+ * \param peerlist Pointer to an mchat peerlist object
+ * \param index Index of the peer to inspect
+ * \param loss Pointer to a double to put the loss ratio into (0.0 to 1.0)
+ * \return 0 on success, 1 if not enough keepalives have been seen yet, or -1 on error
+ *
+ * \details
+ * MChat messages carry no sequence numbers, so loss is estimated by comparing the number of
+ * keepalives received on the common channel to the number the peer should have sent in the
+ * same time.  Peers in stealth mode send no keepalives and never have a loss estimate.
+ */
+int mchatv1_peer_get_loss(mchat_peerlist_t *peerlist, unsigned int index, double *loss);
+
 /*!
  * \brief Get the most relevant information about a peer in the peerlist at the specified index
  * \param peerlist Pointer to an mchat peerlist object
@@ -600,4 +1473,117 @@ int mchatv1_peerlist_destroy(mchat_peerlist_t **peerlist);
 
 /*! @} */
 
+
+/*!
+ * \name MChat Peer Event API
+ * \details
+ * Instead of fetching and diffing the whole peer list, applications can follow
+ * peer changes as a stream of events.  Events are kept in a bounded queue
+ * (::MCHAT_LIMIT_MAX_PEER_EVENTS long).  If the application falls behind, the oldest
+ * events are dropped and the next batch is flagged (see ::mchatv1_peer_events_overflowed),
+ * in which case the application should refetch the full list with ::mchatv1_get_peerlist.
+ * @{
+ */
+
+//! A peer was seen for the first time
+#define MCHAT_PEER_EVENT_JOINED 1
+//! A known peer changed its nickname
+#define MCHAT_PEER_EVENT_NICKNAME_CHANGED 2
+//! A known peer changed its channel
+#define MCHAT_PEER_EVENT_CHANNEL_CHANGED 3
+//! A peer was not seen for the expire interval and was removed
+#define MCHAT_PEER_EVENT_EXPIRED 4
+
+/*!
+ * \brief Retrieve pending peer change events
+ * \param mchat Pointer to an mchat object
+ * \param events Double pointer to an mchat peer events object
+ * \param max The maximum number of events to retrieve (0 for all pending events)
+ * \return The number of events returned in \p events or -1 on error
+ *
+ * \details
+ * Events are returned oldest first and are removed from the queue.  \p events is
+ * always set on success, even when no events are pending, and must be freed with
+ * ::mchatv1_peer_events_destroy.
+ */
+int mchatv1_get_peer_events(mchat_t *mchat, mchat_peer_events_t **events, unsigned int max);
+
+/*!
+ * \brief Return the number of events in a batch
+ * \param events Pointer to an mchat peer events object
+ * \return The number of events (0 or greater) or -1 on error
+ */
+int mchatv1_peer_events_get_size(mchat_peer_events_t *events);
+
+/*!
+ * \brief Check whether events were dropped before this batch
+ * \param events Pointer to an mchat peer events object
+ * \return 1 if events were lost (refetch the peer list), 0 if not
+ */
+int mchatv1_peer_events_overflowed(mchat_peer_events_t *events);
+
+/*!
+ * \brief Get the type of an event
+ * \param events Pointer to an mchat peer events object
+ * \param index Index of the event to inspect
+ * \return One of the MCHAT_PEER_EVENT_ constants or -1 on invalid index
+ */
+int mchatv1_peer_event_get_type(mchat_peer_events_t *events, unsigned int index);
+
+/*!
+ * \brief Get the nickname of the peer an event refers to
+ * \param events Pointer to an mchat peer events object
+ * \param index Index of the event to inspect
+ * \param buf Pointer to a character buffer to place the nickname in
+ * \param buf_size Length of the buffer pointed to by \p buf (Should be MCHAT_LIMIT_MAX_NICKNAME_SIZE)
+ * \return Number of bytes copied or -1 on error
+ *
+ * \note For ::MCHAT_PEER_EVENT_NICKNAME_CHANGED this is the new nickname.
+ */
+int mchatv1_peer_event_get_name(mchat_peer_events_t *events, unsigned int index, char *buf, unsigned int buf_size);
+
+/*!
+ * \brief Get the channel name of the peer an event refers to
+ * \param events Pointer to an mchat peer events object
+ * \param index Index of the event to inspect
+ * \param buf Pointer to a character buffer to place the channel name in
+ * \param buf_size Length of the buffer pointed to by \p buf (Should be MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE)
+ * \return Number of bytes copied or -1 on error
+ *
+ * \note For ::MCHAT_PEER_EVENT_CHANNEL_CHANGED this is the new channel.
+ */
+int mchatv1_peer_event_get_channel(mchat_peer_events_t *events, unsigned int index, char *buf, unsigned int buf_size);
+
+/*!
+ * \brief Get the time an event happened
+ * \param events Pointer to an mchat peer events object
+ * \param index Index of the event to inspect
+ * \param t Pointer to a long to put the time into (UNIX epoch time in microseconds)
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_peer_event_get_timestamp(mchat_peer_events_t *events, unsigned int index, long *t);
+
+/*!
+ * \brief Get the source address of the peer an event refers to
+ * \param events Pointer to an mchat peer events object
+ * \param index Index of the event to inspect
+ * \param addr_buf Character buffer to place the IP address into
+ * \param size Size of \p addr_buf
+ * \return Number of bytes copied or -1 on error
+ *
+ * \details
+ * The source address identifies a peer across events, the same way the peer list does.
+ * \see ::mchatv1_peer_get_source_address
+ */
+int mchatv1_peer_event_get_source_address(mchat_peer_events_t *events, unsigned int index, char *addr_buf, unsigned int size);
+
+/*!
+ * \brief Free an mchat peer events object
+ * \param events Double pointer to an mchat peer events object
+ * \return 0 on success or -1 on error
+ */
+int mchatv1_peer_events_destroy(mchat_peer_events_t **events);
+
+/*! @} */
+
 #endif // MCHATV1_H
@@ -20,6 +20,10 @@
 #include "mchatv1.h"
 #include "mchatv1_structs.h"
 #include "mchatv1_threads.h"
+#include "mchatv1_reactor.h"
+#include "mchatv1_session.h"
+#include "mchatv1_delivery.h"
+#include "mchatv1_broadcast.h"
 #include "mchatv1_utils.h"
 
 
@@ -27,23 +31,36 @@
  ************************    Public API Functions    ************************
  ****************************************************************************/
 mchat_t *mchatv1_init(char *cfg_filename)
+{
+    return mchatv1_init_reactor(cfg_filename, NULL);
+}
+
+
+mchat_t *mchatv1_init_reactor(char *cfg_filename, mchat_reactor_t *reactor)
 {
     /*!
      * \todo This function needs to use configuration system eventually
      */
-    mchat_t *mchat = g_malloc(sizeof(mchat_t));
-
-    memset(mchat, 0, sizeof(mchat_t));
+    mchat_t *mchat = cache_aligned_alloc0(sizeof(mchat_t));
+    if (mchat == NULL)
+        return NULL;
+    /* Set before any thread is started */
+    mchat->reactor = reactor;
+    if (reactor != NULL)
+        g_atomic_int_inc(&reactor->users);
 
     // Initialize child structs
     mchat->nickname = g_malloc(sizeof(gchar) * MCHAT_LIMIT_MAX_NICKNAME_SIZE);
     memset(mchat->nickname, 0, sizeof(gchar) * MCHAT_LIMIT_MAX_NICKNAME_SIZE);
 
-    // Initialize the channels array
-    mchat->added_channels = g_ptr_array_new();
-    g_ptr_array_set_free_func(mchat->added_channels, mchat_channel_destroy);
-    mchat->cdsc_channels = g_ptr_array_new();
-    g_ptr_array_set_free_func(mchat->cdsc_channels, mchat_channel_destroy);
+    // Initialize the channels array (mchatv1_add_channel below takes channels_mutex)
+    g_mutex_init(&mchat->channels_mutex);
+    mchat->added_channels = channel_table_new();
+    mchat->cdsc_channels = channel_table_new();
+    g_queue_init(&mchat->cdsc_lru);
+    mchat_snapshot_slot_init(&mchat->added_snapshot);
+    mchat_snapshot_slot_init(&mchat->cdsc_snapshot);
+    chanlist_publish(mchat->cdsc_channels, &mchat->cdsc_snapshot);
 
     // Create the default #mchat channel
     mchatv1_add_channel(mchat, MCHAT_PROTOCOL_DEFAULT_CHANNEL_NAME, MCHAT_PROTOCOL_DEFAULT_CHANNEL_ADDRESS,
@@ -55,9 +72,36 @@ mchat_t *mchatv1_init(char *cfg_filename)
         g_snprintf(mchat->nickname, 16, "NoNick%u", g_random_int());
         mchat->nickname_size = strlen(mchat->nickname);
     }
+    mchat_snapshot_slot_init(&mchat->identity_snapshot);
+    mchat_snapshot_slot_init(&mchat->message_callback);
+    mchat_snapshot_slot_init(&mchat->watermark);
+    g_mutex_init(&mchat->callback_mutex);
+    identity_publish(mchat);	/* Formatters always find an identity */
     mchat->peerlist = g_array_new(FALSE, FALSE, sizeof(mchat_peer));
+    g_array_set_clear_func(mchat->peerlist, peerlist_peer_clear);
+    mchat->peerlist_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    mchat->channel_members = g_hash_table_new_full(mchat_istr_hash_func, mchat_istr_equal_func,
+                                                   NULL, channel_members_destroy);
     g_mutex_init(&mchat->peerlist_mutex);
-    g_mutex_init(&mchat->channels_mutex);
+    mchat_snapshot_slot_init(&mchat->peerlist_snapshot);
+    mchat->peer_events = g_malloc(sizeof(mchat_peer_event) * MCHAT_LIMIT_MAX_PEER_EVENTS);
+    peerlist_publish(mchat);	/* Readers always find a (possibly empty) list */
+    mchat->joined_channels = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, mchat_channel_destroy);
+    mchat->join_sockets = g_ptr_array_new_with_free_func(join_socket_destroy);
+    mchat->join_wakeup = g_cancellable_new();
+    g_mutex_init(&mchat->join_mutex);
+    g_queue_init(&mchat->warm_sockets);
+    mchat->topic_subscriptions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    mchat->source_allow = g_hash_table_new(g_direct_hash, g_direct_equal);
+    mchat->source_block = g_hash_table_new(g_direct_hash, g_direct_equal);
+    mchat->source_filter_used = 0;
+    mchat->kernel_filter = MCHAT_KERNEL_FILTER_OFF;
+    mchat->kernel_filter_used = 0;
+    g_mutex_init(&mchat->filter_mutex);
+    g_mutex_init(&mchat->tuning_mutex);
+    mchat->sessions = g_ptr_array_new();
+    g_mutex_init(&mchat->session_mutex);
+    g_mutex_init(&mchat->broadcast_mutex);
 
     // Now init the common channel
     GSocket *tsock, *rsock;
@@ -76,6 +120,7 @@ mchat_t *mchatv1_init(char *cfg_filename)
 
     g_socket_set_multicast_loopback(tsock, FALSE);
     g_socket_set_multicast_loopback(rsock, FALSE);
+    multicast_socket_isolate(rsock);
 
     g_socket_join_multicast_group(rsock, tinet, FALSE, NULL, NULL);
     g_socket_bind(rsock, raddr, TRUE, NULL);
@@ -91,40 +136,95 @@ mchat_t *mchatv1_init(char *cfg_filename)
 }
 
 
+int mchatv1_set_message_func(mchat_t *mchat, mchat_message_func func, void *user_data)
+{
+    if (mchat == NULL)
+        return -1;
+
+    /* The receive threads acquire it per message, so it can be replaced while they run */
+    mchat_callback *cb = g_malloc(sizeof(mchat_callback));
+    mchat_snapshot_init(&cb->snap, g_free);
+    cb->func = func;
+    cb->data = user_data;
+    g_mutex_lock(&mchat->callback_mutex);
+    mchat_snapshot_publish(&mchat->message_callback, cb);
+    g_mutex_unlock(&mchat->callback_mutex);
+    return 0;
+}
+
+
 int mchatv1_destroy(mchat_t **mchat)
 {
     // make sure we are disconnected
     mchatv1_disconnect(*mchat);
 
-    mchatv1_thread_destroy(&(*mchat)->comm_send_thread);
+    /* Comm recv watches its sibling, so it has to go first */
     mchatv1_thread_destroy(&(*mchat)->comm_recv_thread);
+    mchatv1_thread_destroy(&(*mchat)->comm_send_thread);
+    if ((*mchat)->multi_recv_thread != NULL)
+        mchatv1_thread_destroy(&(*mchat)->multi_recv_thread);
+    g_hash_table_destroy((*mchat)->joined_channels);
+    g_ptr_array_free((*mchat)->join_sockets, TRUE);
+    g_object_unref((*mchat)->join_wakeup);
+    g_mutex_clear(&(*mchat)->join_mutex);
+    g_hash_table_destroy((*mchat)->topic_subscriptions);
+    g_hash_table_destroy((*mchat)->source_allow);
+    g_hash_table_destroy((*mchat)->source_block);
+    g_mutex_clear(&(*mchat)->filter_mutex);
+    for (int i = 0; i < MCHAT_THREAD_ROLE_COUNT; i++)
+        if ((*mchat)->thread_tuning[i].cpus != NULL)
+            g_array_unref((*mchat)->thread_tuning[i].cpus);
+    g_mutex_clear(&(*mchat)->tuning_mutex);
+    mchat_session_destroy_all(*mchat);
+    g_ptr_array_free((*mchat)->sessions, TRUE);
+    g_mutex_clear(&(*mchat)->session_mutex);
+    mchat_broadcast_destroy(*mchat);
+    g_mutex_clear(&(*mchat)->broadcast_mutex);
+    mchat_warm_socket *ws;
+    while ((ws = g_queue_pop_head(&(*mchat)->warm_sockets)) != NULL)
+        warm_socket_destroy(ws);
     // Free our glib data structures
-    g_ptr_array_free((*mchat)->added_channels, TRUE);
-    g_ptr_array_free((*mchat)->cdsc_channels, TRUE);
+    channel_table_destroy((*mchat)->added_channels);
+    channel_table_destroy((*mchat)->cdsc_channels);
+    g_queue_clear(&(*mchat)->cdsc_lru);
+    mchat_snapshot_slot_clear(&(*mchat)->added_snapshot);
+    mchat_snapshot_slot_clear(&(*mchat)->cdsc_snapshot);
+    mchat_snapshot_slot_clear(&(*mchat)->identity_snapshot);
+    mchat_snapshot_slot_clear(&(*mchat)->message_callback);
+    mchat_snapshot_slot_clear(&(*mchat)->watermark);
+    g_mutex_clear(&(*mchat)->callback_mutex);
+    g_hash_table_destroy((*mchat)->channel_members);
+    g_hash_table_destroy((*mchat)->peerlist_index);
     g_array_unref((*mchat)->peerlist);
+    mchat_snapshot_slot_clear(&(*mchat)->peerlist_snapshot);
+    for (guint32 i = 0; i < (*mchat)->peer_events_count; i++)
+        peerlist_peer_clear(&(*mchat)->peer_events[((*mchat)->peer_events_head + i) % MCHAT_LIMIT_MAX_PEER_EVENTS].peer);
+    g_free((*mchat)->peer_events);
     g_mutex_clear(&(*mchat)->peerlist_mutex);
     g_mutex_clear(&(*mchat)->channels_mutex);
+    if ((*mchat)->reactor != NULL)
+        g_atomic_int_add(&(*mchat)->reactor->users, -1);
     // Free nickname buffer
     g_free((*mchat)->nickname);
-    g_free(*mchat);
+    cache_aligned_free(*mchat);
     return 0;
 }
 
 
 int mchatv1_get_stealth_mode(mchat_t *mchat)
 {
-    return mchat->stealth_mode;
+    return g_atomic_int_get(&mchat->stealth_mode);
 }
 
 
 int mchatv1_set_stealth_mode(mchat_t *mchat, int stealth)
 {
     if (stealth != 0)
-        mchat->stealth_mode = 1;
+        g_atomic_int_set(&mchat->stealth_mode, 1);
     else
-        mchat->stealth_mode = 0;
+        g_atomic_int_set(&mchat->stealth_mode, 0);
 
-    return mchat->stealth_mode;
+    return g_atomic_int_get(&mchat->stealth_mode);
 }
 
 
@@ -137,25 +237,27 @@ int mchatv1_connect(mchat_t *mchat, char *channel)
     GInetAddress *rinet;
     GSocketAddress *taddr, *raddr;
 
+    g_mutex_lock(&mchat->channels_mutex);
     mchat_channel *c = channel_query_by_name(mchat->added_channels, channel);
-    if (c == NULL)
+    rsock = c != NULL ? warm_socket_take(mchat, c) : NULL;
+    if (rsock == NULL)
+    {
+        g_mutex_unlock(&mchat->channels_mutex);
         return -1;
-
+    }
+    /* Published before the send thread formats its first PING */
     mchat->current_channel = c;
+    identity_publish(mchat);
     taddr = g_inet_socket_address_new(c->channel_address, c->channel_portno);
-    tsock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
-                         G_SOCKET_PROTOCOL_UDP, NULL);
+    guint16 portno = c->channel_portno;
+    g_mutex_unlock(&mchat->channels_mutex);
 
-    rinet = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
-    raddr = g_inet_socket_address_new(rinet, c->channel_portno);
-    rsock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+    tsock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
                          G_SOCKET_PROTOCOL_UDP, NULL);
-
     g_socket_set_multicast_loopback(tsock, FALSE);
-    g_socket_set_multicast_loopback(rsock, FALSE);
-    g_socket_join_multicast_group(rsock, c->channel_address, FALSE, NULL, NULL);
 
-    g_socket_bind(rsock, raddr, TRUE, NULL);
+    rinet = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+    raddr = g_inet_socket_address_new(rinet, portno);
     g_object_unref(rinet);
 
     mchatv1_thread_init(mchat, &mchat->text_send_thread, "Text Send",
@@ -163,7 +265,68 @@ int mchatv1_connect(mchat_t *mchat, char *channel)
     mchatv1_thread_init(mchat, &mchat->text_recv_thread, "Text Recv",
                         raddr, rsock, mchatv1_thread_text_recv, NULL);
 
-    mchat->is_connected = 1;
+    /* Whoever checks is_connected under channels_mutex may use the text threads */
+    g_mutex_lock(&mchat->channels_mutex);
+    g_atomic_int_set(&mchat->is_connected, 1);
+    g_mutex_unlock(&mchat->channels_mutex);
+    return 0;
+}
+
+
+int mchatv1_switch_channel(mchat_t *mchat, char *channel)
+{
+    if (!g_atomic_int_get(&mchat->is_connected))
+        return mchatv1_connect(mchat, channel);
+    if (channel == NULL)
+        channel = "#mchat";
+
+    g_mutex_lock(&mchat->channels_mutex);
+    if (!g_atomic_int_get(&mchat->is_connected))
+    {
+        g_mutex_unlock(&mchat->channels_mutex);
+        return -1;
+    }
+    mchat_thread *send = mchat->text_send_thread;
+    mchat_thread *recv = mchat->text_recv_thread;
+    mchat_channel *c = channel_query_by_name(mchat->added_channels, channel);
+    if (c == NULL || c == mchat->current_channel)
+    {
+        g_mutex_unlock(&mchat->channels_mutex);
+        return c == NULL ? -1 : 0;
+    }
+    GSocket *rsock = warm_socket_take(mchat, c);
+    if (rsock == NULL)
+    {
+        g_mutex_unlock(&mchat->channels_mutex);
+        return -1;
+    }
+
+    /* Hand the new socket to the receive thread and park the one it is leaving.  If a
+     * previous switch has not been picked up yet, that socket is the one being left. */
+    g_mutex_lock(&recv->mutex);
+    topic_unsubscribe_all(mchat, recv->next_sock ? recv->next_sock : recv->sock);
+    if (recv->next_sock != NULL)
+    {
+        warm_socket_put(mchat, mchat->current_channel, recv->next_sock);
+        g_object_unref(recv->next_sock);
+    }
+    else
+        warm_socket_put(mchat, mchat->current_channel, recv->sock);
+    recv->next_sock = rsock;
+    g_cancellable_cancel(recv->cancel);
+    g_mutex_unlock(&recv->mutex);
+
+    /* Point the send thread at the new group and wake it, so it announces us there */
+    GSocketAddress *taddr = g_inet_socket_address_new(c->channel_address, c->channel_portno);
+    g_mutex_lock(&send->mutex);
+    g_object_unref(send->addr);
+    send->addr = taddr;
+    mchat->current_channel = c;
+    identity_publish(mchat);
+    mchatv1_thread_wake(send);
+    g_mutex_unlock(&send->mutex);
+    g_mutex_unlock(&mchat->channels_mutex);
+
     return 0;
 }
 
@@ -171,15 +334,26 @@ int mchatv1_connect(mchat_t *mchat, char *channel)
 int mchatv1_disconnect(mchat_t *mchat)
 {
     // Don't disconnect if we never connected in the first place
-    if (!mchat->is_connected)
+    if (!g_atomic_int_get(&mchat->is_connected))
         return -1;
 
+    /* Keep the receive socket warm in case we come back to this channel */
+    mchat_thread *recv = mchat->text_recv_thread;
+    g_mutex_lock(&mchat->channels_mutex);
+    g_mutex_lock(&recv->mutex);
+    topic_unsubscribe_all(mchat, recv->next_sock ? recv->next_sock : recv->sock);
+    warm_socket_put(mchat, mchat->current_channel, recv->next_sock ? recv->next_sock : recv->sock);
+    g_mutex_unlock(&recv->mutex);
+    /* From here on nobody else touches the text threads */
+    g_atomic_int_set(&mchat->is_connected, 0);
+    g_mutex_unlock(&mchat->channels_mutex);
+
     mchatv1_thread_destroy(&mchat->text_recv_thread);
     mchatv1_thread_destroy(&mchat->text_send_thread);
     /* Make sure comm_send or comm_recv is not using channel info */
     g_mutex_lock(&mchat->channels_mutex);
-    mchat->is_connected = 0;
     mchat->current_channel = NULL;
+    identity_publish(mchat);
     g_mutex_unlock(&mchat->channels_mutex);
 
     return 0;
@@ -188,53 +362,521 @@ int mchatv1_disconnect(mchat_t *mchat)
 
 int mchatv1_is_connected(mchat_t *mchat)
 {
-    return mchat->is_connected;
+    return g_atomic_int_get(&mchat->is_connected);
 }
 
 
-int mchatv1_send_message(mchat_t *mchat, char *message)
+/*!
+ * \brief Hand a text message to the text send thread
+ * \param mchat Pointer to a connected mchat object
+ * \param nickname Nickname to send the message as
+ * \param nickname_size Length of \p nickname
+ * \param topic Topic of the message or NULL
+ * \param message Message text
+ * \return 0 on success or -1 on error
+ */
+static int mchatv1_send_text(mchat_t *mchat, const gchar *nickname, guint8 nickname_size,
+                             char *topic, char *message)
 {
-    if (!mchat->is_connected)
+    if (!g_atomic_int_get(&mchat->is_connected))
         return -1;
 
-    if (mchat->text_send_thread->run_flag == 0)
+    if (g_atomic_int_get(&mchat->text_send_thread->run_flag) == 0)
         return -1;
 
     int len = strlen(message);
     if (len > MCHAT_LIMIT_MAX_MESSAGE_SIZE || len == 0)
         return -1;
+    int topic_len = topic != NULL ? strlen(topic) : 0;
+    if (topic_len >= MCHAT_LIMIT_MAX_TOPIC_SIZE)
+        return -1;
+
+    /* current_channel changes under channels_mutex, which must not be held while waiting
+     * for the send thread, so the shard group is worked out first */
+    GSocketAddress *send_addr = NULL;
+    if (topic_len)
+    {
+        g_mutex_lock(&mchat->channels_mutex);
+        mchat_channel *c = mchat->current_channel;
+        if (c != NULL && c->shard_count)
+        {
+            GInetAddress *group = mchat_channel_shard_address(c, mchat_channel_topic_shard(c, topic));
+            send_addr = g_inet_socket_address_new(group, c->channel_portno);
+            g_object_unref(group);
+        }
+        g_mutex_unlock(&mchat->channels_mutex);
+    }
+
+    mchat_thread *t = mchat->text_send_thread;
+    g_mutex_lock(&t->mutex);
+    if (g_atomic_int_get(&t->buffer_flag))
+        g_cond_wait(&t->cond, &t->mutex);
+
+    memset(t->buffer->body, 0, MCHAT_LIMIT_MAX_MESSAGE_SIZE);
+    memset(t->buffer->nickname, 0, MCHAT_LIMIT_MAX_NICKNAME_SIZE);
+    memcpy(t->buffer->body, message, len);
+    memcpy(t->buffer->nickname, nickname, nickname_size);
+    t->buffer->nickname_len = nickname_size;
+    memcpy(t->buffer->topic, topic, topic_len);
+    t->buffer->topic[topic_len] = '\0';
+
+    t->send_addr = send_addr;
+    g_atomic_int_set(&t->buffer_flag, 1);
+
+    int ret = 0;
+    /* A reactor has no send thread to hand the message to */
+    if (t->events != NULL)
+        ret = mchat_reactor_text_send(t);
+    else
+        g_cond_broadcast(&t->cond);
+    g_mutex_unlock(&t->mutex);
+    return ret;
+}
+
+
+int mchatv1_send_message(mchat_t *mchat, char *message)
+{
+    /* Copy the nickname from the published identity; set_nickname may be rewriting mchat->nickname */
+    mchat_identity *id = mchat_snapshot_acquire(&mchat->identity_snapshot);
+    int ret = mchatv1_send_text(mchat, id->nickname, id->nickname_size, NULL, message);
+    mchat_snapshot_unref(id);
+    return ret;
+}
+
+
+int mchatv1_send_topic_message(mchat_t *mchat, char *topic, char *message)
+{
+    if (topic == NULL || topic[0] == '\0')
+        return -1;
+    mchat_identity *id = mchat_snapshot_acquire(&mchat->identity_snapshot);
+    int ret = mchatv1_send_text(mchat, id->nickname, id->nickname_size, topic, message);
+    mchat_snapshot_unref(id);
+    return ret;
+}
+
+
+int mchatv1_session_send_message(mchat_session_t *session, char *message)
+{
+    if (session == NULL)
+        return -1;
+    return mchatv1_send_text(session->mchat, session->nickname, session->nickname_size, NULL, message);
+}
 
-    g_mutex_lock(&mchat->text_send_thread->mutex);
-    if (mchat->text_send_thread->buffer_flag)
-        g_cond_wait(&mchat->text_send_thread->cond, &mchat->text_send_thread->mutex);
 
-    memset(mchat->text_send_thread->buffer->body, 0, MCHAT_LIMIT_MAX_MESSAGE_SIZE);
-    memset(mchat->text_send_thread->buffer->nickname, 0, MCHAT_LIMIT_MAX_NICKNAME_SIZE);
-    memcpy(mchat->text_send_thread->buffer->body, message, len);
-    memcpy(mchat->text_send_thread->buffer->nickname, mchat->nickname, mchat->nickname_size);
-    mchat->text_send_thread->buffer_flag = 1;
+int mchatv1_session_send_topic_message(mchat_session_t *session, char *topic, char *message)
+{
+    if (session == NULL || topic == NULL || topic[0] == '\0')
+        return -1;
+    return mchatv1_send_text(session->mchat, session->nickname, session->nickname_size, topic, message);
+}
+
+
+int mchatv1_subscribe_topic(mchat_t *mchat, char *topic)
+{
+    if (!g_atomic_int_get(&mchat->is_connected) || topic == NULL || strlen(topic) >= MCHAT_LIMIT_MAX_TOPIC_SIZE)
+        return -1;
+
+    int ret = 0;
+    g_mutex_lock(&mchat->channels_mutex);
+    mchat_channel *c = mchat->current_channel;
+    if (c->shard_count && !g_hash_table_contains(mchat->topic_subscriptions, topic))
+    {
+        guint shard = mchat_channel_topic_shard(c, topic);
+        if (mchat->shard_members[shard] == 0)
+        {
+            /* Join on the socket of the current channel, even if the receive thread
+             * has not switched to it yet */
+            mchat_thread *recv = mchat->text_recv_thread;
+            GInetAddress *group = mchat_channel_shard_address(c, shard);
+            g_mutex_lock(&recv->mutex);
+            GSocket *sock = recv->next_sock ? recv->next_sock : recv->sock;
+            if (!g_socket_join_multicast_group(sock, group, FALSE, NULL, NULL))
+                ret = -1;
+            else if (source_filter_apply(mchat, sock, group) == -1)
+            {
+                /* Stay out rather than receive from blocked senders */
+                g_socket_leave_multicast_group(sock, group, FALSE, NULL, NULL);
+                ret = -1;
+            }
+            g_mutex_unlock(&recv->mutex);
+            g_object_unref(group);
+        }
+        if (ret == 0)
+        {
+            mchat->shard_members[shard]++;
+            g_hash_table_insert(mchat->topic_subscriptions, g_strdup(topic), GUINT_TO_POINTER(shard));
+        }
+    }
+    g_mutex_unlock(&mchat->channels_mutex);
+    return ret;
+}
+
+
+int mchatv1_unsubscribe_topic(mchat_t *mchat, char *topic)
+{
+    if (!g_atomic_int_get(&mchat->is_connected) || topic == NULL)
+        return -1;
 
-    g_cond_broadcast(&mchat->text_send_thread->cond);
-    g_mutex_unlock(&mchat->text_send_thread->mutex);
+    gpointer value;
+    g_mutex_lock(&mchat->channels_mutex);
+    if (!g_hash_table_lookup_extended(mchat->topic_subscriptions, topic, NULL, &value))
+    {
+        g_mutex_unlock(&mchat->channels_mutex);
+        return -1;
+    }
+    guint shard = GPOINTER_TO_UINT(value);
+    g_hash_table_remove(mchat->topic_subscriptions, topic);
+    if (--mchat->shard_members[shard] == 0)
+    {
+        mchat_thread *recv = mchat->text_recv_thread;
+        GInetAddress *group = mchat_channel_shard_address(mchat->current_channel, shard);
+        g_mutex_lock(&recv->mutex);
+        g_socket_leave_multicast_group(recv->next_sock ? recv->next_sock : recv->sock,
+                                       group, FALSE, NULL, NULL);
+        g_mutex_unlock(&recv->mutex);
+        g_object_unref(group);
+    }
+    g_mutex_unlock(&mchat->channels_mutex);
     return 0;
 }
 
 
-int mchatv1_recv_message(mchat_t *mchat, mchat_message_t **message)
+/*!
+ * \brief Move a sender from one source list to the other
+ * \param mchat Pointer to an mchat object
+ * \param address IPv4 address of the sender
+ * \param add List to add the sender to
+ * \param remove List to remove the sender from
+ * \return 0 on success or -1 on error
+ */
+static int mchatv1_source_list(mchat_t *mchat, char *address, GHashTable *add, GHashTable *remove)
 {
-    //! \todo Make the return values of this function more meaningful
-    //! \todo Update function description to reflect return values
-    if (!mchat->is_connected)
+    guint32 key;
+    if (source_filter_key(address, &key) == -1)
+        return -1;
+
+    g_mutex_lock(&mchat->filter_mutex);
+    g_hash_table_remove(remove, GUINT_TO_POINTER(key));
+    g_hash_table_add(add, GUINT_TO_POINTER(key));
+    mchat->source_filter_used = 1;
+    guint8 kernel_sources = mchat->kernel_filter == MCHAT_KERNEL_FILTER_SOURCES;
+    g_mutex_unlock(&mchat->filter_mutex);
+    if (kernel_sources)
+        kernel_filter_update(mchat);
+    return source_filter_update(mchat);
+}
+
+
+int mchatv1_source_allow(mchat_t *mchat, char *address)
+{
+    return mchatv1_source_list(mchat, address, mchat->source_allow, mchat->source_block);
+}
+
+
+int mchatv1_source_block(mchat_t *mchat, char *address)
+{
+    return mchatv1_source_list(mchat, address, mchat->source_block, mchat->source_allow);
+}
+
+
+int mchatv1_source_forget(mchat_t *mchat, char *address)
+{
+    guint32 key;
+    if (source_filter_key(address, &key) == -1)
         return -1;
 
-    if (mchat->text_recv_thread->run_flag == 0)
+    g_mutex_lock(&mchat->filter_mutex);
+    gboolean found = g_hash_table_remove(mchat->source_allow, GUINT_TO_POINTER(key));
+    found |= g_hash_table_remove(mchat->source_block, GUINT_TO_POINTER(key));
+    guint8 kernel_sources = mchat->kernel_filter == MCHAT_KERNEL_FILTER_SOURCES;
+    g_mutex_unlock(&mchat->filter_mutex);
+    if (!found)
         return -1;
+    if (kernel_sources)
+        kernel_filter_update(mchat);
+    return source_filter_update(mchat);
+}
 
-    g_mutex_lock(&mchat->text_recv_thread->mutex);
 
-    if (!mchat->text_recv_thread->buffer_flag)
+int mchatv1_source_clear(mchat_t *mchat)
+{
+    g_mutex_lock(&mchat->filter_mutex);
+    g_hash_table_remove_all(mchat->source_allow);
+    g_hash_table_remove_all(mchat->source_block);
+    guint8 kernel_sources = mchat->kernel_filter == MCHAT_KERNEL_FILTER_SOURCES;
+    g_mutex_unlock(&mchat->filter_mutex);
+    if (kernel_sources)
+        kernel_filter_update(mchat);
+    /* An empty block list is an ordinary any-source membership */
+    return source_filter_update(mchat);
+}
+
+
+int mchatv1_set_kernel_filter(mchat_t *mchat, int mode)
+{
+    if (mode < MCHAT_KERNEL_FILTER_OFF || mode > MCHAT_KERNEL_FILTER_SOURCES)
+        return -1;
+
+    g_mutex_lock(&mchat->filter_mutex);
+    guint8 old = mchat->kernel_filter;
+    mchat->kernel_filter = (guint8)mode;
+    if (mode != MCHAT_KERNEL_FILTER_OFF)
+        mchat->kernel_filter_used = 1;
+    g_mutex_unlock(&mchat->filter_mutex);
+    if (kernel_filter_update(mchat) == -1)
     {
-        g_mutex_unlock(&mchat->text_recv_thread->mutex);
+        g_mutex_lock(&mchat->filter_mutex);
+        mchat->kernel_filter = old;
+        g_mutex_unlock(&mchat->filter_mutex);
+        kernel_filter_update(mchat);
+        return -1;
+    }
+    return 0;
+}
+
+
+int mchatv1_get_kernel_filter(mchat_t *mchat)
+{
+    g_mutex_lock(&mchat->filter_mutex);
+    int mode = mchat->kernel_filter;
+    g_mutex_unlock(&mchat->filter_mutex);
+    return mode;
+}
+
+
+/*!
+ * \brief Change part of the tuning of a thread role and apply it to the running thread of that role
+ * \param mchat Pointer to an mchat object run by threads
+ * \param role One of the MCHAT_THREAD_ROLE_* values
+ * \param tuning New tuning (the cpus array is owned by mchat on success, freed on error)
+ * \param field The MCHAT_TUNING_* field of tuning that changed
+ * \return 0 on success or -1 on error
+ */
+static int mchatv1_thread_tune(mchat_t *mchat, int role, mchat_thread_tuning *tuning, guint field)
+{
+    /* The text threads exist while connected, which cannot change under channels_mutex,
+     * and the multi recv thread is started under join_mutex */
+    g_mutex_lock(&mchat->channels_mutex);
+    g_mutex_lock(&mchat->join_mutex);
+    gboolean connected = g_atomic_int_get(&mchat->is_connected);
+    mchat_thread *threads[MCHAT_THREAD_ROLE_COUNT] =
+    {
+        connected ? mchat->text_send_thread : NULL, connected ? mchat->text_recv_thread : NULL,
+        mchat->comm_send_thread, mchat->comm_recv_thread, mchat->fileio_thread,
+        mchat->multi_recv_thread
+    };
+    int ret = 0;
+    g_mutex_lock(&mchat->tuning_mutex);
+    mchat_thread *t = threads[role];
+    if (t != NULL && t->tid != 0)
+        ret = thread_tuning_apply(t, tuning, field);
+    if (ret == 0)
+    {
+        if (mchat->thread_tuning[role].cpus != NULL)
+            g_array_unref(mchat->thread_tuning[role].cpus);
+        tuning->configured |= field;
+        mchat->thread_tuning[role] = *tuning;
+    }
+    else if (tuning->cpus != NULL)
+        g_array_unref(tuning->cpus);
+    g_mutex_unlock(&mchat->tuning_mutex);
+    g_mutex_unlock(&mchat->join_mutex);
+    g_mutex_unlock(&mchat->channels_mutex);
+    return ret;
+}
+
+
+int mchatv1_set_thread_affinity(mchat_t *mchat, int role, const int *cpus, unsigned int count)
+{
+    if (mchat->reactor != NULL || role < 0 || role >= MCHAT_THREAD_ROLE_COUNT)
+        return -1;
+    if (count && cpus == NULL)
+        return -1;
+#ifdef __linux__
+    for (unsigned int i = 0; i < count; i++)
+        if (!thread_tuning_cpu_valid(cpus[i]))
+            return -1;
+
+    g_mutex_lock(&mchat->tuning_mutex);
+    mchat_thread_tuning tuning = mchat->thread_tuning[role];
+    g_mutex_unlock(&mchat->tuning_mutex);
+    tuning.cpus = NULL;
+    if (count)
+    {
+        tuning.cpus = g_array_sized_new(FALSE, FALSE, sizeof(gint), count);
+        g_array_append_vals(tuning.cpus, cpus, count);
+    }
+    return mchatv1_thread_tune(mchat, role, &tuning, MCHAT_TUNING_AFFINITY);
+#else
+    return -1;
+#endif
+}
+
+
+int mchatv1_set_thread_scheduling(mchat_t *mchat, int role, int nice, int fifo_priority)
+{
+    if (mchat->reactor != NULL || role < 0 || role >= MCHAT_THREAD_ROLE_COUNT)
+        return -1;
+    if (nice < -20 || nice > 19 || fifo_priority < 0 || fifo_priority > 99)
+        return -1;
+#ifdef __linux__
+    g_mutex_lock(&mchat->tuning_mutex);
+    mchat_thread_tuning tuning = mchat->thread_tuning[role];
+    if (tuning.cpus != NULL)
+        g_array_ref(tuning.cpus);
+    g_mutex_unlock(&mchat->tuning_mutex);
+    tuning.nice = nice;
+    tuning.fifo_priority = fifo_priority;
+    return mchatv1_thread_tune(mchat, role, &tuning, MCHAT_TUNING_SCHEDULING);
+#else
+    return -1;
+#endif
+}
+
+
+int mchatv1_set_busy_poll(mchat_t *mchat, unsigned int usec)
+{
+    if (mchat->reactor != NULL)
+        return -1;
+#ifdef __linux__
+    g_mutex_lock(&mchat->tuning_mutex);
+    mchat_thread_tuning tuning = mchat->thread_tuning[MCHAT_THREAD_ROLE_TEXT_RECV];
+    if (tuning.cpus != NULL)
+        g_array_ref(tuning.cpus);
+    g_mutex_unlock(&mchat->tuning_mutex);
+    tuning.busy_poll = usec;
+    return mchatv1_thread_tune(mchat, MCHAT_THREAD_ROLE_TEXT_RECV, &tuning, MCHAT_TUNING_BUSY_POLL);
+#else
+    return -1;
+#endif
+}
+
+
+int mchatv1_set_parse_workers(mchat_t *mchat, unsigned int workers)
+{
+    if (mchat->reactor != NULL || workers > MCHAT_LIMIT_MAX_PARSE_WORKERS)
+        return -1;
+    g_atomic_int_set(&mchat->parse_workers, workers);
+    return 0;
+}
+
+
+int mchatv1_get_control_counters(mchat_t *mchat, unsigned int *coalesced, unsigned int *dropped)
+{
+    if (mchat == NULL)
+        return -1;
+
+    if (coalesced != NULL)
+        *coalesced = g_atomic_int_get(&mchat->control_coalesced);
+    if (dropped != NULL)
+        *dropped = g_atomic_int_get(&mchat->control_dropped);
+    return 0;
+}
+
+
+int mchatv1_set_delivery_policy(mchat_t *mchat, int policy)
+{
+    if (mchat == NULL || policy < MCHAT_DELIVERY_BLOCK || policy > MCHAT_DELIVERY_SPILL)
+        return -1;
+
+    g_atomic_int_set(&mchat->delivery.policy, policy);
+    /* Nothing may be left waiting under a policy that no longer blocks */
+    mchatv1_thread_release_recv(mchat);
+    return 0;
+}
+
+
+int mchatv1_get_delivery_counters(mchat_t *mchat, unsigned int *delivered, unsigned int *dropped,
+                                  unsigned int *spilled, unsigned int *blocked)
+{
+    if (mchat == NULL)
+        return -1;
+
+    if (delivered != NULL)
+        *delivered = g_atomic_int_get(&mchat->delivery.delivered);
+    if (dropped != NULL)
+        *dropped = g_atomic_int_get(&mchat->delivery.dropped);
+    if (spilled != NULL)
+        *spilled = g_atomic_int_get(&mchat->delivery.spilled);
+    if (blocked != NULL)
+        *blocked = g_atomic_int_get(&mchat->delivery.blocked);
+    return 0;
+}
+
+
+int mchatv1_set_delivery_watermark(mchat_t *mchat, unsigned int high, mchat_watermark_func func, void *user_data)
+{
+    if (mchat == NULL || (high > 0 && func == NULL))
+        return -1;
+
+    /* The receive threads acquire it per check, so it can be replaced while they run */
+    mchat_watermark *wm = g_malloc(sizeof(mchat_watermark));
+    mchat_snapshot_init(&wm->snap, g_free);
+    wm->high = high;
+    wm->func = func;
+    wm->data = user_data;
+    g_mutex_lock(&mchat->callback_mutex);
+    mchat_snapshot_publish(&mchat->watermark, wm);
+    g_mutex_unlock(&mchat->callback_mutex);
+    return 0;
+}
+
+
+/*!
+ * \brief Hand a receive thread's buffer back after its message was taken
+ * \param t Pointer to a text receive thread (mutex held)
+ *
+ * \details
+ * Refills the buffer with the oldest spilled message, if any, and lets the receive
+ * path continue.
+ */
+static void mchatv1_recv_release(mchat_thread *t)
+{
+    g_atomic_int_set(&t->buffer_flag, 0);
+    if (t->spill != NULL && t->spill->count > 0)
+    {
+        guint lost;
+        mchat_message_t *next = mchat_spill_pop(t->spill, &lost);
+        if (next != NULL)
+        {
+            mchat_delivery_message_load(t->buffer, next);
+            mchatv1_message_destroy(&next);
+            g_atomic_int_set(&t->buffer_flag, 1);
+            g_atomic_int_inc(&t->mchat->delivery.delivered);
+        }
+        g_atomic_int_add(&t->mchat->delivery.dropped, lost);
+    }
+    /* Only rearms the watermark, as the backlog just shrank */
+    mchat_watermark *wm = mchat_snapshot_acquire(&t->mchat->watermark);
+    mchat_delivery_watermark(wm, g_atomic_int_get(&t->buffer_flag) +
+                             (t->spill != NULL ? t->spill->count : 0), &t->above_watermark);
+    if (wm != NULL)
+        mchat_snapshot_unref(wm);
+    g_cond_broadcast(&t->cond);
+    if (t->events != NULL)
+        mchat_reactor_resume(t);
+}
+
+
+/*!
+ * \brief Take the message waiting in a receive thread's buffer
+ * \param t Pointer to a text receive thread
+ * \param message Double pointer to an mchat message object
+ * \return 1 on available message, 0 on no message, and -1 on error
+ */
+static int mchatv1_recv_message_from(mchat_thread *t, mchat_message_t **message)
+{
+    if (g_atomic_int_get(&t->run_flag) == 0)
+        return -1;
+    /* Polling callers mostly find nothing, which needs no lock to tell */
+    if (!g_atomic_int_get(&t->buffer_flag))
+        return 0;
+
+    g_mutex_lock(&t->mutex);
+
+    if (!g_atomic_int_get(&t->buffer_flag))
+    {
+        g_mutex_unlock(&t->mutex);
         return 0;
     }
 
@@ -242,43 +884,234 @@ int mchatv1_recv_message(mchat_t *mchat, mchat_message_t **message)
 
     char *body = g_malloc(MCHAT_LIMIT_MAX_MESSAGE_SIZE);
     char *nickname = g_malloc(MCHAT_LIMIT_MAX_NICKNAME_SIZE);
-    memcpy(m, mchat->text_recv_thread->buffer, sizeof(mchat_message_t));
+    memcpy(m, t->buffer, sizeof(mchat_message_t));
     memset(body, 0, MCHAT_LIMIT_MAX_MESSAGE_SIZE);
     memset(nickname, 0, MCHAT_LIMIT_MAX_NICKNAME_SIZE);
     m->body = body;
     m->nickname = nickname;
-    memcpy(m->body, mchat->text_recv_thread->buffer->body, m->body_len);
-    memcpy(m->nickname, mchat->text_recv_thread->buffer->nickname, m->nickname_len);
-    mchat->text_recv_thread->buffer_flag = 0;
-    g_cond_broadcast(&mchat->text_recv_thread->cond);
-    g_mutex_unlock(&mchat->text_recv_thread->mutex);
+    memcpy(m->body, t->buffer->body, m->body_len);
+    memcpy(m->nickname, t->buffer->nickname, m->nickname_len);
+    mchatv1_recv_release(t);
+    g_mutex_unlock(&t->mutex);
 
     *message = m;
     return 1;
 }
 
 
+/*!
+ * \brief Take the messages waiting in a receive thread's buffer and spill
+ * \param t Pointer to a text receive thread
+ * \param messages Array to store the messages in
+ * \param max Length of \p messages (at least 1)
+ * \return Number of messages stored or -1 on error
+ *
+ * \details
+ * Without a spill the buffer is all there is, so this returns at most one message.
+ */
+static int mchatv1_recv_messages_from(mchat_thread *t, mchat_message_t **messages, unsigned int max)
+{
+    if (g_atomic_int_get(&t->run_flag) == 0)
+        return -1;
+    if (!g_atomic_int_get(&t->buffer_flag))
+        return 0;
+
+    g_mutex_lock(&t->mutex);
+
+    if (!g_atomic_int_get(&t->buffer_flag))
+    {
+        g_mutex_unlock(&t->mutex);
+        return 0;
+    }
+
+    /* Batches are sized to each message rather than to the largest possible one */
+    unsigned int count = 0;
+    messages[count++] = mchat_delivery_message_copy(t->buffer);
+    guint lost = 0;
+    while (count < max && t->spill != NULL && t->spill->count > 0)
+    {
+        mchat_message_t *next = mchat_spill_pop(t->spill, &lost);
+        if (next == NULL)
+            break;
+        messages[count++] = next;
+        g_atomic_int_inc(&t->mchat->delivery.delivered);
+    }
+    g_atomic_int_add(&t->mchat->delivery.dropped, lost);
+    /* The receive path is signalled once for the whole batch */
+    mchatv1_recv_release(t);
+    g_mutex_unlock(&t->mutex);
+    return count;
+}
+
+
+int mchatv1_recv_message(mchat_t *mchat, mchat_message_t **message)
+{
+    //! \todo Make the return values of this function more meaningful
+    if (!g_atomic_int_get(&mchat->is_connected) && mchat->multi_recv_thread == NULL)
+        return -1;
+
+    if (g_atomic_int_get(&mchat->is_connected))
+    {
+        int ret = mchatv1_recv_message_from(mchat->text_recv_thread, message);
+        if (ret != 0)
+            return ret;
+    }
+    if (mchat->multi_recv_thread != NULL)
+        return mchatv1_recv_message_from(mchat->multi_recv_thread, message);
+    return 0;
+}
+
+
+int mchatv1_recv_messages(mchat_t *mchat, mchat_message_t **messages, unsigned int max)
+{
+    if (mchat == NULL || messages == NULL)
+        return -1;
+    if (!g_atomic_int_get(&mchat->is_connected) && mchat->multi_recv_thread == NULL)
+        return -1;
+
+    int count = 0;
+    if (max > 0 && g_atomic_int_get(&mchat->is_connected))
+    {
+        count = mchatv1_recv_messages_from(mchat->text_recv_thread, messages, max);
+        if (count < 0)
+            return count;
+    }
+    if ((unsigned int)count < max && mchat->multi_recv_thread != NULL)
+    {
+        int ret = mchatv1_recv_messages_from(mchat->multi_recv_thread, messages + count, max - count);
+        if (ret < 0)
+            return count > 0 ? count : ret;
+        count += ret;
+    }
+    return count;
+}
+
+
+int mchatv1_join_channel(mchat_t *mchat, char *channel)
+{
+    if (channel == NULL)
+        return -1;
+
+    g_mutex_lock(&mchat->channels_mutex);
+    mchat_channel *c = channel_query_by_name(mchat->added_channels, channel);
+    if (c != NULL)
+        c = mchat_channel_copy(c);
+    g_mutex_unlock(&mchat->channels_mutex);
+    if (c == NULL)
+        return -1;
+
+    int ret = -1;
+    g_mutex_lock(&mchat->join_mutex);
+    if (!g_hash_table_contains(mchat->joined_channels, c->channel_name))
+    {
+        mchat_join_socket *js = join_socket_lookup(mchat, c->channel_portno);
+        gboolean new_socket = js == NULL;
+        if (new_socket)
+            js = join_socket_new(c->channel_portno);
+
+        /* Channels with the same address and port share one membership */
+        gboolean shared = js != NULL && join_membership_shared(mchat, c);
+        if (js != NULL && (shared ||
+                g_socket_join_multicast_group(js->sock, c->channel_address, FALSE, NULL, NULL)))
+        {
+            if (source_filter_apply(mchat, js->sock, c->channel_address) == 0)
+            {
+                if (new_socket)
+                    g_ptr_array_add(mchat->join_sockets, js);
+                js->channel_count++;
+                g_hash_table_insert(mchat->joined_channels, c->channel_name, c);
+                if (new_socket)
+                    kernel_filter_apply(mchat, js->sock, MCHAT_KERNEL_FILTER_CHANNEL_TYPES);
+                ret = 0;
+            }
+            else if (!shared)
+                g_socket_leave_multicast_group(js->sock, c->channel_address, FALSE, NULL, NULL);
+        }
+        if (ret == -1 && new_socket && js != NULL)
+            join_socket_destroy(js);
+    }
+
+    if (ret == 0 && mchat->multi_recv_thread == NULL)
+        mchatv1_thread_init(mchat, &mchat->multi_recv_thread, "Multi Recv",
+                            NULL, NULL, mchatv1_thread_multi_recv, NULL);
+    g_mutex_unlock(&mchat->join_mutex);
+
+    if (ret == 0)
+        g_cancellable_cancel(mchat->join_wakeup);
+    else
+        mchat_channel_destroy(c);
+    return ret;
+}
+
+
+int mchatv1_part_channel(mchat_t *mchat, char *channel)
+{
+    if (channel == NULL)
+        return -1;
+
+    g_mutex_lock(&mchat->join_mutex);
+    mchat_channel *c = g_hash_table_lookup(mchat->joined_channels, channel);
+    if (c == NULL)
+    {
+        g_mutex_unlock(&mchat->join_mutex);
+        return -1;
+    }
+
+    mchat_join_socket *js = join_socket_lookup(mchat, c->channel_portno);
+    if (!join_membership_shared(mchat, c))
+        g_socket_leave_multicast_group(js->sock, c->channel_address, FALSE, NULL, NULL);
+    /* The receive thread keeps its own reference until it reloads the socket set */
+    if (--js->channel_count == 0)
+        g_ptr_array_remove_fast(mchat->join_sockets, js);
+    g_hash_table_remove(mchat->joined_channels, channel);	/* frees c */
+    g_mutex_unlock(&mchat->join_mutex);
+
+    g_cancellable_cancel(mchat->join_wakeup);
+    return 0;
+}
+
+
+int mchatv1_is_joined(mchat_t *mchat, char *channel)
+{
+    if (channel == NULL)
+        return 0;
+
+    g_mutex_lock(&mchat->join_mutex);
+    int joined = g_hash_table_contains(mchat->joined_channels, channel);
+    g_mutex_unlock(&mchat->join_mutex);
+    return joined;
+}
+
+
 int mchatv1_set_nickname(mchat_t *mchat, char *new_nickname, unsigned int len)
 {
     int nickname_len = strlen(new_nickname);
     if (len > MCHAT_LIMIT_MAX_NICKNAME_SIZE || nickname_len < len)
         return -1;
 
+    /* The send paths keep using the published identity until the new one replaces it */
+    g_mutex_lock(&mchat->channels_mutex);
     memset(mchat->nickname, 0, MCHAT_LIMIT_MAX_NICKNAME_SIZE);
     memcpy(mchat->nickname, new_nickname, len);
     mchat->nickname_size = len;
+    identity_publish(mchat);
+    g_mutex_unlock(&mchat->channels_mutex);
     return 0;
 }
 
 
 int mchatv1_get_nickname(mchat_t *mchat, char *buf, unsigned int buf_size)
 {
-    if (mchat->nickname_size > buf_size)
-        return -1;
-
-    memcpy(buf, mchat->nickname, mchat->nickname_size);
-    buf[mchat->nickname_size] = '\0';
-    return mchat->nickname_size;
+    mchat_identity *id = mchat_snapshot_acquire(&mchat->identity_snapshot);
+    int ret = -1;
+    if (id->nickname_size < buf_size)
+    {
+        memcpy(buf, id->nickname, id->nickname_size);
+        buf[id->nickname_size] = '\0';
+        ret = id->nickname_size;
+    }
+    mchat_snapshot_unref(id);
+    return ret;
 }
 
 
@@ -328,6 +1161,32 @@ int mchatv1_message_get_nickname(mchat_message_t *packet, char *buf, unsigned in
     return tocopy + 1;
 }
 
+int mchatv1_message_get_channel(mchat_message_t *packet, char *buf, unsigned int len)
+{
+    if (len == 0)
+        return -1;
+
+    int tocopy = strlen(packet->channel);
+    if (tocopy >= len)
+        tocopy = len - 1;
+    memcpy(buf, packet->channel, tocopy);
+    buf[tocopy] = '\0';
+    return tocopy;
+}
+
+int mchatv1_message_get_topic(mchat_message_t *packet, char *buf, unsigned int len)
+{
+    if (len == 0)
+        return -1;
+
+    int tocopy = strlen(packet->topic);
+    if (tocopy >= len)
+        tocopy = len - 1;
+    memcpy(buf, packet->topic, tocopy);
+    buf[tocopy] = '\0';
+    return tocopy;
+}
+
 int mchatv1_message_get_timestamp(mchat_message_t *packet, long *t)
 {
     *t = packet->timestamp;
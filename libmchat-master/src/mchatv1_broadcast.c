@@ -0,0 +1,193 @@
+/*!
+ * \file mchatv1_broadcast.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Broadcast ring giving every registered reader each received text message
+ */
+#include <string.h>
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_structs.h"
+#include "mchatv1_snapshot.h"
+#include "mchatv1_threads.h"
+#include "mchatv1_delivery.h"
+#include "mchatv1_broadcast.h"
+
+
+gboolean mchat_broadcast_publish(mchat_t *mchat, mchat_parser *parser, guint32 sbytes, gint64 recv_time)
+{
+    if (g_atomic_int_get(&mchat->reader_count) == 0)
+        return FALSE;
+
+    mchat_message_t view;
+    mchat_delivery_message_view(&view, parser, sbytes, recv_time);
+
+    /* One allocation holds the entry, its nickname and its body */
+    mchat_broadcast_entry *e = g_malloc(sizeof(mchat_broadcast_entry) + view.nickname_len + view.body_len + 2);
+    mchat_snapshot_init(&e->snap, g_free);
+    memcpy(&e->message, &view, sizeof(mchat_message_t));
+    e->message.nickname = (gchar *)(e + 1);
+    e->message.body = e->message.nickname + view.nickname_len + 1;
+    memcpy(e->message.nickname, view.nickname, view.nickname_len);
+    e->message.nickname[view.nickname_len] = '\0';
+    memcpy(e->message.body, view.body, view.body_len);
+    e->message.body[view.body_len] = '\0';
+
+    mchat_broadcast *b = mchat->broadcast;
+    g_mutex_lock(&mchat->broadcast_mutex);
+    guint32 seq = g_atomic_int_get(&b->head);
+    e->seq = seq;
+    mchat_snapshot_publish(&b->slots[seq % MCHAT_LIMIT_MAX_BROADCAST_RING], e);
+    g_atomic_int_set(&b->head, seq + 1);
+    g_mutex_unlock(&mchat->broadcast_mutex);
+
+    /* Waiters announce themselves before their last look at head, so either they see
+     * the new head or we see them */
+    if (g_atomic_int_get(&b->waiters))
+    {
+        g_mutex_lock(&b->wait_mutex);
+        g_cond_broadcast(&b->wait_cond);
+        g_mutex_unlock(&b->wait_mutex);
+    }
+    return TRUE;
+}
+
+
+void mchat_broadcast_destroy(mchat_t *mchat)
+{
+    mchat_broadcast *b = mchat->broadcast;
+    if (b == NULL)
+        return;
+    for (guint i = 0; i < MCHAT_LIMIT_MAX_BROADCAST_RING; i++)
+        mchat_snapshot_slot_clear(&b->slots[i]);
+    g_cond_clear(&b->wait_cond);
+    g_mutex_clear(&b->wait_mutex);
+    g_free(b);
+    mchat->broadcast = NULL;
+}
+
+/*****************************************************************************
+ * 								Public API									 *
+ *****************************************************************************/
+
+mchat_reader_t *mchatv1_reader_new(mchat_t *mchat)
+{
+    if (mchat == NULL)
+        return NULL;
+
+    mchat_reader_t *r = g_malloc0(sizeof(mchat_reader_t));
+    r->mchat = mchat;
+
+    g_mutex_lock(&mchat->broadcast_mutex);
+    if (mchat->broadcast == NULL)
+    {
+        mchat_broadcast *b = g_malloc0(sizeof(mchat_broadcast));
+        for (guint i = 0; i < MCHAT_LIMIT_MAX_BROADCAST_RING; i++)
+            mchat_snapshot_slot_init(&b->slots[i]);
+        g_mutex_init(&b->wait_mutex);
+        g_cond_init(&b->wait_cond);
+        mchat->broadcast = b;
+    }
+    r->cursor = g_atomic_int_get(&mchat->broadcast->head);
+    /* The receive paths only look at broadcast once they see a reader */
+    g_atomic_int_inc(&mchat->reader_count);
+    g_mutex_unlock(&mchat->broadcast_mutex);
+
+    mchatv1_thread_release_recv(mchat);
+    return r;
+}
+
+
+int mchatv1_reader_destroy(mchat_reader_t **reader)
+{
+    if (reader == NULL || *reader == NULL)
+        return -1;
+
+    mchat_reader_t *r = *reader;
+    if (r->held != NULL)
+        mchat_snapshot_unref(r->held);
+    g_atomic_int_add(&r->mchat->reader_count, -1);
+    g_free(r);
+    *reader = NULL;
+    return 0;
+}
+
+
+int mchatv1_reader_next(mchat_reader_t *reader, const mchat_message_t **message, unsigned int *missed)
+{
+    if (reader == NULL || message == NULL)
+        return -1;
+
+    if (reader->held != NULL)
+    {
+        mchat_snapshot_unref(reader->held);
+        reader->held = NULL;
+    }
+
+    mchat_broadcast *b = reader->mchat->broadcast;
+    guint32 lost = 0;
+    mchat_broadcast_entry *e;
+    while ((e = mchat_snapshot_acquire(&b->slots[reader->cursor % MCHAT_LIMIT_MAX_BROADCAST_RING])) != NULL &&
+            e->seq != reader->cursor)
+    {
+        guint32 seq = e->seq;
+        mchat_snapshot_unref(e);
+        if ((gint32)(seq - reader->cursor) < 0)
+        {
+            /* Still the previous lap, so nothing new yet */
+            e = NULL;
+            break;
+        }
+        /* Lapped: every message older than the lap of seq has been overwritten */
+        guint32 oldest = seq - MCHAT_LIMIT_MAX_BROADCAST_RING + 1;
+        lost += oldest - reader->cursor;
+        reader->cursor = oldest;
+    }
+
+    if (missed != NULL)
+        *missed = lost;
+    if (e == NULL)
+        return 0;
+
+    reader->held = e;
+    reader->cursor++;
+    *message = &e->message;
+    return 1;
+}
+
+
+int mchatv1_reader_wait(mchat_reader_t *reader, const mchat_message_t **message, unsigned int *missed, long timeout)
+{
+    if (reader == NULL || message == NULL)
+        return -1;
+
+    mchat_broadcast *b = reader->mchat->broadcast;
+    gint64 end_time = timeout >= 0 ? g_get_monotonic_time() + timeout : 0;
+    guint32 lost = 0;
+    int ret;
+    while (TRUE)
+    {
+        unsigned int skipped;
+        ret = mchatv1_reader_next(reader, message, &skipped);
+        lost += skipped;
+        if (ret != 0 || (timeout >= 0 && g_get_monotonic_time() >= end_time))
+            break;
+
+        g_mutex_lock(&b->wait_mutex);
+        g_atomic_int_inc(&b->waiters);
+        if ((guint32)g_atomic_int_get(&b->head) == reader->cursor)
+        {
+            if (timeout >= 0)
+                g_cond_wait_until(&b->wait_cond, &b->wait_mutex, end_time);
+            else
+                g_cond_wait(&b->wait_cond, &b->wait_mutex);
+        }
+        g_atomic_int_add(&b->waiters, -1);
+        g_mutex_unlock(&b->wait_mutex);
+    }
+
+    if (missed != NULL)
+        *missed = lost;
+    return ret;
+}
@@ -0,0 +1,40 @@
+/*!
+ * \file mchatv1_broadcast.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Broadcast ring giving every registered reader each received text message
+ *
+ * \details
+ * The receive paths publish each text message once, as a reference counted
+ * mchat_broadcast_entry, into the snapshot slot for its sequence number.  Readers acquire
+ * the entry at their cursor without locking; a newer sequence number in that slot means
+ * the reader was lapped.  Writers (the receive threads and parse workers) only serialize
+ * among themselves, so a slow reader never holds them up.  Readers waiting for a message
+ * announce themselves in mchat_broadcast.waiters, and only then do writers take the
+ * wait mutex to wake them.
+ */
+#ifndef MCHATV1_BROADCAST_H
+#define MCHATV1_BROADCAST_H
+
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_structs.h"
+
+/*!
+ * \brief Publish a received text message to the readers
+ * \param mchat Pointer to the mchat object the message was received by
+ * \param parser Parser holding the validated message
+ * \param sbytes Source address of the message
+ * \param recv_time Time the message was received
+ * \return TRUE if any reader is registered
+ */
+gboolean mchat_broadcast_publish(mchat_t *mchat, mchat_parser *parser, guint32 sbytes, gint64 recv_time);
+
+/*!
+ * \brief Free the broadcast ring of an mchat object
+ * \param mchat Pointer to an mchat object without readers or running threads
+ */
+void mchat_broadcast_destroy(mchat_t *mchat);
+
+#endif // MCHATV1_BROADCAST_H
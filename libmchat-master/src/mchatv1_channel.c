@@ -15,6 +15,7 @@
 #include "mchatv1.h"
 #include "mchatv1_utils.h"
 #include "mchatv1_structs.h"
+#include "mchatv1_intern.h"
 
 
 int mchatv1_add_channel(mchat_t *mchat, char *channel, char *channel_address, unsigned short channel_portno)
@@ -30,20 +31,46 @@ int mchatv1_add_channel(mchat_t *mchat, char *channel, char *channel_address, un
             return -1;
         }
         mchat_channel *newc = mchat_channel_copy(c);
-        g_ptr_array_add(mchat->added_channels, newc);
+        int ret = -1;
+        if (!channel_table_shards_overlap(mchat->added_channels, newc, newc->shard_count))
+            ret = channel_table_add(mchat->added_channels, newc);
+        if (ret == 0)
+            chanlist_publish(mchat->added_channels, &mchat->added_snapshot);
         g_mutex_unlock(&mchat->channels_mutex);
+        if (ret != 0)
+        {
+            mchat_channel_destroy(newc);
+            return -1;
+        }
     }
     else
     {
         /* This is a new channel that we need to completely define */
+        if (channel == NULL || channel_address == NULL || strlen(channel) >= MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE)
+            return -1;
+        GInetAddress *addr = g_inet_address_new_from_string(channel_address);
+        if (addr == NULL)
+            return -1;
+
         int hash = mchat_channel_hash_params(channel, channel_address, channel_portno);
         mchat_channel *c = g_malloc(sizeof(mchat_channel));
         memset(c, 0, sizeof(mchat_channel));
         memcpy(c->channel_name, channel, strlen(channel));
         c->channel_portno = channel_portno;
-        c->channel_address = g_inet_address_new_from_string(channel_address);
+        c->channel_address = addr;
         c->channel_id = hash;
-        g_ptr_array_add(mchat->added_channels, c);
+        g_mutex_lock(&mchat->channels_mutex);
+        int ret = -1;
+        if (!channel_table_shards_overlap(mchat->added_channels, c, 0))
+            ret = channel_table_add(mchat->added_channels, c);
+        if (ret == 0)
+            chanlist_publish(mchat->added_channels, &mchat->added_snapshot);
+        g_mutex_unlock(&mchat->channels_mutex);
+        if (ret != 0)
+        {
+            mchat_channel_destroy(c);
+            return -1;
+        }
     }
     return 0;
 }
@@ -54,23 +81,60 @@ int mchatv1_del_channel(mchat_t *mchat, char *channel)
     if (g_ascii_strncasecmp(channel, MCHAT_PROTOCOL_DEFAULT_CHANNEL_NAME, strlen(MCHAT_PROTOCOL_DEFAULT_CHANNEL_NAME)) == 0)
         return -1;
 
+    g_mutex_lock(&mchat->channels_mutex);
     mchat_channel *c = channel_query_by_name(mchat->added_channels, channel);
-    if (c != NULL)
+    if (c == NULL || (g_atomic_int_get(&mchat->is_connected) && mchat->current_channel == c) ||
+            mchatv1_is_joined(mchat, channel))
     {
-        if (mchat->is_connected && mchat->current_channel == c)
-            return -1;
-        g_ptr_array_remove(mchat->added_channels, c);
+        g_mutex_unlock(&mchat->channels_mutex);
+        return -1;
     }
-    else
+    warm_socket_drop(mchat, c->channel_id);
+    channel_table_remove(mchat->added_channels, c);
+    chanlist_publish(mchat->added_channels, &mchat->added_snapshot);
+    g_mutex_unlock(&mchat->channels_mutex);
+
+    return 0;
+}
+
+
+int mchatv1_set_channel_shards(mchat_t *mchat, char *channel, unsigned int shard_count)
+{
+    if (channel == NULL || shard_count > MCHAT_LIMIT_MAX_CHANNEL_SHARDS)
         return -1;
 
+    g_mutex_lock(&mchat->channels_mutex);
+    mchat_channel *c = channel_query_by_name(mchat->added_channels, channel);
+    if (c == NULL || (g_atomic_int_get(&mchat->is_connected) && mchat->current_channel == c) ||
+            mchatv1_is_joined(mchat, channel) ||
+            channel_table_shards_overlap(mchat->added_channels, c, shard_count))
+    {
+        g_mutex_unlock(&mchat->channels_mutex);
+        return -1;
+    }
+    c->shard_count = shard_count;
+    chanlist_publish(mchat->added_channels, &mchat->added_snapshot);
+    g_mutex_unlock(&mchat->channels_mutex);
     return 0;
 }
 
 
+int mchatv1_get_channel_shards(mchat_t *mchat, char *channel)
+{
+    if (channel == NULL)
+        return -1;
+
+    g_mutex_lock(&mchat->channels_mutex);
+    mchat_channel *c = channel_query_by_name(mchat->added_channels, channel);
+    int count = c != NULL ? c->shard_count : -1;
+    g_mutex_unlock(&mchat->channels_mutex);
+    return count;
+}
+
+
 int mchatv1_get_channel(mchat_t *mchat, char *buf, unsigned int buf_size)
 {
-    if (!mchat->is_connected)
+    if (!g_atomic_int_get(&mchat->is_connected))
         return -1;
 
     int tocopy;
@@ -87,54 +151,136 @@ int mchatv1_get_channel(mchat_t *mchat, char *buf, unsigned int buf_size)
 
 int mchatv1_get_channel_count(mchat_t *mchat)
 {
-    return mchat->added_channels->len;
+    return mchat->added_channels->list->len;
+}
+
+
+int mchatv1_channel_member_count(mchat_t *mchat, char *channel)
+{
+    if (channel == NULL)
+        return -1;
+
+    mchat_istr key;
+    MCHAT_ISTR_KEY_INIT(&key, channel, strlen(channel));
+
+    int count = 0;
+    g_mutex_lock(&mchat->peerlist_mutex);
+    mchat_channel_members *m = g_hash_table_lookup(mchat->channel_members, &key);
+    if (m != NULL)
+        count = g_hash_table_size(m->members);
+    g_mutex_unlock(&mchat->peerlist_mutex);
+    return count;
+}
+
+
+int mchatv1_get_channel_peerlist(mchat_t *mchat, char *channel, mchat_peerlist_t **peerlist)
+{
+    if (channel == NULL)
+        return -1;
+
+    mchat_istr key;
+    MCHAT_ISTR_KEY_INIT(&key, channel, strlen(channel));
+
+    g_mutex_lock(&mchat->peerlist_mutex);
+    mchat_channel_members *m = g_hash_table_lookup(mchat->channel_members, &key);
+    mchat_peerlist_t *l = peerlist_snapshot_new(m != NULL ? g_hash_table_size(m->members) : 0);
+    l->snap.generation = mchat_snapshot_slot_generation(&mchat->peerlist_snapshot);
+    if (m != NULL)
+    {
+        GHashTableIter iter;
+        gpointer address;
+        g_hash_table_iter_init(&iter, m->members);
+        while (g_hash_table_iter_next(&iter, &address, NULL))
+        {
+            int index = peerlist_query(mchat, GPOINTER_TO_UINT(address));
+            if (index < 0)
+                continue;
+            memcpy(&l->list[l->length], &g_array_index(mchat->peerlist, mchat_peer, index), sizeof(mchat_peer));
+            peerlist_peer_ref(&l->list[l->length]);
+            l->length++;
+        }
+    }
+    g_mutex_unlock(&mchat->peerlist_mutex);
+
+    *peerlist = l;
+    return l->length ? 1 : 0;
 }
 
 
 int mchatv1_get_added_channels(mchat_t *mchat, mchat_chanlist_t **channel_list)
 {
-    /*! \todo This function needs to be implemented */
-    return 0;
+    mchat_chanlist_t *l = mchat_snapshot_acquire(&mchat->added_snapshot);
+    if (l == NULL)
+        return -1;
+
+    *channel_list = l;
+    return l->length ? 1 : 0;
 }
 
 
 int mchatv1_get_cdsc_channels(mchat_t *mchat, mchat_chanlist_t **channel_list)
 {
-    /*! \todo This function needs to be implemented */
-    return 0;
+    mchat_chanlist_t *l = mchat_snapshot_acquire(&mchat->cdsc_snapshot);
+    if (l == NULL)
+        return -1;
+
+    *channel_list = l;
+    return l->length ? 1 : 0;
 }
 
 
 int mchatv1_chanlist_size(mchat_chanlist_t *channel_list)
 {
+    if (channel_list == NULL)
+        return -1;
     return channel_list->length;
 }
 
 
 int mchatv1_chanlist_get_channel_name(mchat_chanlist_t *channel, unsigned int index, char *buf, unsigned int buf_size)
 {
-    /*! \todo This function needs to be implemented */
-    return 0;
+    if (index >= channel->length || buf_size == 0)
+        return -1;
+
+    int tocopy = strlen(channel->list[index].channel_name);
+    if (tocopy >= buf_size)
+        tocopy = buf_size - 1;
+    memcpy(buf, channel->list[index].channel_name, tocopy);
+    buf[tocopy] = '\0';
+    return tocopy;
 }
 
 
 int mchatv1_chanlist_get_channel_address(mchat_chanlist_t *channel, unsigned int index, char *buf, unsigned int buf_size)
 {
-    /*! \todo This function needs to be implemented */
-    return 0;
+    if (index >= channel->length || buf_size == 0)
+        return -1;
+
+    gchar *addr = g_inet_address_to_string(channel->list[index].channel_address);
+    int tocopy = strlen(addr);
+    if (tocopy >= buf_size)
+        tocopy = buf_size - 1;
+    memcpy(buf, addr, tocopy);
+    buf[tocopy] = '\0';
+    g_free(addr);
+    return tocopy;
 }
 
 
 int mchatv1_chanlist_get_channel_port(mchat_chanlist_t *channel, unsigned int index, unsigned short *port)
 {
-    /*! \todo This function needs to be implemented */
+    if (index >= channel->length)
+        return -1;
+    *port = channel->list[index].channel_portno;
     return 0;
 }
 
 
 int mchatv1_chanlist_get_channel_time(mchat_chanlist_t *channel, unsigned int index, long *time)
 {
-    /*! \todo This function needs to be implemented */
+    if (index >= channel->length)
+        return -1;
+    *time = channel->list[index].last_seen;
     return 0;
 }
 
@@ -144,6 +290,33 @@ int mchatv1_chanlist_get_channel_info(mchat_chanlist_t *channel, unsigned int in
                                       char *addr_buf, unsigned int addr_buf_size,
                                       unsigned short *portno, long *time)
 {
-    /*! \todo This function needs to be implemented */
+    if (index >= channel->length)
+        return -1;
+
+    mchat_channel *c = &channel->list[index];
+    if (name_buf_size <= strlen(c->channel_name))
+        return -2;
+    gchar *addr = g_inet_address_to_string(c->channel_address);
+    if (addr_buf_size <= strlen(addr))
+    {
+        g_free(addr);
+        return -3;
+    }
+
+    strcpy(name_buf, c->channel_name);
+    strcpy(addr_buf, addr);
+    g_free(addr);
+    *portno = c->channel_portno;
+    *time = c->last_seen;
+    return 0;
+}
+
+
+int mchatv1_chanlist_destroy(mchat_chanlist_t **channel_list)
+{
+    if (*channel_list == NULL)
+        return -1;
+    mchat_snapshot_unref(*channel_list);
+    *channel_list = NULL;
     return 0;
 }
@@ -0,0 +1,197 @@
+/*!
+ * \file mchatv1_delivery.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Delivery policies for received messages the application has not taken yet
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_proto.h"
+#include "mchatv1_structs.h"
+#include "mchatv1_delivery.h"
+
+
+void mchat_delivery_message_view(mchat_message_t *m, mchat_parser *parser, guint32 sbytes, gint64 recv_time)
+{
+    memset(m, 0, sizeof(mchat_message_t));
+    m->packet_type = parser->packet_type;
+    m->body = parser->body;
+    m->body_len = parser->body_size;
+    m->nickname = parser->header_offset[MCHATV1_HEADER_TYPE_NICKNAME];
+    m->nickname_len = parser->header_len[MCHATV1_HEADER_TYPE_NICKNAME];
+    m->timestamp = recv_time;
+    m->source_address = sbytes;
+    guint32 len = MIN(parser->header_len[MCHATV1_HEADER_TYPE_CHANNEL], MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE - 1);
+    memcpy(m->channel, parser->header_offset[MCHATV1_HEADER_TYPE_CHANNEL], len);
+    len = MIN(parser->header_len[MCHATV1_HEADER_TYPE_TOPIC], MCHAT_LIMIT_MAX_TOPIC_SIZE - 1);
+    memcpy(m->topic, parser->header_offset[MCHATV1_HEADER_TYPE_TOPIC], len);
+    m->parser_error = parser->parser_error;
+    m->validation_error = parser->validation_error;
+}
+
+
+mchat_message_t *mchat_delivery_message_copy(const mchat_message_t *src)
+{
+    mchat_message_t *m = g_malloc(sizeof(mchat_message_t));
+    memcpy(m, src, sizeof(mchat_message_t));
+    m->body = g_malloc0(src->body_len + 1);
+    memcpy(m->body, src->body, src->body_len);
+    m->nickname = g_malloc0(src->nickname_len + 1);
+    memcpy(m->nickname, src->nickname, src->nickname_len);
+    return m;
+}
+
+
+void mchat_delivery_message_load(mchat_message_t *dst, const mchat_message_t *src)
+{
+    gchar *body = dst->body;
+    gchar *nickname = dst->nickname;
+    memcpy(dst, src, sizeof(mchat_message_t));
+    dst->body = body;
+    dst->nickname = nickname;
+    memset(dst->body, 0, MCHAT_LIMIT_MAX_MESSAGE_SIZE);
+    memset(dst->nickname, 0, MCHAT_LIMIT_MAX_NICKNAME_SIZE);
+    memcpy(dst->body, src->body, src->body_len);
+    memcpy(dst->nickname, src->nickname, src->nickname_len);
+}
+
+
+gboolean mchat_delivery_watermark(const mchat_watermark *wm, guint backlog, guint8 *above)
+{
+    if (wm == NULL || wm->func == NULL || wm->high == 0)
+        return FALSE;
+    if (backlog < wm->high)
+    {
+        *above = 0;
+        return FALSE;
+    }
+    if (*above)
+        return FALSE;
+    *above = 1;
+    return TRUE;
+}
+
+
+mchat_spill *mchat_spill_new(void)
+{
+    FILE *file = tmpfile();
+    if (file == NULL)
+        return NULL;
+
+    mchat_spill *spill = g_malloc0(sizeof(mchat_spill));
+    spill->file = file;
+    spill->stream_pos = -1;
+    return spill;
+}
+
+
+/*!
+ * \brief Move the unread records of a spill to the start of its file
+ * \param spill Pointer to a spill with at least as many bytes read as unread
+ * \return 0 on success or -1 on error (the spill is then unchanged)
+ *
+ * \details
+ * As no more is unread than was read, every write lands on bytes already read, so a
+ * failure part way leaves the unread records where they were.
+ */
+static int mchat_spill_compact(mchat_spill *spill)
+{
+    gchar buf[8192];
+    long live = spill->write_pos - spill->read_pos;
+    spill->stream_pos = -1;
+    for (long done = 0; done < live; )
+    {
+        size_t n = MIN(sizeof(buf), (size_t)(live - done));
+        if (fseek(spill->file, spill->read_pos + done, SEEK_SET) != 0 ||
+                fread(buf, 1, n, spill->file) != n ||
+                fseek(spill->file, done, SEEK_SET) != 0 ||
+                fwrite(buf, 1, n, spill->file) != n)
+            return -1;
+        done += n;
+    }
+    spill->read_pos = 0;
+    spill->write_pos = live;
+    return 0;
+}
+
+
+int mchat_spill_push(mchat_spill *spill, const mchat_message_t *m)
+{
+    long len = sizeof(mchat_message_t) + m->nickname_len + m->body_len;
+    /* Only once the read part outgrows the rest, so each byte is moved at most once on average */
+    if (spill->write_pos + len > MCHAT_LIMIT_MAX_SPILL_SIZE &&
+            spill->read_pos >= spill->write_pos - spill->read_pos)
+        mchat_spill_compact(spill);
+    if (spill->write_pos + len > MCHAT_LIMIT_MAX_SPILL_SIZE)
+        return -1;
+    spill->stream_pos = -1;
+    if (fseek(spill->file, spill->write_pos, SEEK_SET) != 0)
+        return -1;
+
+    /* The pointers in the record are meaningless once read back and get replaced */
+    if (fwrite(m, sizeof(mchat_message_t), 1, spill->file) != 1 ||
+            fwrite(m->nickname, 1, m->nickname_len, spill->file) != m->nickname_len ||
+            fwrite(m->body, 1, m->body_len, spill->file) != m->body_len)
+        return -1;
+
+    spill->write_pos += len;
+    spill->count++;
+    return 0;
+}
+
+
+mchat_message_t *mchat_spill_pop(mchat_spill *spill, guint *lost)
+{
+    *lost = 0;
+    if (spill->count == 0)
+        return NULL;
+
+    /* Seeking drops the stdio read buffer, so back to back reads (a bulk drain) skip it */
+    mchat_message_t *m = g_malloc(sizeof(mchat_message_t));
+    gboolean ok = (spill->stream_pos == spill->read_pos ||
+                   fseek(spill->file, spill->read_pos, SEEK_SET) == 0) &&
+                  fread(m, sizeof(mchat_message_t), 1, spill->file) == 1 &&
+                  m->nickname_len < MCHAT_LIMIT_MAX_NICKNAME_SIZE &&
+                  m->body_len <= MCHAT_LIMIT_MAX_MESSAGE_SIZE;
+    m->nickname = NULL;
+    m->body = NULL;
+    if (ok)
+    {
+        m->nickname = g_malloc0(m->nickname_len + 1);
+        m->body = g_malloc0(m->body_len + 1);
+        ok = fread(m->nickname, 1, m->nickname_len, spill->file) == m->nickname_len &&
+             fread(m->body, 1, m->body_len, spill->file) == m->body_len;
+    }
+
+    if (!ok)
+    {
+        spill->stream_pos = -1;
+        *lost = spill->count;
+        spill->count = 0;
+        spill->read_pos = 0;
+        spill->write_pos = 0;
+        mchatv1_message_destroy(&m);
+        return NULL;
+    }
+
+    spill->read_pos += sizeof(mchat_message_t) + m->nickname_len + m->body_len;
+    spill->stream_pos = spill->read_pos;
+    if (--spill->count == 0)
+    {
+        spill->read_pos = 0;
+        spill->write_pos = 0;
+    }
+    return m;
+}
+
+
+void mchat_spill_destroy(mchat_spill *spill)
+{
+    if (spill == NULL)
+        return;
+    fclose(spill->file);
+    g_free(spill);
+}
@@ -0,0 +1,91 @@
+/*!
+ * \file mchatv1_delivery.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Delivery policies for received messages the application has not taken yet
+ *
+ * \details
+ * The receive threads (::mchatv1_thread_deliver_text()) and the session queues
+ * (::mchat_session_fanout()) apply the delivery policy of their owner when a message
+ * arrives while they are full.  ::MCHAT_DELIVERY_SPILL appends to an mchat_spill, which
+ * the taking side reads back from as it makes room.
+ */
+#ifndef MCHATV1_DELIVERY_H
+#define MCHATV1_DELIVERY_H
+
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_structs.h"
+
+/*!
+ * \brief Fill a message with pointers into a parser instead of copies
+ * \param m Message to fill (only valid as long as the parser's receive buffer)
+ * \param parser Parser holding a validated message
+ * \param sbytes Source address of the message
+ * \param recv_time Time the message was received
+ */
+void mchat_delivery_message_view(mchat_message_t *m, mchat_parser *parser, guint32 sbytes, gint64 recv_time);
+
+/*!
+ * \brief Copy a message, allocating only what its body and nickname need
+ * \param src Message to copy
+ * \return A message to be freed with ::mchatv1_message_destroy()
+ */
+mchat_message_t *mchat_delivery_message_copy(const mchat_message_t *src);
+
+/*!
+ * \brief Copy a message into a receive thread's message buffer
+ * \param dst Message whose body and nickname buffers have the maximum sizes
+ * \param src Message to copy
+ */
+void mchat_delivery_message_load(mchat_message_t *dst, const mchat_message_t *src);
+
+/*!
+ * \brief Check whether a backlog just reached the high watermark
+ * \param wm Watermark acquired from mchat_t.watermark, or NULL
+ * \param backlog Messages waiting to be taken
+ * \param above Watermark state of the backlog (under the owner's mutex)
+ * \return TRUE if wm->func should be called (after unlocking, still holding \p wm)
+ *
+ * \details
+ * Also rearms the watermark once the backlog is below it again.
+ */
+gboolean mchat_delivery_watermark(const mchat_watermark *wm, guint backlog, guint8 *above);
+
+/*!
+ * \brief Create an empty spill backed by an anonymous temporary file
+ * \return A spill or NULL on error
+ */
+mchat_spill *mchat_spill_new(void);
+
+/*!
+ * \brief Append a message to a spill
+ * \param spill Pointer to a spill
+ * \param m Message to append
+ * \return 0 on success or -1 if the spill is full or the write failed
+ *
+ * \details
+ * Space already read back is reclaimed, so only the unread records count against
+ * ::MCHAT_LIMIT_MAX_SPILL_SIZE (at least half of it is always usable).
+ */
+int mchat_spill_push(mchat_spill *spill, const mchat_message_t *m);
+
+/*!
+ * \brief Take the oldest message of a spill
+ * \param spill Pointer to a spill
+ * \param lost Set to the number of messages discarded after a read error, otherwise 0
+ * \return A message to be freed with ::mchatv1_message_destroy(), or NULL if empty or on error
+ *
+ * \details
+ * A failed read leaves the rest of the file unusable, so the spill is emptied.
+ */
+mchat_message_t *mchat_spill_pop(mchat_spill *spill, guint *lost);
+
+/*!
+ * \brief Close a spill and its file
+ * \param spill Pointer to a spill or NULL
+ */
+void mchat_spill_destroy(mchat_spill *spill);
+
+#endif // MCHATV1_DELIVERY_H
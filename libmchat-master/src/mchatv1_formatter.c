@@ -29,8 +29,17 @@ int nickname_format(struct mchat_thread *thread_info, char *dst)
 {
     int offset = 0;
     HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_NICKNAME, offset, dst);
-    memcpy(dst + offset, thread_info->mchat->nickname, thread_info->mchat->nickname_size);
-    offset += thread_info->mchat->nickname_size;
+    /* A session or a queued message may speak for another identity */
+    if (thread_info->nickname != NULL)
+    {
+        memcpy(dst + offset, thread_info->nickname, thread_info->nickname_size);
+        offset += thread_info->nickname_size;
+    }
+    else
+    {
+        memcpy(dst + offset, thread_info->identity->nickname, thread_info->identity->nickname_size);
+        offset += thread_info->identity->nickname_size;
+    }
     FORMAT_CRLF(offset, dst);
     return offset;
 }
@@ -39,7 +48,7 @@ int nickname_format(struct mchat_thread *thread_info, char *dst)
 int length_format(struct mchat_thread *thread_info, char *dst)
 {
     int offset = 0;
-    if (thread_info->buffer_flag)
+    if (g_atomic_int_get(&thread_info->buffer_flag))
     {
         HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_LENGTH, offset, dst);
         offset += g_snprintf(dst + offset, 6, "%u", strlen(thread_info->buffer->body));
@@ -84,11 +93,10 @@ int channel_format(struct mchat_thread *thread_info, char *dst)
     int offset = 0;
     HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_CHANNEL, offset, dst);
     int len;
-    /* We may need to use a mutex for mchat structures here -Sean */
-    if (thread_info->mchat->is_connected && thread_info->mchat->current_channel != NULL)
+    if (thread_info->identity->is_connected)
     {
-        len = strlen(thread_info->mchat->current_channel->channel_name);
-        memcpy(dst + offset, thread_info->mchat->current_channel->channel_name, len);
+        len = strlen(thread_info->identity->channel_name);
+        memcpy(dst + offset, thread_info->identity->channel_name, len);
     }
     else
     {
@@ -110,13 +118,11 @@ int presence_format(struct mchat_thread *thread_info, char *dst)
 int address_format(struct mchat_thread *thread_info, char *dst)
 {
     int offset = 0;
-    if (thread_info->mchat->is_connected && thread_info->mchat->current_channel != NULL)
+    if (thread_info->identity->is_connected)
     {
         HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_ADDRESS, offset, dst);
-        guchar *addr = g_inet_address_to_string(thread_info->mchat->current_channel->channel_address);
-        int addr_len = strlen(addr);
-        memcpy(dst + offset, addr, addr_len);
-        g_free(addr);
+        int addr_len = strlen(thread_info->identity->channel_address);
+        memcpy(dst + offset, thread_info->identity->channel_address, addr_len);
         offset += addr_len;
         FORMAT_CRLF(offset, dst);
     }
@@ -127,10 +133,24 @@ int address_format(struct mchat_thread *thread_info, char *dst)
 int port_format(struct mchat_thread *thread_info, char *dst)
 {
     int offset = 0;
-    if (thread_info->mchat->is_connected && thread_info->mchat->current_channel != NULL)
+    if (thread_info->identity->is_connected)
     {
         HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_PORT, offset, dst);
-        offset += g_snprintf(dst + offset, 5, "%u", thread_info->mchat->current_channel->channel_portno);
+        offset += g_snprintf(dst + offset, 6, "%u", thread_info->identity->channel_portno);
+        FORMAT_CRLF(offset, dst);
+    }
+    return offset;
+}
+
+int topic_format(struct mchat_thread *thread_info, char *dst)
+{
+    int offset = 0;
+    if (g_atomic_int_get(&thread_info->buffer_flag) && thread_info->buffer->topic[0] != '\0')
+    {
+        HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_TOPIC, offset, dst);
+        int len = strlen(thread_info->buffer->topic);
+        memcpy(dst + offset, thread_info->buffer->topic, len);
+        offset += len;
         FORMAT_CRLF(offset, dst);
     }
     return offset;
@@ -160,14 +180,81 @@ int mchatv1_format(mchat_thread *thread_info, char *dest, enum mchatv1_type type
     int offset = g_sprintf(dest, mchatv1_protocol_line_string, typestring,
                          MCHAT_PROTOCOL_VERSION_MAJOR, MCHAT_PROTOCOL_VERSION_MINOR);
 
+    /* One consistent nickname and channel for the whole packet, without locking */
+    thread_info->identity = mchat_snapshot_acquire(&thread_info->mchat->identity_snapshot);
     for (int i = 0; i < rh_len; i++)
         offset += mchatv1_header_formatters[req_hdrs[i]](thread_info, dest + offset);
+    /* Optional headers */
+    if (type == MCHATV1_MESSAGE_TYPE_TEXT)
+        offset += topic_format(thread_info, dest + offset);
     FORMAT_CRLF(offset, dest);
-    if (mchatv1_message_type_has_body(type) && thread_info->buffer_flag)
+    if (mchatv1_message_type_has_body(type) && g_atomic_int_get(&thread_info->buffer_flag))
     {
         int bodylen = strlen(thread_info->buffer->body);
         memcpy(dest + offset, thread_info->buffer->body, bodylen);
         offset += bodylen;
     }
+    mchat_snapshot_unref(thread_info->identity);
+    thread_info->identity = NULL;
     return offset;
 }
+
+
+int mchatv1_format_cdsc(char *dest, int dest_size, mchat_channel **channels,
+                        unsigned int count, unsigned int *formatted)
+{
+    gchar body[MCHAT_PROTOCOL_MAX_CDSC_SIZE];
+    gchar line[MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE + 64];
+    gchar *addr;
+    int offset, len, body_len = 0;
+
+    *formatted = 0;
+    if (count == 0 || dest_size > (int)sizeof(body))
+        return -1;
+
+    offset = g_sprintf(dest, mchatv1_protocol_line_string,
+                       mchatv1_message_type_strings[MCHATV1_MESSAGE_TYPE_CDSC],
+                       MCHAT_PROTOCOL_VERSION_MAJOR, MCHAT_PROTOCOL_VERSION_MINOR);
+    len = 0;
+    HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_CHANNEL, len, (dest + offset));
+    offset += len;
+    offset += g_sprintf(dest + offset, "%s", channels[0]->channel_name);
+    FORMAT_CRLF(offset, dest);
+    HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_ADDRESS, len, (dest + offset));
+    offset += len;
+    addr = g_inet_address_to_string(channels[0]->channel_address);
+    offset += g_sprintf(dest + offset, "%s", addr);
+    g_free(addr);
+    FORMAT_CRLF(offset, dest);
+    HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_PORT, len, (dest + offset));
+    offset += len;
+    offset += g_sprintf(dest + offset, "%u", channels[0]->channel_portno);
+    FORMAT_CRLF(offset, dest);
+    *formatted = 1;
+
+    /* Room left for the body after a "Length: NNNN" header and the blank line */
+    int budget = dest_size - offset - (int)strlen(mchatv1_header_type_strings[MCHATV1_HEADER_TYPE_LENGTH]) - 10;
+    while (*formatted < count)
+    {
+        mchat_channel *c = channels[*formatted];
+        addr = g_inet_address_to_string(c->channel_address);
+        len = g_snprintf(line, sizeof(line), "%s %s %u\r\n", c->channel_name, addr, c->channel_portno);
+        g_free(addr);
+        if (body_len + len > budget)
+            break;
+        memcpy(body + body_len, line, len);
+        body_len += len;
+        (*formatted)++;
+    }
+
+    if (body_len)
+    {
+        HEADER_FORMAT_START(MCHATV1_HEADER_TYPE_LENGTH, len, (dest + offset));
+        offset += len;
+        offset += g_sprintf(dest + offset, "%d", body_len);
+        FORMAT_CRLF(offset, dest);
+    }
+    FORMAT_CRLF(offset, dest);
+    memcpy(dest + offset, body, body_len);
+    return offset + body_len;
+}
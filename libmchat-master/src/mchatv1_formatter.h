@@ -35,4 +35,21 @@
  */
 int mchatv1_format(mchat_thread *thread_info, char *dest, enum mchatv1_type type);
 
+/*!
+ * \brief Create an aggregated CDSC message describing several channels
+ * \param dest Destination buffer to put the formatted packet
+ * \param dest_size Maximum size of the packet (at least ::MCHAT_PROTOCOL_MAX_CDSC_SIZE is sensible)
+ * \param channels Channels to describe
+ * \param count Number of channels in \p channels
+ * \param formatted Set to the number of channels that fit in the packet
+ * \return Size of the message in \p dest or -1 on error
+ *
+ * \details
+ * The first channel goes in the Channel, Address and Port headers, so peers that do not
+ * know about aggregation still see it.  The rest are listed in the body, one
+ * "name address port" line each, until \p dest_size is reached.
+ */
+int mchatv1_format_cdsc(char *dest, int dest_size, mchat_channel **channels,
+                        unsigned int count, unsigned int *formatted);
+
 #endif // MCHATV1_FORMATTER_H
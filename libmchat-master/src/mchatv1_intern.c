@@ -0,0 +1,114 @@
+/*!
+ * \file mchatv1_intern.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Interned strings for nicknames and channel names
+ *
+ * \details
+ * The table itself is only touched when a string is interned for the first time
+ * or its last reference is dropped.  Taking extra references to an entry that is
+ * already held (as snapshots do) is a single atomic increment.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "mchatv1_intern.h"
+#include "mchatv1_utils.h"
+
+static GMutex intern_mutex;
+static GHashTable *intern_table = NULL;
+
+
+guint32 mchat_intern_hash(const gchar *str, guint32 len)
+{
+    guint32 hash = MCHAT_CHANNEL_HASH_FNV_OFFSET;
+    for (guint32 i = 0; i < len; i++)
+        hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ (guchar)str[i];
+    return hash;
+}
+
+
+mchat_istr *mchat_intern(const gchar *str, guint32 len, guint32 hash)
+{
+    /* The lookup key points at the caller's bytes, so nothing is copied on a hit */
+    mchat_istr key = { 0, hash, len, str };
+
+    g_mutex_lock(&intern_mutex);
+    if (intern_table == NULL)
+        intern_table = g_hash_table_new(mchat_istr_hash_func, mchat_istr_equal_func);
+
+    mchat_istr *s = g_hash_table_lookup(intern_table, &key);
+    if (s != NULL)
+        g_atomic_int_inc(&s->ref_count);
+    else
+    {
+        s = g_malloc(sizeof(mchat_istr) + len + 1);
+        gchar *data = (gchar*)(s + 1);
+        memcpy(data, str, len);
+        data[len] = '\0';
+        s->ref_count = 1;
+        s->hash = hash;
+        s->len = len;
+        s->str = data;
+        g_hash_table_add(intern_table, s);
+    }
+    g_mutex_unlock(&intern_mutex);
+    return s;
+}
+
+
+mchat_istr *mchat_istr_ref(mchat_istr *s)
+{
+    if (s != NULL)
+        g_atomic_int_inc(&s->ref_count);
+    return s;
+}
+
+
+void mchat_istr_unref(mchat_istr *s)
+{
+    if (s == NULL)
+        return;
+
+    /* Fast path: this is not the last reference, so no lock is needed */
+    for (;;)
+    {
+        gint old = g_atomic_int_get(&s->ref_count);
+        if (old <= 1)
+            break;
+        if (g_atomic_int_compare_and_exchange(&s->ref_count, old, old - 1))
+            return;
+    }
+
+    /* Dropping to zero has to happen under the table lock, otherwise a concurrent
+     * mchat_intern() could find the entry and resurrect it while it is being freed. */
+    g_mutex_lock(&intern_mutex);
+    if (g_atomic_int_dec_and_test(&s->ref_count))
+    {
+        g_hash_table_remove(intern_table, s);
+        g_free(s);
+    }
+    g_mutex_unlock(&intern_mutex);
+}
+
+
+gboolean mchat_istr_equal(mchat_istr *s, const gchar *str, guint32 len, guint32 hash)
+{
+    if (s == NULL)
+        return len == 0;
+    return s->hash == hash && s->len == len && memcmp(s->str, str, len) == 0;
+}
+
+
+guint mchat_istr_hash_func(gconstpointer key)
+{
+    return ((const mchat_istr*)key)->hash;
+}
+
+
+gboolean mchat_istr_equal_func(gconstpointer a, gconstpointer b)
+{
+    const mchat_istr *sa = a, *sb = b;
+    return sa->hash == sb->hash && sa->len == sb->len && memcmp(sa->str, sb->str, sa->len) == 0;
+}
@@ -0,0 +1,110 @@
+/*!
+ * \file mchatv1_intern.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Interned strings for nicknames and channel names
+ *
+ * \details
+ * Peers mostly share a handful of channel names and keep the same nickname for
+ * their whole lifetime, so libmchat stores these strings once in a process-wide
+ * intern table and peers only hold references to the entries.  Entries are
+ * immutable and reference counted, so peer list snapshots can share them with
+ * the live peer list without copying.
+ */
+#ifndef MCHATV1_INTERN_H
+#define MCHATV1_INTERN_H
+
+#include <glib.h>
+
+/*!
+ * \brief An interned, immutable string
+ */
+typedef struct mchat_istr
+{
+    volatile gint ref_count;	/*!< Reference count */
+    guint32 hash;				/*!< FNV hash of the string (see ::mchat_intern_hash) */
+    guint32 len;				/*!< Length of the string, not counting the terminating NUL */
+    const gchar *str;			/*!< The NUL terminated string (stored right after this struct) */
+} mchat_istr;
+
+/*!
+ * \brief Initialize a stack mchat_istr to use as a lookup key
+ * \param key Pointer to the mchat_istr to initialize
+ * \param _str Pointer to the string (does not need to be NUL terminated)
+ * \param _len Length of \p _str
+ *
+ * \details
+ * The key is not interned and holds no reference; it can be used with hash tables
+ * built with ::mchat_istr_hash_func and ::mchat_istr_equal_func.
+ */
+#define MCHAT_ISTR_KEY_INIT(key, _str, _len) \
+    do { \
+        (key)->ref_count = 0; \
+        (key)->len = (_len); \
+        (key)->str = (_str); \
+        (key)->hash = mchat_intern_hash((_str), (_len)); \
+    } while (0)
+
+/*!
+ * \brief Hash a string the same way the intern table does
+ * \param str Pointer to the string (does not need to be NUL terminated)
+ * \param len Length of \p str
+ * \return The hash value
+ */
+guint32 mchat_intern_hash(const gchar *str, guint32 len);
+
+/*!
+ * \brief Find or add a string in the intern table
+ * \param str Pointer to the string (does not need to be NUL terminated)
+ * \param len Length of \p str
+ * \param hash Hash of \p str from ::mchat_intern_hash
+ * \return A new reference to the interned string
+ */
+mchat_istr *mchat_intern(const gchar *str, guint32 len, guint32 hash);
+
+/*!
+ * \brief Take another reference to an interned string
+ * \param s Interned string (may be NULL)
+ * \return \p s
+ */
+mchat_istr *mchat_istr_ref(mchat_istr *s);
+
+/*!
+ * \brief Drop a reference to an interned string
+ * \param s Interned string (may be NULL)
+ *
+ * \details
+ * The entry is removed from the intern table when the last reference goes away.
+ */
+void mchat_istr_unref(mchat_istr *s);
+
+/*!
+ * \brief Check whether an interned string equals a raw string
+ * \param s Interned string (may be NULL)
+ * \param str Pointer to the raw string
+ * \param len Length of \p str
+ * \param hash Hash of \p str from ::mchat_intern_hash
+ * \return TRUE if the strings are equal
+ *
+ * \details
+ * The hash and length are compared first, so a mismatch costs no string compare.
+ */
+gboolean mchat_istr_equal(mchat_istr *s, const gchar *str, guint32 len, guint32 hash);
+
+/*!
+ * \brief GHashFunc for hash tables keyed by interned strings
+ * \param key Pointer to an mchat_istr
+ * \return The precomputed hash of \p key
+ */
+guint mchat_istr_hash_func(gconstpointer key);
+
+/*!
+ * \brief GEqualFunc for hash tables keyed by interned strings
+ * \param a Pointer to an mchat_istr
+ * \param b Pointer to an mchat_istr
+ * \return TRUE if the strings are equal
+ */
+gboolean mchat_istr_equal_func(gconstpointer a, gconstpointer b);
+
+#endif // MCHATV1_INTERN_H
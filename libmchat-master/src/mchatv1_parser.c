@@ -183,6 +183,15 @@ int port_parse(struct mchat_parser *parser, char *ptr, int len)
     return 0;
 }
 
+int topic_parse(struct mchat_parser *parser, char *ptr, int len)
+{
+    if (len >= MCHAT_LIMIT_MAX_TOPIC_SIZE)
+        return -1;
+    parser->header_offset[MCHATV1_HEADER_TYPE_TOPIC] = ptr;
+    parser->header_len[MCHATV1_HEADER_TYPE_TOPIC] = len;
+    return 0;
+}
+
 //! @}
 
 /*****************************************************************************
@@ -431,6 +440,14 @@ int mchatv1_parser_to_message(struct mchat_parser *parser, mchat_message_t *mess
            parser->header_offset[MCHATV1_HEADER_TYPE_NICKNAME],
            parser->header_len[MCHATV1_HEADER_TYPE_NICKNAME]);
     message->nickname_len = parser->header_len[MCHATV1_HEADER_TYPE_NICKNAME];
+    guint32 channel_len = parser->header_len[MCHATV1_HEADER_TYPE_CHANNEL];
+    if (channel_len >= MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE)
+        channel_len = MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE - 1;
+    memcpy(message->channel, parser->header_offset[MCHATV1_HEADER_TYPE_CHANNEL], channel_len);
+    message->channel[channel_len] = '\0';
+    memcpy(message->topic, parser->header_offset[MCHATV1_HEADER_TYPE_TOPIC],
+           parser->header_len[MCHATV1_HEADER_TYPE_TOPIC]);
+    message->topic[parser->header_len[MCHATV1_HEADER_TYPE_TOPIC]] = '\0';
     message->validation_error = parser->validation_error;
     message->parser_error = parser->parser_error;
     message->packet_type = parser->packet_type;
@@ -13,35 +13,41 @@
 #include <string.h>
 #include "mchatv1.h"
 #include "mchatv1_structs.h"
+#include "mchatv1_snapshot.h"
+#include "mchatv1_utils.h"
 
 int mchatv1_peers_available(mchat_t *mchat)
 {
-    if (mchat->peerlist->len > 0)
-        return 1;
-    else
-        return 0;
+    mchat_peerlist_t *l = mchat_snapshot_acquire(&mchat->peerlist_snapshot);
+    int ret = (l != NULL && l->length > 0) ? 1 : 0;
+    if (l != NULL)
+        mchat_snapshot_unref(l);
+    return ret;
 }
 
 
 int mchatv1_get_peerlist(mchat_t *mchat, mchat_peerlist_t **peerlist)
 {
+    /* The published snapshot is shared with every other reader, so there is
+     * nothing to lock or copy here. */
+    mchat_peerlist_t *l = mchat_snapshot_acquire(&mchat->peerlist_snapshot);
+    if (l == NULL)
+        return -1;
 
-    mchat_peerlist_t *l = g_malloc(sizeof(mchat_peerlist_t));
-    memset(l, 0, sizeof(mchat_peerlist_t));
-    int ret = 0;
-    g_mutex_lock(&mchat->peerlist_mutex);
-    if (mchat->peerlist->len)
-    {
-        ret = 1;
-        l->length = mchat->peerlist->len;
-        l->list = g_malloc(sizeof(mchat_peer) * l->length);
-        memset(l->list, 0, l->length * sizeof(mchat_peer));
-        for (int i = 0; i < l->length; i++)
-            memcpy(&l->list[i], &g_array_index(mchat->peerlist, mchat_peer, i), sizeof(mchat_peer));
-    }
-    g_mutex_unlock(&mchat->peerlist_mutex);
     *peerlist = l;
-    return ret;
+    return l->length ? 1 : 0;
+}
+
+
+unsigned int mchatv1_peerlist_generation(mchat_t *mchat)
+{
+    return mchat_snapshot_slot_generation(&mchat->peerlist_snapshot);
+}
+
+
+unsigned int mchatv1_peerlist_get_generation(mchat_peerlist_t *peerlist)
+{
+    return peerlist->snap.generation;
 }
 
 
@@ -58,11 +64,11 @@ int mchatv1_peer_get_name(mchat_peerlist_t *peerlist, unsigned int index, char *
 
     mchat_peer *p = &peerlist->list[index];
     int tocopy = 0;
-    if (buf_size >= p->nickname_len)
-        tocopy = p->nickname_len;
+    if (buf_size >= p->nickname->len)
+        tocopy = p->nickname->len;
     else
         tocopy = buf_size;
-    memcpy(buf, p->nickname, tocopy);
+    memcpy(buf, p->nickname->str, tocopy);
     buf[tocopy] = '\0';
     return tocopy;
 }
@@ -75,11 +81,11 @@ int mchatv1_peer_get_channel(mchat_peerlist_t *peerlist, unsigned int index, cha
 
     mchat_peer *p = &peerlist->list[index];
     int tocopy = 0;
-    if (buf_size >= p->channel_len)
-        tocopy = p->channel_len;
+    if (buf_size >= p->channel->len)
+        tocopy = p->channel->len;
     else
         tocopy = buf_size;
-    memcpy(buf, p->channel, tocopy);
+    memcpy(buf, p->channel->str, tocopy);
     buf[tocopy] = '\0';
     return tocopy;
 }
@@ -94,6 +100,65 @@ int mchatv1_peer_get_timestamp(mchat_peerlist_t *peerlist, unsigned int index, l
 }
 
 
+int mchatv1_peer_get_message_count(mchat_peerlist_t *peerlist, unsigned int index, unsigned long *count)
+{
+    if (index >= peerlist->length)
+        return -1;
+    *count = peerlist->list[index].text_count;
+    return 0;
+}
+
+
+int mchatv1_peer_get_ping_count(mchat_peerlist_t *peerlist, unsigned int index, unsigned long *count)
+{
+    if (index >= peerlist->length)
+        return -1;
+    *count = peerlist->list[index].ping_count;
+    return 0;
+}
+
+
+int mchatv1_peer_get_byte_count(mchat_peerlist_t *peerlist, unsigned int index, unsigned long *bytes)
+{
+    if (index >= peerlist->length)
+        return -1;
+    *bytes = peerlist->list[index].byte_count;
+    return 0;
+}
+
+
+int mchatv1_peer_get_last_text(mchat_peerlist_t *peerlist, unsigned int index, long *t)
+{
+    if (index >= peerlist->length)
+        return -1;
+    *t = peerlist->list[index].last_text;
+    return 0;
+}
+
+
+int mchatv1_peer_get_jitter(mchat_peerlist_t *peerlist, unsigned int index, long *jitter)
+{
+    if (index >= peerlist->length)
+        return -1;
+    *jitter = peerlist->list[index].jitter;
+    return 0;
+}
+
+
+int mchatv1_peer_get_loss(mchat_peerlist_t *peerlist, unsigned int index, double *loss)
+{
+    if (index >= peerlist->length)
+        return -1;
+
+    mchat_peer *p = &peerlist->list[index];
+    if (p->keepalive_count < 2)
+        return 1;
+
+    *loss = (double)p->keepalive_lost / (double)(p->keepalive_lost + p->keepalive_count);
+    return 0;
+}
+
+
 int mchatv1_peer_get_peer(mchat_peerlist_t *peerlist, unsigned int index,
                           char *nick_buf, char *channel_buf,
                           unsigned int nick_buf_size,
@@ -104,15 +169,15 @@ int mchatv1_peer_get_peer(mchat_peerlist_t *peerlist, unsigned int index,
 
     mchat_peer *p = &peerlist->list[index];
 
-    if (nick_buf_size < p->nickname_len)
+    if (nick_buf_size < p->nickname->len)
         return -2;
-    if (channel_buf_size < p->channel_len)
+    if (channel_buf_size < p->channel->len)
         return -3;
 
-    memcpy(nick_buf, p->nickname, p->nickname_len);
-    memcpy(channel_buf, p->channel, p->channel_len);
-    nick_buf[p->nickname_len] = '\0';
-    channel_buf[p->channel_len] = '\0';
+    memcpy(nick_buf, p->nickname->str, p->nickname->len);
+    memcpy(channel_buf, p->channel->str, p->channel->len);
+    nick_buf[p->nickname->len] = '\0';
+    channel_buf[p->channel->len] = '\0';
     *t = p->last_seen;
     return 0;
 }
@@ -134,8 +199,127 @@ int mchatv1_peer_get_source_address(mchat_peerlist_t *peerlist,
 
 int mchatv1_peerlist_destroy(mchat_peerlist_t **peerlist)
 {
-    if ((*peerlist)->list != NULL)
-        g_free((*peerlist)->list);
-    g_free(*peerlist);
+    if (*peerlist == NULL)
+        return -1;
+    mchat_snapshot_unref(*peerlist);
+    *peerlist = NULL;
+    return 0;
+}
+
+
+int mchatv1_get_peer_events(mchat_t *mchat, mchat_peer_events_t **events, unsigned int max)
+{
+    mchat_peer_events_t *e = g_malloc(sizeof(mchat_peer_events_t));
+    memset(e, 0, sizeof(mchat_peer_events_t));
+
+    g_mutex_lock(&mchat->peerlist_mutex);
+    guint32 count = mchat->peer_events_count;
+    if (max != 0 && max < count)
+        count = max;
+    if (count)
+    {
+        e->list = g_malloc(sizeof(mchat_peer_event) * count);
+        /* Move out of the ring in at most two pieces; the batch takes over the
+         * references the queued entries held */
+        guint32 first = MIN(count, MCHAT_LIMIT_MAX_PEER_EVENTS - mchat->peer_events_head);
+        memcpy(e->list, &mchat->peer_events[mchat->peer_events_head], sizeof(mchat_peer_event) * first);
+        memcpy(e->list + first, mchat->peer_events, sizeof(mchat_peer_event) * (count - first));
+        mchat->peer_events_head = (mchat->peer_events_head + count) % MCHAT_LIMIT_MAX_PEER_EVENTS;
+        mchat->peer_events_count -= count;
+    }
+    e->length = count;
+    e->overflowed = mchat->peer_events_overflowed;
+    mchat->peer_events_overflowed = 0;
+    g_mutex_unlock(&mchat->peerlist_mutex);
+
+    *events = e;
+    return count;
+}
+
+
+int mchatv1_peer_events_get_size(mchat_peer_events_t *events)
+{
+    return events->length;
+}
+
+
+int mchatv1_peer_events_overflowed(mchat_peer_events_t *events)
+{
+    return events->overflowed;
+}
+
+
+int mchatv1_peer_event_get_type(mchat_peer_events_t *events, unsigned int index)
+{
+    if (index >= events->length)
+        return -1;
+    return events->list[index].type;
+}
+
+
+int mchatv1_peer_event_get_name(mchat_peer_events_t *events, unsigned int index, char *buf, unsigned int buf_size)
+{
+    if (index >= events->length || buf_size == 0)
+        return -1;
+
+    mchat_peer *p = &events->list[index].peer;
+    int tocopy = 0;
+    if (buf_size > p->nickname->len)
+        tocopy = p->nickname->len;
+    else
+        tocopy = buf_size - 1;
+    memcpy(buf, p->nickname->str, tocopy);
+    buf[tocopy] = '\0';
+    return tocopy;
+}
+
+
+int mchatv1_peer_event_get_channel(mchat_peer_events_t *events, unsigned int index, char *buf, unsigned int buf_size)
+{
+    if (index >= events->length || buf_size == 0)
+        return -1;
+
+    mchat_peer *p = &events->list[index].peer;
+    int tocopy = 0;
+    if (buf_size > p->channel->len)
+        tocopy = p->channel->len;
+    else
+        tocopy = buf_size - 1;
+    memcpy(buf, p->channel->str, tocopy);
+    buf[tocopy] = '\0';
+    return tocopy;
+}
+
+
+int mchatv1_peer_event_get_timestamp(mchat_peer_events_t *events, unsigned int index, long *t)
+{
+    if (index >= events->length)
+        return -1;
+    *t = events->list[index].timestamp;
+    return 0;
+}
+
+
+int mchatv1_peer_event_get_source_address(mchat_peer_events_t *events, unsigned int index,
+                                          char *addr_buf, unsigned int size)
+{
+    if (index >= events->length)
+        return -1;
+
+    guchar bytes[4];
+    memcpy(bytes, &events->list[index].peer.source_address, 4);
+    return g_snprintf(addr_buf, size, "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+}
+
+
+int mchatv1_peer_events_destroy(mchat_peer_events_t **events)
+{
+    if (*events == NULL)
+        return -1;
+    for (guint64 i = 0; i < (*events)->length; i++)
+        peerlist_peer_clear(&(*events)->list[i].peer);
+    g_free((*events)->list);
+    g_free(*events);
+    *events = NULL;
     return 0;
 }
@@ -0,0 +1,374 @@
+/*!
+ * \file mchatv1_pipeline.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Pipelined receive for the text recv thread
+ */
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "mchatv1.h"
+#include "mchatv1_proto.h"
+#include "mchatv1_structs.h"
+#include "mchatv1_parser.h"
+#include "mchatv1_threads.h"
+#include "mchatv1_utils.h"
+#include "mchatv1_pipeline.h"
+
+
+/*!
+ * \brief Longest a waiting thread sleeps before looking at the rings and flags again
+ */
+#define MCHAT_PIPELINE_WAIT_INTERVAL (G_TIME_SPAN_MILLISECOND * 100)
+
+/*!
+ * \brief Longest the socket thread waits for a free slot before looking for PINGs again
+ */
+#define MCHAT_PIPELINE_CONTROL_POLL_INTERVAL (G_TIME_SPAN_MILLISECOND * 5)
+
+
+/*!
+ * \brief Set up an empty ring
+ * \param r Pointer to the ring
+ * \param capacity Number of items the ring must hold
+ */
+static void mchat_pipeline_ring_init(mchat_pipeline_ring *r, guint capacity)
+{
+    /* One item stays unused, so head == tail always means empty */
+    r->size = capacity + 1;
+    r->items = g_malloc0(sizeof(mchat_pipeline_slot*) * r->size);
+    r->head = 0;
+    r->tail = 0;
+}
+
+
+/*!
+ * \brief Add a slot to a ring (producer only)
+ */
+static void mchat_pipeline_ring_push(mchat_pipeline_ring *r, mchat_pipeline_slot *slot)
+{
+    gint head = r->head;
+    r->items[head] = slot;
+    /* The slot pointer is visible before the new head */
+    g_atomic_int_set(&r->head, (head + 1) % r->size);
+}
+
+
+/*!
+ * \brief Take the oldest slot from a ring (consumer only)
+ * \return The slot or NULL if the ring is empty
+ */
+static mchat_pipeline_slot *mchat_pipeline_ring_pop(mchat_pipeline_ring *r)
+{
+    gint tail = r->tail;
+    if (tail == g_atomic_int_get(&r->head))
+        return NULL;
+    mchat_pipeline_slot *slot = r->items[tail];
+    g_atomic_int_set(&r->tail, (tail + 1) % r->size);
+    return slot;
+}
+
+
+/*!
+ * \brief Tell whether a ring has nothing to pop
+ */
+static gboolean mchat_pipeline_ring_empty(mchat_pipeline_ring *r)
+{
+    return g_atomic_int_get(&r->tail) == g_atomic_int_get(&r->head);
+}
+
+
+/*!
+ * \brief Wake any thread sleeping on the pipeline after a push
+ *
+ * \details
+ * Sleepers announce themselves before checking their ring for the last time, and we
+ * check for sleepers after pushing, so either they see the push or we see them.
+ */
+static void mchat_pipeline_wake(mchat_pipeline *p)
+{
+    if (g_atomic_int_get(&p->sleepers) == 0)
+        return;
+    g_mutex_lock(&p->mutex);
+    g_cond_broadcast(&p->cond);
+    g_mutex_unlock(&p->mutex);
+}
+
+
+/*!
+ * \brief Tell whether every worker's done ring is empty
+ */
+static gboolean mchat_pipeline_all_busy(mchat_pipeline *p)
+{
+    for (guint i = 0; i < p->worker_count; i++)
+        if (!mchat_pipeline_ring_empty(&p->workers[i]->done))
+            return FALSE;
+    return TRUE;
+}
+
+
+static gpointer mchat_pipeline_worker_run(gpointer data)
+{
+    mchat_pipeline_worker *w = (mchat_pipeline_worker*)data;
+    mchat_pipeline *p = w->pipeline;
+
+    while (!g_atomic_int_get(&p->stop))
+    {
+        mchat_pipeline_slot *slot = mchat_pipeline_ring_pop(&w->work);
+        if (slot == NULL)
+        {
+            g_mutex_lock(&p->mutex);
+            g_atomic_int_inc(&p->sleepers);
+            if (mchat_pipeline_ring_empty(&w->work) && !g_atomic_int_get(&p->stop))
+                g_cond_wait_until(&p->cond, &p->mutex, g_get_monotonic_time() + MCHAT_PIPELINE_WAIT_INTERVAL);
+            g_atomic_int_add(&p->sleepers, -1);
+            g_mutex_unlock(&p->mutex);
+            continue;
+        }
+
+        mchatv1_thread_handle_text(p->t, slot->data, slot->len, slot->sbytes, slot->recv_time);
+        mchat_pipeline_ring_push(&w->done, slot);
+        mchat_pipeline_wake(p);
+    }
+    return NULL;
+}
+
+
+/*!
+ * \brief Tell whether a datagram is a PING small enough for the control lane
+ */
+static gboolean mchat_pipeline_is_control(mchat_pipeline_slot *slot)
+{
+    if (slot->len > MCHAT_PIPELINE_CONTROL_SIZE)
+        return FALSE;
+    /* Only the type word of the protocol line; the worker validates the rest */
+    gchar *space = memchr(slot->data, ' ', MIN(slot->len, 16));
+    if (space == NULL)
+        return FALSE;
+    return mchatv1_find_message_type(slot->data, space - slot->data) == MCHATV1_MESSAGE_TYPE_PING;
+}
+
+
+/*!
+ * \brief Keep a PING as the latest one of its sender in the control lane
+ */
+static void mchat_pipeline_control_push(mchat_pipeline *p, mchat_pipeline_slot *slot)
+{
+    gpointer key = GUINT_TO_POINTER(slot->sbytes);
+    g_mutex_lock(&p->control_mutex);
+    mchat_pipeline_ping *ping = g_hash_table_lookup(p->control_pending, key);
+    if (ping != NULL)
+        g_atomic_int_inc(&p->t->mchat->control_coalesced);
+    else if (g_hash_table_size(p->control_pending) >= MCHAT_PIPELINE_CONTROL_MAX_PENDING)
+        g_atomic_int_inc(&p->t->mchat->control_dropped);
+    else
+    {
+        ping = g_malloc(sizeof(mchat_pipeline_ping));
+        g_hash_table_insert(p->control_pending, key, ping);
+        g_cond_signal(&p->control_cond);
+    }
+    if (ping != NULL)
+    {
+        memcpy(ping->data, slot->data, slot->len + 1);
+        ping->len = slot->len;
+        ping->sbytes = slot->sbytes;
+        ping->recv_time = slot->recv_time;
+    }
+    g_mutex_unlock(&p->control_mutex);
+}
+
+
+/*!
+ * \brief Read the PINGs at the head of the socket buffer into the reserved slot
+ *
+ * \details
+ * Called by the socket thread while every other slot is in use.  Each datagram is
+ * peeked at first and only read if it is a PING, so a chat message stays in the socket
+ * buffer until a slot frees up and is never dropped here.
+ */
+static void mchat_pipeline_control_drain(mchat_pipeline *p)
+{
+    GSocket *sock = p->t->sock;
+    mchat_pipeline_slot *slot = p->control_slot;
+    if (sock == NULL)
+        return;
+
+    while (g_socket_condition_check(sock, G_IO_IN) & G_IO_IN)
+    {
+        /* One byte more than a control PING, to tell a larger datagram apart */
+        GInputVector vec = { slot->data, MCHAT_PIPELINE_CONTROL_SIZE + 1 };
+        gint flags = G_SOCKET_MSG_PEEK;
+        gssize len = g_socket_receive_message(sock, NULL, &vec, 1, NULL, NULL, &flags, NULL, NULL);
+        if (len <= 0 || len > MCHAT_PIPELINE_CONTROL_SIZE)
+            return;
+        slot->len = len;
+        if (!mchat_pipeline_is_control(slot))
+            return;
+
+        GSocketAddress *saddr;
+        len = g_socket_receive_from(sock, &saddr, slot->data, MCHAT_PIPELINE_CONTROL_SIZE + 1, NULL, NULL);
+        if (len <= 0)
+            return;
+        slot->data[len] = '\0';
+        slot->len = len;
+        slot->sbytes = mchatv1_thread_source_bytes(saddr);
+        slot->recv_time = g_get_real_time();
+        mchat_pipeline_control_push(p, slot);
+    }
+}
+
+
+static gpointer mchat_pipeline_control_run(gpointer data)
+{
+    mchat_pipeline *p = (mchat_pipeline*)data;
+    GHashTable *batch = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    g_mutex_lock(&p->control_mutex);
+    while (!g_atomic_int_get(&p->stop))
+    {
+        if (g_hash_table_size(p->control_pending) == 0)
+        {
+            g_cond_wait(&p->control_cond, &p->control_mutex);
+            continue;
+        }
+        /* Take the whole batch, so the socket thread can fill a fresh table meanwhile */
+        GHashTable *pending = p->control_pending;
+        p->control_pending = batch;
+        batch = pending;
+        g_mutex_unlock(&p->control_mutex);
+
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init(&iter, batch);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+        {
+            mchat_pipeline_ping *ping = (mchat_pipeline_ping*)value;
+            mchatv1_thread_handle_text(p->t, ping->data, ping->len, ping->sbytes, ping->recv_time);
+        }
+        g_hash_table_remove_all(batch);
+        g_mutex_lock(&p->control_mutex);
+    }
+    g_mutex_unlock(&p->control_mutex);
+    g_hash_table_destroy(batch);
+    return NULL;
+}
+
+
+mchat_pipeline *mchat_pipeline_new(mchat_thread *t, guint workers)
+{
+    mchat_pipeline *p = g_malloc0(sizeof(mchat_pipeline));
+    guint total = workers * MCHAT_PIPELINE_SLOTS_PER_WORKER;
+    p->t = t;
+    p->worker_count = workers;
+    p->slots = g_malloc(sizeof(mchat_pipeline_slot) * total);
+    p->free_slots = g_ptr_array_sized_new(total);
+    for (guint i = 0; i < total; i++)
+        g_ptr_array_add(p->free_slots, &p->slots[i]);
+    p->control_slot = g_malloc(sizeof(mchat_pipeline_slot));
+    g_mutex_init(&p->mutex);
+    g_cond_init(&p->cond);
+    p->control_pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    g_mutex_init(&p->control_mutex);
+    g_cond_init(&p->control_cond);
+    p->control_thread = g_thread_new("Text Control", mchat_pipeline_control_run, p);
+
+    p->workers = g_malloc0(sizeof(mchat_pipeline_worker*) * workers);
+    for (guint i = 0; i < workers; i++)
+    {
+        mchat_pipeline_worker *w = cache_aligned_alloc0(sizeof(mchat_pipeline_worker));
+        w->pipeline = p;
+        /* Every slot may end up with one worker, so neither ring can fill up */
+        mchat_pipeline_ring_init(&w->work, total);
+        mchat_pipeline_ring_init(&w->done, total);
+        w->thread = g_thread_new("Text Parse", mchat_pipeline_worker_run, w);
+        p->workers[i] = w;
+    }
+    return p;
+}
+
+
+mchat_pipeline_slot *mchat_pipeline_take(mchat_pipeline *p)
+{
+    while (p->free_slots->len == 0)
+    {
+        for (guint i = 0; i < p->worker_count; i++)
+        {
+            mchat_pipeline_slot *slot;
+            while ((slot = mchat_pipeline_ring_pop(&p->workers[i]->done)) != NULL)
+                g_ptr_array_add(p->free_slots, slot);
+        }
+        if (p->free_slots->len)
+            break;
+        if (!g_atomic_int_get(&p->t->run_flag))
+            return NULL;
+
+        /* PINGs keep flowing through the reserved slot while the workers are held up */
+        mchat_pipeline_control_drain(p);
+        g_mutex_lock(&p->mutex);
+        g_atomic_int_inc(&p->sleepers);
+        if (mchat_pipeline_all_busy(p))
+            g_cond_wait_until(&p->cond, &p->mutex, g_get_monotonic_time() + MCHAT_PIPELINE_CONTROL_POLL_INTERVAL);
+        g_atomic_int_add(&p->sleepers, -1);
+        g_mutex_unlock(&p->mutex);
+    }
+    return g_ptr_array_remove_index_fast(p->free_slots, p->free_slots->len - 1);
+}
+
+
+gboolean mchat_pipeline_push(mchat_pipeline *p, mchat_pipeline_slot *slot)
+{
+    if (mchat_pipeline_is_control(slot))
+    {
+        mchat_pipeline_control_push(p, slot);
+        return FALSE;
+    }
+
+    /* Same sender, same worker: keeps each sender's messages in order */
+    guint index = ((slot->sbytes * 2654435761u) >> 16) % p->worker_count;
+    mchat_pipeline_ring_push(&p->workers[index]->work, slot);
+    mchat_pipeline_wake(p);
+    return TRUE;
+}
+
+
+void mchat_pipeline_untake(mchat_pipeline *p, mchat_pipeline_slot *slot)
+{
+    g_ptr_array_add(p->free_slots, slot);
+}
+
+
+void mchat_pipeline_destroy(mchat_pipeline *p)
+{
+    g_mutex_lock(&p->mutex);
+    g_atomic_int_set(&p->stop, 1);
+    g_cond_broadcast(&p->cond);
+    g_mutex_unlock(&p->mutex);
+    g_mutex_lock(&p->control_mutex);
+    g_cond_signal(&p->control_cond);
+    g_mutex_unlock(&p->control_mutex);
+    /* Workers blocked on a full message buffer give up now that run_flag is clear */
+    g_mutex_lock(&p->t->mutex);
+    g_cond_broadcast(&p->t->cond);
+    g_mutex_unlock(&p->t->mutex);
+    g_thread_join(p->control_thread);
+
+    for (guint i = 0; i < p->worker_count; i++)
+    {
+        mchat_pipeline_worker *w = p->workers[i];
+        g_thread_join(w->thread);
+        g_free(w->work.items);
+        g_free(w->done.items);
+        cache_aligned_free(w);
+    }
+    g_free(p->workers);
+    g_ptr_array_free(p->free_slots, TRUE);
+    g_free(p->slots);
+    g_free(p->control_slot);
+    g_hash_table_destroy(p->control_pending);
+    g_cond_clear(&p->control_cond);
+    g_mutex_clear(&p->control_mutex);
+    g_cond_clear(&p->cond);
+    g_mutex_clear(&p->mutex);
+    g_free(p);
+}
@@ -0,0 +1,173 @@
+/*!
+ * \file mchatv1_pipeline.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Pipelined receive for the text recv thread
+ *
+ * \details
+ * With parse workers configured (::mchatv1_set_parse_workers()), the text recv thread
+ * only reads datagrams.  Each datagram is read into a pooled slot and pushed through a
+ * single producer, single consumer ring to a parse worker, which parses it, updates the
+ * peer list and delivers it, then hands the slot back through a second ring.
+ *
+ * Datagrams are routed to workers by source address, so messages from one sender are
+ * still delivered in the order they arrived.  The socket thread only waits when every
+ * slot is in use.
+ *
+ * PINGs take a separate control lane: they are copied out of the slot right away into a
+ * table holding the latest PING of each sender, which a control worker drains.  The lane
+ * has its own thread and memory, so a PING read while the workers wait for the
+ * application to take messages is not queued behind them, and under a PING storm
+ * repeated PINGs from one sender are coalesced instead of queued.
+ *
+ * Control traffic also has a reserved slot of its own.  While every other slot is in
+ * use, as with ::MCHAT_DELIVERY_BLOCK and a TEXT backlog, the socket thread keeps
+ * peeking at the socket: a PING is read into the reserved slot and handed to the lane,
+ * anything else is left in the socket buffer until a slot frees up.  A datagram socket
+ * is read in order, so PINGs that arrived after that datagram still wait behind it.
+ * The lane and the reserved slot only exist with parse workers.
+ */
+#ifndef MCHATV1_PIPELINE_H
+#define MCHATV1_PIPELINE_H
+
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_structs.h"
+
+/*!
+ * \brief Receive slots in the pool per parse worker
+ */
+#define MCHAT_PIPELINE_SLOTS_PER_WORKER 16
+
+/*!
+ * \brief Largest datagram a receive slot holds (a UDP datagram can be no larger)
+ */
+#define MCHAT_PIPELINE_SLOT_SIZE (1 << 16)
+
+/*!
+ * \brief Largest PING handled by the control lane (larger ones go through a worker)
+ */
+#define MCHAT_PIPELINE_CONTROL_SIZE 512
+
+/*!
+ * \brief Senders with a PING pending in the control lane before further senders' PINGs are dropped
+ */
+#define MCHAT_PIPELINE_CONTROL_MAX_PENDING 1024
+
+/*!
+ * \brief Latest PING of one sender waiting in the control lane
+ */
+typedef struct mchat_pipeline_ping
+{
+    gchar data[MCHAT_PIPELINE_CONTROL_SIZE + 1];	/*!< Datagram, NUL terminated */
+    gssize len;									/*!< Length of the datagram */
+    guint32 sbytes;								/*!< Source address of the datagram */
+    gint64 recv_time;							/*!< Time the datagram was read */
+} mchat_pipeline_ping;
+
+/*!
+ * \brief A received datagram waiting to be parsed
+ */
+typedef struct mchat_pipeline_slot
+{
+    gchar data[MCHAT_PIPELINE_SLOT_SIZE + 1];	/*!< Datagram, NUL terminated */
+    gssize len;									/*!< Length of the datagram */
+    guint32 sbytes;								/*!< Source address of the datagram */
+    gint64 recv_time;							/*!< Time the datagram was read */
+} mchat_pipeline_slot;
+
+/*!
+ * \brief Single producer, single consumer ring of slot pointers
+ *
+ * \details
+ * head is only written by the producer and tail by the consumer, each on its own
+ * cache line.  The ring is as large as the whole pool, so a push never fails.
+ */
+typedef struct mchat_pipeline_ring
+{
+    mchat_pipeline_slot **items;				/*!< Ring storage */
+    guint size;									/*!< Capacity of items */
+    gint head MCHAT_CACHE_ALIGNED;				/*!< Next item to write (atomic, producer) */
+    gint tail MCHAT_CACHE_ALIGNED;				/*!< Next item to read (atomic, consumer) */
+} mchat_pipeline_ring;
+
+typedef struct mchat_pipeline mchat_pipeline;
+
+/*!
+ * \brief A parse worker and its rings
+ */
+typedef struct mchat_pipeline_worker
+{
+    mchat_pipeline *pipeline;					/*!< Pipeline of the worker */
+    GThread *thread;							/*!< Worker thread */
+    mchat_pipeline_ring work;					/*!< Slots to parse (socket thread to worker) */
+    mchat_pipeline_ring done;					/*!< Parsed slots (worker to socket thread) */
+} mchat_pipeline_worker;
+
+/*!
+ * \brief Receive pipeline of a text recv thread
+ */
+struct mchat_pipeline
+{
+    mchat_thread *t;							/*!< Text recv thread the workers deliver to */
+    mchat_pipeline_worker **workers;			/*!< Parse workers */
+    guint worker_count;							/*!< Number of workers */
+    mchat_pipeline_slot *slots;					/*!< The slot pool */
+    GPtrArray *free_slots;						/*!< Slots ready to be read into (socket thread only) */
+    mchat_pipeline_slot *control_slot;			/*!< Reserved slot for PINGs read while every other slot is in use */
+    GMutex mutex;								/*!< Only used to sleep and wake */
+    GCond cond;									/*!< Broadcast when a ring gains an item or on stop */
+    gint sleepers;								/*!< Threads about to wait on cond (atomic) */
+    gint stop;									/*!< Set to make the workers exit (atomic) */
+    GThread *control_thread;					/*!< Control lane worker */
+    GHashTable *control_pending;				/*!< Source address to its latest mchat_pipeline_ping (under control_mutex) */
+    GMutex control_mutex;						/*!< Mutex for control_pending */
+    GCond control_cond;							/*!< Signalled when control_pending gains a sender or on stop */
+};
+
+/*!
+ * \brief Start the parse workers of a text recv thread
+ * \param t Pointer to the text recv thread
+ * \param workers Number of parse workers (at least 1)
+ * \return A pipeline, to be used only by the thread \p t
+ */
+mchat_pipeline *mchat_pipeline_new(mchat_thread *t, guint workers);
+
+/*!
+ * \brief Get an empty slot to read the next datagram into
+ * \param p Pointer to a pipeline
+ * \return A slot, or NULL if the thread was stopped while every slot was in use
+ *
+ * \details
+ * While every slot is in use, PINGs at the head of the socket buffer of the thread
+ * are read into the reserved slot and handed to the control lane.
+ */
+mchat_pipeline_slot *mchat_pipeline_take(mchat_pipeline *p);
+
+/*!
+ * \brief Route a filled slot to the control lane or to the worker of its source address
+ * \param p Pointer to a pipeline
+ * \param slot Slot from ::mchat_pipeline_take() with len, sbytes and recv_time set
+ * \return TRUE if a worker took the slot, FALSE if it is free again (control lane)
+ */
+gboolean mchat_pipeline_push(mchat_pipeline *p, mchat_pipeline_slot *slot);
+
+/*!
+ * \brief Put back a slot from ::mchat_pipeline_take() that was not filled
+ * \param p Pointer to a pipeline
+ * \param slot The slot
+ */
+void mchat_pipeline_untake(mchat_pipeline *p, mchat_pipeline_slot *slot);
+
+/*!
+ * \brief Stop the workers and free the pipeline
+ * \param p Pointer to a pipeline
+ *
+ * \details
+ * Datagrams the workers have not parsed yet are dropped.  Call it after run_flag of
+ * the text recv thread is cleared, so no worker waits for its buffer to be taken.
+ */
+void mchat_pipeline_destroy(mchat_pipeline *p);
+
+#endif // MCHATV1_PIPELINE_H
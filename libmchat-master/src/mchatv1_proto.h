@@ -54,7 +54,8 @@
     MAP_MACRO(FILE, NICKNAME, LENGTH, FILENAME, FILESUM, CHUNK, \
         CHUNKCOUNT, FILESUM, CHUNKSUM) /*!< File chuck message used in file sending */ \
     MAP_MACRO(PING, NICKNAME, CHANNEL) /*!< (Not used yet) for presence information */ \
-    MAP_MACRO(CDSC, CHANNEL, ADDRESS, PORT) /*!< (Not used yet) Channel Description informantion */ \
+    MAP_MACRO(CDSC, CHANNEL, ADDRESS, PORT) /*!< Channel Description information.  An optional
+        Length header and body list more channels, one "name address port" line each */ \
     /*! */
 
 /*!
@@ -83,6 +84,7 @@
     MAP_MACRO(PRESENCE, presence, Presence) /*!< Not used yet - used for setting presence info */ \
     MAP_MACRO(ADDRESS, address, Address) /*!< Not used yet - Channel IP Address in CDSC */ \
     MAP_MACRO(PORT, port, Port) /*!< Not used yet - Channel Port Number in CDSC */ \
+    MAP_MACRO(TOPIC, topic, Topic) /*!< Optional sub-topic of a TEXT message (selects the shard of a sharded channel) */ \
     /*! */
 
 //! @}
@@ -0,0 +1,787 @@
+/*!
+ * \file mchatv1_reactor.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Event driven stand-in for the mchat threads
+ *
+ * \details
+ * Every callback runs on the reactor thread, so the reactor's receive buffer and the
+ * comm send buffer need no locking.  Sources are only added or removed under the
+ * mutex of their mchat_thread, since ::mchat_reactor_resume() runs in the caller's thread.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "mchatv1.h"
+#include "mchatv1_proto.h"
+#include "mchatv1_formatter.h"
+#include "mchatv1_parser.h"
+#include "mchatv1_structs.h"
+#include "mchatv1_threads.h"
+#include "mchatv1_reactor.h"
+#include "mchatv1_session.h"
+#include "mchatv1_utils.h"
+
+
+/*****************************************************************************
+ * 								Reactor Plumbing							 *
+ *****************************************************************************/
+
+/*!
+ * \brief Function run on the reactor by mchat_reactor_call_sync
+ */
+typedef struct mchat_reactor_call
+{
+    GSourceFunc func;		/*!< Function to run */
+    gpointer data;			/*!< Argument of func */
+    GMutex mutex;			/*!< Protects done */
+    GCond cond;				/*!< Signalled when done is set */
+    gboolean done;			/*!< Set once func has returned */
+} mchat_reactor_call;
+
+
+static gpointer mchat_reactor_run(gpointer data)
+{
+    mchat_reactor_t *reactor = (mchat_reactor_t*)data;
+    g_main_context_push_thread_default(reactor->context);
+    g_main_loop_run(reactor->loop);
+    g_main_context_pop_thread_default(reactor->context);
+    return NULL;
+}
+
+
+static gboolean mchat_reactor_quit(gpointer data)
+{
+    g_main_loop_quit((GMainLoop*)data);
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean mchat_reactor_call_dispatch(gpointer data)
+{
+    mchat_reactor_call *call = (mchat_reactor_call*)data;
+    call->func(call->data);
+    g_mutex_lock(&call->mutex);
+    call->done = TRUE;
+    g_cond_signal(&call->cond);
+    g_mutex_unlock(&call->mutex);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*!
+ * \brief Run a function on the reactor and wait for it to return
+ * \param reactor Pointer to a reactor
+ * \param func Function to run
+ * \param data Argument of \p func
+ */
+static void mchat_reactor_call_sync(mchat_reactor_t *reactor, GSourceFunc func, gpointer data)
+{
+    /* Either nobody is dispatching or we are the reactor, so no callback can run meanwhile */
+    if (g_main_context_acquire(reactor->context))
+    {
+        func(data);
+        g_main_context_release(reactor->context);
+        return;
+    }
+
+    mchat_reactor_call call;
+    call.func = func;
+    call.data = data;
+    call.done = FALSE;
+    g_mutex_init(&call.mutex);
+    g_cond_init(&call.cond);
+    GSource *source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_HIGH);
+    g_source_set_callback(source, mchat_reactor_call_dispatch, &call, NULL);
+    g_source_attach(source, reactor->context);
+    g_source_unref(source);
+
+    g_mutex_lock(&call.mutex);
+    while (!call.done)
+        g_cond_wait(&call.cond, &call.mutex);
+    g_mutex_unlock(&call.mutex);
+    g_cond_clear(&call.cond);
+    g_mutex_clear(&call.mutex);
+}
+
+
+static gboolean mchat_reactor_timer_dispatch(GSource *source, GSourceFunc callback, gpointer data)
+{
+    return callback(data);
+}
+
+
+/*!
+ * \brief Timer source driven by its ready time, so any thread can re-arm or fire it
+ */
+static GSourceFuncs mchat_reactor_timer_funcs =
+{
+    NULL, NULL, mchat_reactor_timer_dispatch, NULL
+};
+
+
+/*!
+ * \brief Attach a timer that fires after \p delay microseconds
+ *
+ * \details
+ * The callback must re-arm the timer with g_source_set_ready_time(), or it fires again
+ * right away.
+ */
+static GSource *mchat_reactor_timer_new(mchat_thread *t, GSourceFunc func, gint64 delay)
+{
+    GSource *source = g_source_new(&mchat_reactor_timer_funcs, sizeof(GSource));
+    g_source_set_callback(source, func, t, NULL);
+    g_source_set_ready_time(source, g_get_monotonic_time() + delay);
+    g_source_attach(source, t->events->reactor->context);
+    return source;
+}
+
+
+/*!
+ * \brief Re-arm a timer to fire after \p delay microseconds
+ */
+static void mchat_reactor_timer_rearm(GSource *timer, gint64 delay)
+{
+    g_source_set_ready_time(timer, g_get_monotonic_time() + delay);
+}
+
+
+/*!
+ * \brief Watch a cancellable, replacing the thread's previous wakeup source
+ */
+static void mchat_reactor_watch_cancel(mchat_thread *t, GCancellable *cancel, GCancellableSourceFunc func)
+{
+    if (t->events->wakeup != NULL)
+    {
+        g_source_destroy(t->events->wakeup);
+        g_source_unref(t->events->wakeup);
+    }
+    GSource *source = g_cancellable_source_new(cancel);
+    g_source_set_callback(source, (GSourceFunc)func, t, NULL);
+    g_source_attach(source, t->events->reactor->context);
+    t->events->wakeup = source;
+}
+
+
+/*!
+ * \brief Watch the sockets of a receive role (mutex held)
+ */
+static void mchat_reactor_watch(mchat_thread *t)
+{
+    mchat_thread_events *ev = t->events;
+    guint count = ev->socks != NULL ? ev->socks->len : 1;
+    for (guint i = 0; i < count; i++)
+    {
+        GSocket *sock = ev->socks != NULL ? g_array_index(ev->socks, mchat_join_socket, i).sock : t->sock;
+        g_socket_set_blocking(sock, FALSE);
+        GSource *source = g_socket_create_source(sock, G_IO_IN, NULL);
+        g_source_set_callback(source, (GSourceFunc)ev->io_func, t, NULL);
+        g_source_attach(source, ev->reactor->context);
+        g_ptr_array_add(ev->io, source);
+    }
+}
+
+
+/*!
+ * \brief Stop watching the sockets of a receive role (mutex held)
+ */
+static void mchat_reactor_unwatch(mchat_thread *t)
+{
+    for (guint i = 0; i < t->events->io->len; i++)
+        g_source_destroy(g_ptr_array_index(t->events->io, i));
+    g_ptr_array_set_size(t->events->io, 0);
+}
+
+
+/*!
+ * \brief Stop reading if the message buffer of a receive role is full
+ * \return TRUE if the sockets are no longer watched
+ *
+ * \details
+ * Only ::MCHAT_DELIVERY_BLOCK holds reading back; the other policies deal with a full
+ * buffer as each message arrives.
+ */
+static gboolean mchat_reactor_backpressure(mchat_thread *t)
+{
+    g_mutex_lock(&t->mutex);
+    gboolean full = g_atomic_int_get(&t->buffer_flag) && g_atomic_int_get(&t->mchat->session_count) == 0 &&
+                    g_atomic_int_get(&t->mchat->reader_count) == 0 &&
+                    g_atomic_int_get(&t->mchat->delivery.policy) == MCHAT_DELIVERY_BLOCK;
+    if (full)
+    {
+        t->events->paused = 1;
+        mchat_reactor_unwatch(t);
+    }
+    g_mutex_unlock(&t->mutex);
+    return full;
+}
+
+
+/*!
+ * \brief Stop a role after a socket error, like a thread exiting
+ * \return G_SOURCE_REMOVE
+ */
+static gboolean mchat_reactor_fail(mchat_thread *t)
+{
+    g_atomic_int_set(&t->run_flag, 0);
+    t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
+    g_mutex_lock(&t->mutex);
+    mchat_reactor_unwatch(t);
+    g_mutex_unlock(&t->mutex);
+    return G_SOURCE_REMOVE;
+}
+
+
+/*!
+ * \brief Read one datagram into the reactor's receive buffer
+ * \param t Pointer to the receiving mchat_thread
+ * \param sock Readable socket
+ * \param sbytes Set to the source address of the datagram
+ * \return The datagram length, 0 if nothing is waiting, or -1 on a socket error
+ */
+static gssize mchat_reactor_receive(mchat_thread *t, GSocket *sock, guint32 *sbytes)
+{
+    gchar *buf = t->events->reactor->recv_buffer;
+    GSocketAddress *saddr;
+    GError *error = NULL;
+    gssize len = g_socket_receive_from(sock, &saddr, buf, (1 << 16) - 1, NULL, &error);
+    if (len < 0)
+    {
+        gboolean would_block = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+        g_error_free(error);
+        return would_block ? 0 : -1;
+    }
+    buf[len] = '\0';
+    *sbytes = mchatv1_thread_source_bytes(saddr);
+    return len;
+}
+
+
+/*!
+ * \brief Send a PING to an address
+ * \return 0 on success or -1 on a socket error
+ */
+static int mchat_reactor_send_ping(mchat_thread *t, GSocketAddress *addr, gchar *send_buffer)
+{
+    gssize send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_PING);
+    if (g_socket_send_to(t->sock, addr, send_buffer, send_len, NULL, NULL) != send_len)
+        return -1;
+    return 0;
+}
+
+/*****************************************************************************
+ * 								Role Callbacks								 *
+ *****************************************************************************/
+
+static gboolean mchat_reactor_comm_ping(gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_reactor_timer_rearm(t->events->timer, MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND);
+    if (g_atomic_int_get(&t->mchat->stealth_mode))
+        return G_SOURCE_CONTINUE;
+
+    gssize send_len = mchatv1_format(t, t->events->send_buffer, MCHATV1_MESSAGE_TYPE_PING);
+    if (g_socket_send_to(t->sock, t->addr, t->events->send_buffer, send_len, NULL, NULL) != send_len)
+        return mchat_reactor_fail(t);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean mchat_reactor_comm_cdsc(gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    gdouble interval = MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER *
+            g_random_double_range(1.0 - MCHAT_PROTOCOL_CDSC_JITTER, 1.0 + MCHAT_PROTOCOL_CDSC_JITTER);
+    mchat_reactor_timer_rearm(t->events->cdsc_timer, interval * G_TIME_SPAN_SECOND);
+    if (g_atomic_int_get(&t->mchat->stealth_mode))
+        return G_SOURCE_CONTINUE;
+
+    gint64 now = g_get_real_time();
+    if (mchatv1_thread_send_cdsc(t, t->events->send_buffer, t->events->last_cdsc) != 0)
+        return mchat_reactor_fail(t);
+    t->events->last_cdsc = now;
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean mchat_reactor_comm_recv(GSocket *sock, GIOCondition condition, gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_parser parser;
+    guint32 sbytes;
+
+    for (guint i = 0; i < MCHAT_REACTOR_RECV_BUDGET; i++)
+    {
+        gssize len = mchat_reactor_receive(t, sock, &sbytes);
+        if (len < 0)
+            return mchat_reactor_fail(t);
+        if (len == 0)
+            break;
+        memset(&parser, 0, sizeof(mchat_parser));
+        if (mchatv1_parse_and_validate(&parser, t->events->reactor->recv_buffer, len) == 0)
+            mchatv1_thread_handle_comm(t->mchat, &parser, sbytes);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean mchat_reactor_comm_expire(gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_reactor_timer_rearm(t->events->timer, MCHAT_REACTOR_EXPIRE_INTERVAL);
+    peerlist_expire(t->mchat);
+    mchat_channel_expire(t->mchat);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean mchat_reactor_text_ping(gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_reactor_timer_rearm(t->events->timer, MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND);
+    if (g_atomic_int_get(&t->mchat->stealth_mode))
+        return G_SOURCE_CONTINUE;
+
+    /* mchatv1_switch_channel() may replace the address at any time */
+    g_mutex_lock(&t->mutex);
+    int ret = mchat_reactor_send_ping(t, t->addr, t->events->send_buffer);
+    if (ret == 0)
+        ret = mchat_session_ping(t, t->addr, t->events->send_buffer);
+    g_mutex_unlock(&t->mutex);
+    if (ret != 0)
+        return mchat_reactor_fail(t);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean mchat_reactor_text_recv(GSocket *sock, GIOCondition condition, gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_parser parser;
+    guint32 sbytes;
+
+    for (guint i = 0; i < MCHAT_REACTOR_RECV_BUDGET; i++)
+    {
+        if (mchat_reactor_backpressure(t))
+            return G_SOURCE_REMOVE;
+        gssize len = mchat_reactor_receive(t, sock, &sbytes);
+        if (len < 0)
+            return mchat_reactor_fail(t);
+        if (len == 0)
+            break;
+
+        memset(&parser, 0, sizeof(mchat_parser));
+        if (mchatv1_parse_and_validate(&parser, t->events->reactor->recv_buffer, len) != 0)
+            continue;
+        if (parser.packet_type == MCHATV1_MESSAGE_TYPE_TEXT)
+            mchatv1_thread_deliver_text(t, &parser, sbytes, g_get_real_time());
+        if (parser.packet_type == MCHATV1_MESSAGE_TYPE_TEXT ||
+                parser.packet_type == MCHATV1_MESSAGE_TYPE_PING)
+            peerlist_update_peer(t->mchat, parser, sbytes, 0);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean mchat_reactor_text_retarget(GCancellable *cancel, gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    /* mchatv1_thread_destroy() cancels too */
+    if (!g_atomic_int_get(&t->run_flag))
+        return G_SOURCE_REMOVE;
+
+    g_mutex_lock(&t->mutex);
+    if (t->next_sock != NULL)
+    {
+        GSocket *old = t->sock;
+        t->sock = t->next_sock;
+        t->next_sock = NULL;
+        g_object_unref(old);
+        if (!t->events->paused)
+        {
+            mchat_reactor_unwatch(t);
+            mchat_reactor_watch(t);
+        }
+    }
+    g_cancellable_reset(t->cancel);
+    mchat_reactor_watch_cancel(t, t->cancel, mchat_reactor_text_retarget);
+    g_mutex_unlock(&t->mutex);
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean mchat_reactor_multi_recv(GSocket *sock, GIOCondition condition, gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_parser parser;
+    guint32 sbytes;
+
+    /* socks only changes on the reactor thread */
+    guint16 portno = 0;
+    for (guint i = 0; i < t->events->socks->len; i++)
+        if (g_array_index(t->events->socks, mchat_join_socket, i).sock == sock)
+            portno = g_array_index(t->events->socks, mchat_join_socket, i).portno;
+
+    for (guint i = 0; i < MCHAT_REACTOR_RECV_BUDGET; i++)
+    {
+        if (mchat_reactor_backpressure(t))
+            return G_SOURCE_REMOVE;
+        gssize len = mchat_reactor_receive(t, sock, &sbytes);
+        if (len < 0)
+            return mchat_reactor_fail(t);
+        if (len == 0)
+            break;
+
+        memset(&parser, 0, sizeof(mchat_parser));
+        if (mchatv1_parse_and_validate(&parser, t->events->reactor->recv_buffer, len) != 0)
+            continue;
+        if (!mchatv1_thread_join_accepts(t->mchat, &parser, portno))
+            continue;
+        if (parser.packet_type == MCHATV1_MESSAGE_TYPE_TEXT)
+            mchatv1_thread_deliver_text(t, &parser, sbytes, g_get_real_time());
+        peerlist_update_peer(t->mchat, parser, sbytes, 0);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+
+/*!
+ * \brief Clear function for the multi recv role's copy of mchat_t.join_sockets
+ */
+static void mchat_reactor_join_socket_clear(gpointer data)
+{
+    g_object_unref(((mchat_join_socket*)data)->sock);
+}
+
+
+static gboolean mchat_reactor_multi_reload(GCancellable *cancel, gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_t *mchat = t->mchat;
+
+    /* Reset before reading, so a change made during the reload wakes us again */
+    g_cancellable_reset(mchat->join_wakeup);
+    GArray *socks = g_array_new(FALSE, FALSE, sizeof(mchat_join_socket));
+    g_array_set_clear_func(socks, mchat_reactor_join_socket_clear);
+    g_mutex_lock(&mchat->join_mutex);
+    for (guint i = 0; i < mchat->join_sockets->len; i++)
+    {
+        mchat_join_socket js = *(mchat_join_socket*)g_ptr_array_index(mchat->join_sockets, i);
+        g_object_ref(js.sock);
+        g_array_append_val(socks, js);
+    }
+    g_mutex_unlock(&mchat->join_mutex);
+
+    g_mutex_lock(&t->mutex);
+    mchat_reactor_unwatch(t);
+    if (t->events->socks != NULL)
+        g_array_free(t->events->socks, TRUE);
+    t->events->socks = socks;
+    if (!t->events->paused)
+        mchat_reactor_watch(t);
+    mchat_reactor_watch_cancel(t, mchat->join_wakeup, mchat_reactor_multi_reload);
+    g_mutex_unlock(&t->mutex);
+    return G_SOURCE_REMOVE;
+}
+
+/*****************************************************************************
+ * 								Role Attach Functions						 *
+ *****************************************************************************/
+
+/*!
+ * \brief Allocate the message buffer strings, as the thread functions do on start
+ */
+static void mchat_reactor_alloc_buffer(mchat_thread *t)
+{
+    t->buffer->body = g_malloc(sizeof(gchar) * MCHAT_LIMIT_MAX_MESSAGE_SIZE);
+    t->buffer->nickname = g_malloc(sizeof(gchar) * MCHAT_LIMIT_MAX_NICKNAME_SIZE);
+}
+
+
+/*!
+ * \brief Send the 3 announcement pings a send thread starts with
+ */
+static void mchat_reactor_announce(mchat_thread *t)
+{
+    if (g_atomic_int_get(&t->mchat->stealth_mode))
+        return;
+    for (int i = 0; i < 3; i++)
+    {
+        if (mchat_reactor_send_ping(t, t->addr, t->events->send_buffer) != 0)
+        {
+            g_atomic_int_set(&t->run_flag, 0);
+            t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
+            return;
+        }
+    }
+}
+
+
+static void mchat_reactor_attach_comm_send(mchat_thread *t)
+{
+    t->events->send_buffer = g_malloc(1 << 16);
+    mchat_reactor_announce(t);
+    t->events->timer = mchat_reactor_timer_new(t, mchat_reactor_comm_ping,
+            MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND);
+    /* The first announcement goes out after a random fraction of the interval */
+    t->events->last_cdsc = g_get_real_time();
+    t->events->cdsc_timer = mchat_reactor_timer_new(t, mchat_reactor_comm_cdsc,
+            MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER * g_random_double() * G_TIME_SPAN_SECOND);
+}
+
+
+static void mchat_reactor_attach_comm_recv(mchat_thread *t)
+{
+    t->events->io_func = mchat_reactor_comm_recv;
+    mchat_reactor_watch(t);
+    t->events->timer = mchat_reactor_timer_new(t, mchat_reactor_comm_expire, MCHAT_REACTOR_EXPIRE_INTERVAL);
+}
+
+
+static void mchat_reactor_attach_text_send(mchat_thread *t)
+{
+    mchat_reactor_alloc_buffer(t);
+    t->events->send_buffer = g_malloc(1 << 16);
+    mchat_reactor_announce(t);
+    t->events->timer = mchat_reactor_timer_new(t, mchat_reactor_text_ping,
+            MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND);
+}
+
+
+static void mchat_reactor_attach_text_recv(mchat_thread *t)
+{
+    mchat_reactor_alloc_buffer(t);
+    t->events->io_func = mchat_reactor_text_recv;
+    mchat_reactor_watch(t);
+    mchat_reactor_watch_cancel(t, t->cancel, mchat_reactor_text_retarget);
+}
+
+
+static void mchat_reactor_attach_multi_recv(mchat_thread *t)
+{
+    mchat_reactor_alloc_buffer(t);
+    t->events->io_func = mchat_reactor_multi_recv;
+    t->events->socks = g_array_new(FALSE, FALSE, sizeof(mchat_join_socket));
+    g_array_set_clear_func(t->events->socks, mchat_reactor_join_socket_clear);
+    /* mchatv1_join_channel() holds join_mutex here and cancels join_wakeup afterwards,
+     * which loads the sockets */
+    mchat_reactor_watch_cancel(t, t->mchat->join_wakeup, mchat_reactor_multi_reload);
+}
+
+
+/*!
+ * \brief Thread functions and the attach functions replacing them
+ */
+static const struct
+{
+    gpointer (*thread_func)(gpointer);		/*!< Thread function */
+    void (*attach)(mchat_thread *t);		/*!< Attach function (mutex held) */
+} mchat_reactor_roles[] =
+{
+    { mchatv1_thread_comm_send, mchat_reactor_attach_comm_send },
+    { mchatv1_thread_comm_recv, mchat_reactor_attach_comm_recv },
+    { mchatv1_thread_text_send, mchat_reactor_attach_text_send },
+    { mchatv1_thread_text_recv, mchat_reactor_attach_text_recv },
+    { mchatv1_thread_multi_recv, mchat_reactor_attach_multi_recv },
+};
+
+
+static gboolean mchat_reactor_detach_sources(gpointer data)
+{
+    mchat_thread *t = (mchat_thread*)data;
+    mchat_thread_events *ev = t->events;
+
+    g_mutex_lock(&t->mutex);
+    mchat_reactor_unwatch(t);
+    g_mutex_unlock(&t->mutex);
+    GSource *sources[] = { ev->timer, ev->cdsc_timer, ev->wakeup };
+    for (guint i = 0; i < G_N_ELEMENTS(sources); i++)
+    {
+        if (sources[i] == NULL)
+            continue;
+        g_source_destroy(sources[i]);
+        g_source_unref(sources[i]);
+    }
+    g_ptr_array_free(ev->io, TRUE);
+    if (ev->socks != NULL)
+        g_array_free(ev->socks, TRUE);
+    g_free(ev->send_buffer);
+    g_free(t->buffer->body);
+    g_free(t->buffer->nickname);
+    g_free(ev);
+    t->events = NULL;
+    return G_SOURCE_REMOVE;
+}
+
+/*****************************************************************************
+ * 								Internal API								 *
+ *****************************************************************************/
+
+void mchat_reactor_attach(mchat_reactor_t *reactor, mchat_thread *t, gpointer (*thread_func)(gpointer))
+{
+    mchat_thread_events *ev = g_malloc0(sizeof(mchat_thread_events));
+    ev->reactor = reactor;
+    ev->io = g_ptr_array_new_with_free_func((GDestroyNotify)g_source_unref);
+    t->events = ev;
+    for (guint i = 0; i < G_N_ELEMENTS(mchat_reactor_roles); i++)
+        if (mchat_reactor_roles[i].thread_func == thread_func)
+            mchat_reactor_roles[i].attach(t);
+    g_mutex_unlock(&t->mutex);
+}
+
+
+void mchat_reactor_detach(mchat_thread *t)
+{
+    mchat_reactor_call_sync(t->events->reactor, mchat_reactor_detach_sources, t);
+}
+
+
+void mchat_reactor_wake(mchat_thread *t)
+{
+    if (t->events->timer != NULL)
+        g_source_set_ready_time(t->events->timer, 0);
+}
+
+
+void mchat_reactor_resume(mchat_thread *t)
+{
+    if (!t->events->paused)
+        return;
+    t->events->paused = 0;
+    mchat_reactor_watch(t);
+}
+
+
+int mchat_reactor_text_send(mchat_thread *t)
+{
+    gchar *send_buffer = t->events->send_buffer;
+    t->nickname = t->buffer->nickname;
+    t->nickname_size = t->buffer->nickname_len;
+    gssize send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_TEXT);
+    t->nickname = NULL;
+    g_atomic_int_set(&t->buffer_flag, 0);
+    GSocketAddress *addr = t->send_addr != NULL ? t->send_addr : t->addr;
+    gssize sent = g_socket_send_to(t->sock, addr, send_buffer, send_len, NULL, NULL);
+    if (t->send_addr != NULL)
+    {
+        g_object_unref(t->send_addr);
+        t->send_addr = NULL;
+    }
+    if (sent != send_len)
+    {
+        g_atomic_int_set(&t->run_flag, 0);
+        t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
+        return -1;
+    }
+    /* Like the thread, only ping when we have been quiet for a keepalive interval */
+    mchat_reactor_timer_rearm(t->events->timer, MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND);
+    return 0;
+}
+
+/*****************************************************************************
+ * 								Public API									 *
+ *****************************************************************************/
+
+mchat_reactor_t *mchatv1_reactor_new(void)
+{
+    mchat_reactor_t *reactor = g_malloc0(sizeof(mchat_reactor_t));
+    reactor->context = g_main_context_new();
+    reactor->loop = g_main_loop_new(reactor->context, FALSE);
+    reactor->recv_buffer = g_malloc(1 << 16);
+    reactor->thread = g_thread_new("MChat Reactor", mchat_reactor_run, reactor);
+    return reactor;
+}
+
+
+mchat_reactor_t *mchatv1_reactor_new_for_context(GMainContext *context)
+{
+    mchat_reactor_t *reactor = g_malloc0(sizeof(mchat_reactor_t));
+    reactor->context = g_main_context_ref(context != NULL ? context : g_main_context_default());
+    reactor->recv_buffer = g_malloc(1 << 16);
+    return reactor;
+}
+
+
+int mchatv1_reactor_destroy(mchat_reactor_t **reactor)
+{
+    mchat_reactor_t *r = *reactor;
+    if (g_atomic_int_get(&r->users) != 0)
+        return -1;
+
+    /* The application runs the loop of a reactor made for its context */
+    if (r->thread != NULL)
+    {
+        /* Quit from inside the loop, in case it has not started running yet */
+        GSource *source = g_idle_source_new();
+        g_source_set_callback(source, mchat_reactor_quit, r->loop, NULL);
+        g_source_attach(source, r->context);
+        g_source_unref(source);
+        g_thread_join(r->thread);
+        g_main_loop_unref(r->loop);
+    }
+    g_main_context_unref(r->context);
+    g_free(r->recv_buffer);
+    g_free(r);
+    *reactor = NULL;
+    return 0;
+}
+
+
+mchat_runtime_t *mchatv1_runtime_new(unsigned int threads)
+{
+    if (threads == 0)
+        threads = g_get_num_processors();
+
+    mchat_runtime_t *runtime = g_malloc0(sizeof(mchat_runtime_t));
+    runtime->reactors = g_malloc(sizeof(mchat_reactor_t*) * threads);
+    for (guint i = 0; i < threads; i++)
+        runtime->reactors[i] = mchatv1_reactor_new();
+    runtime->reactor_count = threads;
+    g_mutex_init(&runtime->mutex);
+    return runtime;
+}
+
+
+int mchatv1_runtime_destroy(mchat_runtime_t **runtime)
+{
+    mchat_runtime_t *rt = *runtime;
+    /* mchatv1_init_runtime() counts its new object under the mutex */
+    g_mutex_lock(&rt->mutex);
+    for (guint i = 0; i < rt->reactor_count; i++)
+    {
+        if (g_atomic_int_get(&rt->reactors[i]->users) != 0)
+        {
+            g_mutex_unlock(&rt->mutex);
+            return -1;
+        }
+    }
+
+    for (guint i = 0; i < rt->reactor_count; i++)
+        mchatv1_reactor_destroy(&rt->reactors[i]);
+    g_mutex_unlock(&rt->mutex);
+    g_free(rt->reactors);
+    g_mutex_clear(&rt->mutex);
+    g_free(rt);
+    *runtime = NULL;
+    return 0;
+}
+
+
+mchat_t *mchatv1_init_runtime(char *cfg_filename, mchat_runtime_t *runtime)
+{
+    if (runtime == NULL)
+        return NULL;
+
+    /* Hold the mutex until the new object is counted, so a burst of sessions spreads out */
+    g_mutex_lock(&runtime->mutex);
+    mchat_reactor_t *reactor = runtime->reactors[0];
+    for (guint i = 1; i < runtime->reactor_count; i++)
+        if (g_atomic_int_get(&runtime->reactors[i]->users) < g_atomic_int_get(&reactor->users))
+            reactor = runtime->reactors[i];
+    mchat_t *mchat = mchatv1_init_reactor(cfg_filename, reactor);
+    g_mutex_unlock(&runtime->mutex);
+    return mchat;
+}
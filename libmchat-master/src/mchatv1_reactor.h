@@ -0,0 +1,80 @@
+/*!
+ * \file mchatv1_reactor.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Event driven stand-in for the mchat threads
+ *
+ * \details
+ * A reactor is one thread running a GMainContext, or (::mchatv1_reactor_new_for_context())
+ * a GMainContext the application iterates itself.  An mchat object created with
+ * ::mchatv1_init_reactor() still has its mchat_thread structs (sockets, buffers and
+ * mutexes are used exactly as before), but instead of starting a thread for each,
+ * ::mchatv1_thread_init() hands them to the reactor, which attaches socket sources
+ * and timers doing the same work as the thread functions:
+ *
+ * - comm send: keepalive and CDSC timers
+ * - comm recv: common channel socket and an expiry timer
+ * - text send: keepalive timer.  Messages are formatted and sent right away by the
+ *   thread calling ::mchatv1_send_message()
+ * - text recv: channel socket, and mchat_thread.cancel to pick up mchat_thread.next_sock
+ * - multi recv: every join socket, and mchat_t.join_wakeup to reload them
+ *
+ * A receive role stops watching its sockets while its message buffer is full, and
+ * ::mchat_reactor_resume() starts watching them again once the message is taken.
+ */
+#ifndef MCHATV1_REACTOR_H
+#define MCHATV1_REACTOR_H
+
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_structs.h"
+
+/*!
+ * \brief Datagrams read from one socket per dispatch, so one busy socket cannot starve the rest
+ */
+#define MCHAT_REACTOR_RECV_BUDGET 64
+
+/*!
+ * \brief Interval of the peer and channel expiry timer in microseconds
+ */
+#define MCHAT_REACTOR_EXPIRE_INTERVAL G_TIME_SPAN_SECOND
+
+/*!
+ * \brief Attach the event sources doing the work of a thread function
+ * \param reactor Reactor to attach to
+ * \param t Pointer to an initialized mchat_thread (mutex held, unlocked by this function)
+ * \param thread_func The thread function that would otherwise be started
+ */
+void mchat_reactor_attach(mchat_reactor_t *reactor, mchat_thread *t, gpointer (*thread_func)(gpointer));
+
+/*!
+ * \brief Remove and free the event sources of a thread
+ * \param t Pointer to an attached mchat_thread
+ *
+ * \details
+ * This waits for the reactor, so no callback uses \p t after it returns.  Call it
+ * without holding any mchat mutex.
+ */
+void mchat_reactor_detach(mchat_thread *t);
+
+/*!
+ * \brief Fire the timer of a thread right away
+ * \param t Pointer to an attached mchat_thread
+ */
+void mchat_reactor_wake(mchat_thread *t);
+
+/*!
+ * \brief Watch the sockets of a receive role again after its buffer was taken
+ * \param t Pointer to an attached mchat_thread (mutex held)
+ */
+void mchat_reactor_resume(mchat_thread *t);
+
+/*!
+ * \brief Format and send the message in a text send thread's buffer
+ * \param t Pointer to the attached text send thread (mutex held, buffer_flag set)
+ * \return 0 on success or -1 on a socket error
+ */
+int mchat_reactor_text_send(mchat_thread *t);
+
+#endif // MCHATV1_REACTOR_H
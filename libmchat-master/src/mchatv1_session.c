@@ -0,0 +1,285 @@
+/*!
+ * \file mchatv1_session.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Virtual sessions sharing the sockets of one mchat object
+ */
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "mchatv1.h"
+#include "mchatv1_proto.h"
+#include "mchatv1_structs.h"
+#include "mchatv1_formatter.h"
+#include "mchatv1_threads.h"
+#include "mchatv1_delivery.h"
+#include "mchatv1_session.h"
+
+
+/*!
+ * \brief Queue a received message for one session according to its delivery policy
+ * \param s Pointer to a session (mchat_t.session_mutex held)
+ * \param m Message to queue (copied)
+ */
+static void mchat_session_deliver(mchat_session_t *s, const mchat_message_t *m)
+{
+    int policy = g_atomic_int_get(&s->delivery.policy);
+    /* Once messages are spilled, newer ones go behind them to keep the order */
+    gboolean spilling = s->spill != NULL && s->spill->count > 0;
+    if (!spilling && g_queue_get_length(&s->queue) < MCHAT_LIMIT_MAX_SESSION_QUEUE)
+    {
+        g_queue_push_tail(&s->queue, mchat_delivery_message_copy(m));
+        g_atomic_int_inc(&s->delivery.delivered);
+    }
+    else if (policy == MCHAT_DELIVERY_SPILL || spilling)
+    {
+        if (s->spill == NULL)
+            s->spill = mchat_spill_new();
+        if (s->spill != NULL && mchat_spill_push(s->spill, m) == 0)
+            g_atomic_int_inc(&s->delivery.spilled);
+        else
+            g_atomic_int_inc(&s->delivery.dropped);
+    }
+    else if (policy == MCHAT_DELIVERY_DROP_OLDEST)
+    {
+        mchat_message_t *old = g_queue_pop_head(&s->queue);
+        mchatv1_message_destroy(&old);
+        g_queue_push_tail(&s->queue, mchat_delivery_message_copy(m));
+        g_atomic_int_inc(&s->delivery.delivered);
+        g_atomic_int_inc(&s->delivery.dropped);
+    }
+    else
+        g_atomic_int_inc(&s->delivery.dropped);
+}
+
+
+/*!
+ * \brief Get the number of messages waiting for a session
+ * \param s Pointer to a session (mchat_t.session_mutex held)
+ */
+static guint mchat_session_backlog(mchat_session_t *s)
+{
+    return g_queue_get_length(&s->queue) + (s->spill != NULL ? s->spill->count : 0);
+}
+
+
+/*!
+ * \brief Drop a reference to a session, freeing it and its queued messages with the last
+ * \param s Pointer to a session
+ */
+static void mchat_session_unref(mchat_session_t *s)
+{
+    if (!g_atomic_int_dec_and_test(&s->ref_count))
+        return;
+    mchat_message_t *m;
+    while ((m = g_queue_pop_head(&s->queue)) != NULL)
+        mchatv1_message_destroy(&m);
+    mchat_spill_destroy(s->spill);
+    g_free(s);
+}
+
+
+int mchat_session_fanout(mchat_t *mchat, mchat_parser *parser, guint32 sbytes, gint64 recv_time)
+{
+    if (g_atomic_int_get(&mchat->session_count) == 0)
+        return 0;
+
+    /* The parser points into the receive buffer, so the template needs no copying */
+    mchat_message_t tmpl;
+    mchat_delivery_message_view(&tmpl, parser, sbytes, recv_time);
+
+    GPtrArray *crossed = NULL;
+    mchat_watermark *wm = mchat_snapshot_acquire(&mchat->watermark);
+    g_mutex_lock(&mchat->session_mutex);
+    int count = mchat->sessions->len;
+    for (guint i = 0; i < mchat->sessions->len; i++)
+    {
+        mchat_session_t *s = g_ptr_array_index(mchat->sessions, i);
+        mchat_session_deliver(s, &tmpl);
+        if (mchat_delivery_watermark(wm, mchat_session_backlog(s), &s->above_watermark))
+        {
+            if (crossed == NULL)
+                crossed = g_ptr_array_new();
+            /* Kept alive for the call, even if it is destroyed meanwhile */
+            g_atomic_int_inc(&s->ref_count);
+            g_ptr_array_add(crossed, s);
+        }
+    }
+    g_mutex_unlock(&mchat->session_mutex);
+
+    /* Called unlocked, so the function can drain the session right away.  Backlogs
+     * grow one message at a time, so a crossed one equals the watermark */
+    if (crossed != NULL)
+    {
+        for (guint i = 0; i < crossed->len; i++)
+        {
+            mchat_session_t *s = g_ptr_array_index(crossed, i);
+            wm->func(mchat, s, wm->high, wm->data);
+            mchat_session_unref(s);
+        }
+        g_ptr_array_free(crossed, TRUE);
+    }
+    if (wm != NULL)
+        mchat_snapshot_unref(wm);
+    return count;
+}
+
+
+int mchat_session_ping(mchat_thread *t, GSocketAddress *addr, gchar *send_buffer)
+{
+    mchat_t *mchat = t->mchat;
+    int ret = 0;
+    g_mutex_lock(&mchat->session_mutex);
+    for (guint i = 0; i < mchat->sessions->len && ret == 0; i++)
+    {
+        mchat_session_t *s = g_ptr_array_index(mchat->sessions, i);
+        t->nickname = s->nickname;
+        t->nickname_size = s->nickname_size;
+        gssize send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_PING);
+        if (g_socket_send_to(t->sock, addr, send_buffer, send_len, NULL, NULL) != send_len)
+            ret = -1;
+    }
+    t->nickname = NULL;
+    g_mutex_unlock(&mchat->session_mutex);
+    return ret;
+}
+
+
+void mchat_session_destroy_all(mchat_t *mchat)
+{
+    g_mutex_lock(&mchat->session_mutex);
+    for (guint i = 0; i < mchat->sessions->len; i++)
+        mchat_session_unref(g_ptr_array_index(mchat->sessions, i));
+    g_ptr_array_set_size(mchat->sessions, 0);
+    g_atomic_int_set(&mchat->session_count, 0);
+    g_mutex_unlock(&mchat->session_mutex);
+}
+
+/*****************************************************************************
+ * 								Public API									 *
+ *****************************************************************************/
+
+mchat_session_t *mchatv1_session_new(mchat_t *mchat, char *nickname)
+{
+    if (mchat == NULL || nickname == NULL)
+        return NULL;
+    size_t len = strlen(nickname);
+    if (len == 0 || len >= MCHAT_LIMIT_MAX_NICKNAME_SIZE)
+        return NULL;
+
+    mchat_session_t *s = g_malloc0(sizeof(mchat_session_t));
+    s->mchat = mchat;
+    s->ref_count = 1;
+    memcpy(s->nickname, nickname, len);
+    s->nickname_size = len;
+    g_queue_init(&s->queue);
+    s->delivery.policy = MCHAT_DELIVERY_DROP_OLDEST;
+
+    g_mutex_lock(&mchat->session_mutex);
+    g_ptr_array_add(mchat->sessions, s);
+    g_atomic_int_set(&mchat->session_count, mchat->sessions->len);
+    g_mutex_unlock(&mchat->session_mutex);
+
+    mchatv1_thread_release_recv(mchat);
+    /* Announce the new identity now rather than at the next keepalive */
+    g_mutex_lock(&mchat->channels_mutex);
+    if (g_atomic_int_get(&mchat->is_connected))
+    {
+        mchat_thread *send = mchat->text_send_thread;
+        g_mutex_lock(&send->mutex);
+        mchatv1_thread_wake(send);
+        g_mutex_unlock(&send->mutex);
+    }
+    g_mutex_unlock(&mchat->channels_mutex);
+    return s;
+}
+
+
+int mchatv1_session_destroy(mchat_session_t **session)
+{
+    if (session == NULL || *session == NULL)
+        return -1;
+
+    mchat_t *mchat = (*session)->mchat;
+    g_mutex_lock(&mchat->session_mutex);
+    gboolean found = g_ptr_array_remove(mchat->sessions, *session);
+    g_atomic_int_set(&mchat->session_count, mchat->sessions->len);
+    g_mutex_unlock(&mchat->session_mutex);
+    if (!found)
+        return -1;
+
+    mchat_session_unref(*session);
+    *session = NULL;
+    return 0;
+}
+
+
+int mchatv1_session_recv_message(mchat_session_t *session, mchat_message_t **message)
+{
+    if (session == NULL || message == NULL)
+        return -1;
+
+    mchat_t *mchat = session->mchat;
+    mchat_watermark *wm = mchat_snapshot_acquire(&mchat->watermark);
+    g_mutex_lock(&mchat->session_mutex);
+    mchat_message_t *m = g_queue_pop_head(&session->queue);
+    if (m != NULL && session->spill != NULL && session->spill->count > 0)
+    {
+        guint lost;
+        mchat_message_t *next = mchat_spill_pop(session->spill, &lost);
+        if (next != NULL)
+        {
+            g_queue_push_tail(&session->queue, next);
+            g_atomic_int_inc(&session->delivery.delivered);
+        }
+        g_atomic_int_add(&session->delivery.dropped, lost);
+    }
+    /* Only rearms the watermark, as the backlog just shrank */
+    mchat_delivery_watermark(wm, mchat_session_backlog(session), &session->above_watermark);
+    g_mutex_unlock(&mchat->session_mutex);
+    if (wm != NULL)
+        mchat_snapshot_unref(wm);
+    if (m == NULL)
+        return 0;
+
+    *message = m;
+    return 1;
+}
+
+
+int mchatv1_session_get_nickname(mchat_session_t *session, char *buf, unsigned int buf_size)
+{
+    if (session->nickname_size >= buf_size)
+        return -1;
+
+    memcpy(buf, session->nickname, session->nickname_size);
+    buf[session->nickname_size] = '\0';
+    return session->nickname_size;
+}
+
+
+int mchatv1_session_set_delivery_policy(mchat_session_t *session, int policy)
+{
+    if (session == NULL || policy < MCHAT_DELIVERY_DROP_NEWEST || policy > MCHAT_DELIVERY_SPILL)
+        return -1;
+
+    g_atomic_int_set(&session->delivery.policy, policy);
+    return 0;
+}
+
+
+int mchatv1_session_get_delivery_counters(mchat_session_t *session, unsigned int *delivered,
+        unsigned int *dropped, unsigned int *spilled)
+{
+    if (session == NULL)
+        return -1;
+
+    if (delivered != NULL)
+        *delivered = g_atomic_int_get(&session->delivery.delivered);
+    if (dropped != NULL)
+        *dropped = g_atomic_int_get(&session->delivery.dropped);
+    if (spilled != NULL)
+        *spilled = g_atomic_int_get(&session->delivery.spilled);
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*!
+ * \file mchatv1_session.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Virtual sessions sharing the sockets of one mchat object
+ *
+ * \details
+ * The receive paths hand each parsed text message to ::mchat_session_fanout(), which
+ * queues a compact copy for every attached session.  The text send keepalive calls
+ * ::mchat_session_ping() after its own PING so every session stays in the peer lists
+ * of other hosts.
+ */
+#ifndef MCHATV1_SESSION_H
+#define MCHATV1_SESSION_H
+
+#include <glib.h>
+#include "mchatv1.h"
+#include "mchatv1_structs.h"
+
+/*!
+ * \brief Queue a copy of a received text message for every session
+ * \param mchat Pointer to the mchat object the message was received by
+ * \param parser Parser holding the validated message
+ * \param sbytes Source address of the message
+ * \param recv_time Time the message was received
+ * \return Number of sessions the message was queued for
+ */
+int mchat_session_fanout(mchat_t *mchat, mchat_parser *parser, guint32 sbytes, gint64 recv_time);
+
+/*!
+ * \brief Send a PING for every session
+ * \param t Pointer to the text send thread (mutex held)
+ * \param addr Address to send the PINGs to
+ * \param send_buffer Format buffer large enough for a PING
+ * \return 0 on success or -1 on a socket error
+ */
+int mchat_session_ping(mchat_thread *t, GSocketAddress *addr, gchar *send_buffer);
+
+/*!
+ * \brief Free every session still attached to an mchat object
+ * \param mchat Pointer to an mchat object whose threads are stopped
+ */
+void mchat_session_destroy_all(mchat_t *mchat);
+
+#endif // MCHATV1_SESSION_H
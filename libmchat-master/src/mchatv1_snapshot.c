@@ -0,0 +1,118 @@
+/*!
+ * \file mchatv1_snapshot.c
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Reference counted, immutable snapshots for read-mostly data
+ *
+ * \details
+ * Readers announce themselves in mchat_snapshot_slot.readers for the short window
+ * between loading the published pointer and taking their reference.  A writer only
+ * drops the slot's reference on a replaced snapshot once it has seen that counter at
+ * zero after the swap, so a reader can never take a reference on freed memory.
+ */
+
+#include <glib.h>
+#include "mchatv1_snapshot.h"
+
+
+void mchat_snapshot_init(mchat_snapshot *snap, GDestroyNotify free_func)
+{
+    snap->ref_count = 1;
+    snap->generation = 0;
+    snap->free_func = free_func;
+}
+
+
+gpointer mchat_snapshot_ref(gpointer snap)
+{
+    g_atomic_int_inc(&((mchat_snapshot*)snap)->ref_count);
+    return snap;
+}
+
+
+void mchat_snapshot_unref(gpointer snap)
+{
+    mchat_snapshot *s = (mchat_snapshot*)snap;
+    if (g_atomic_int_dec_and_test(&s->ref_count))
+        s->free_func(s);
+}
+
+
+void mchat_snapshot_slot_init(mchat_snapshot_slot *slot)
+{
+    slot->current = NULL;
+    slot->readers = 0;
+    slot->generation = 0;
+    slot->retired = NULL;
+    slot->retired_count = 0;
+}
+
+
+void mchat_snapshot_slot_clear(mchat_snapshot_slot *slot)
+{
+    gpointer cur = g_atomic_pointer_get(&slot->current);
+    g_atomic_pointer_set(&slot->current, NULL);
+    if (cur != NULL)
+        mchat_snapshot_unref(cur);
+    g_slist_free_full(slot->retired, mchat_snapshot_unref);
+    slot->retired = NULL;
+    slot->retired_count = 0;
+}
+
+
+guint mchat_snapshot_publish(mchat_snapshot_slot *slot, gpointer snap)
+{
+    mchat_snapshot *s = (mchat_snapshot*)snap;
+    guint gen = (guint)g_atomic_int_get(&slot->generation) + 1;
+
+    s->generation = gen;
+    gpointer old = g_atomic_pointer_get(&slot->current);
+    g_atomic_pointer_set(&slot->current, snap);
+    g_atomic_int_set(&slot->generation, (gint)gen);
+
+    if (old != NULL)
+    {
+        slot->retired = g_slist_prepend(slot->retired, old);
+        slot->retired_count++;
+    }
+    mchat_snapshot_reclaim(slot);
+
+    /* Readers only stay in the acquire window for a few instructions, so waiting
+     * for a gap between them is short and keeps the retired list bounded */
+    while (slot->retired_count >= MCHAT_SNAPSHOT_MAX_RETIRED)
+    {
+        g_thread_yield();
+        mchat_snapshot_reclaim(slot);
+    }
+    return gen;
+}
+
+
+void mchat_snapshot_reclaim(mchat_snapshot_slot *slot)
+{
+    /* Anyone who shows up after this check can only load the new snapshot */
+    if (slot->retired == NULL || g_atomic_int_get(&slot->readers) != 0)
+        return;
+
+    g_slist_free_full(slot->retired, mchat_snapshot_unref);
+    slot->retired = NULL;
+    slot->retired_count = 0;
+}
+
+
+gpointer mchat_snapshot_acquire(mchat_snapshot_slot *slot)
+{
+    g_atomic_int_inc(&slot->readers);
+    gpointer snap = g_atomic_pointer_get(&slot->current);
+    if (snap != NULL)
+        mchat_snapshot_ref(snap);
+    g_atomic_int_add(&slot->readers, -1);
+    return snap;
+}
+
+
+guint mchat_snapshot_slot_generation(mchat_snapshot_slot *slot)
+{
+    return (guint)g_atomic_int_get(&slot->generation);
+}
@@ -0,0 +1,139 @@
+/*!
+ * \file mchatv1_snapshot.h
+ * \author Sean Tracy
+ * \date 18 October 2026
+ * \version 0.0.1
+ * \brief Reference counted, immutable snapshots for read-mostly data
+ *
+ * \details
+ * Some of the lists libmchat keeps (the peer list, for instance) are written by
+ * the receive threads and read by the UI far more often than they change.  Instead
+ * of copying the list under a mutex for every reader, the writer builds an immutable
+ * snapshot and publishes it into an ::mchat_snapshot_slot.  Readers take a reference
+ * to the published snapshot without locking or copying.
+ *
+ * Writers must serialize calls to ::mchat_snapshot_publish themselves (they normally
+ * already hold the lock protecting the data being published).  Readers only ever use
+ * ::mchat_snapshot_acquire and ::mchat_snapshot_unref.
+ */
+#ifndef MCHATV1_SNAPSHOT_H
+#define MCHATV1_SNAPSHOT_H
+
+#include <glib.h>
+
+/*!
+ * \brief Retired snapshots a slot keeps before a publish waits for the readers to drain
+ */
+#define MCHAT_SNAPSHOT_MAX_RETIRED 8
+
+/*!
+ * \brief Common header for every snapshot object
+ *
+ * \details
+ * This must be the first member of any struct published through a snapshot slot,
+ * so that a pointer to the struct can be used as a pointer to this header.
+ */
+typedef struct mchat_snapshot
+{
+    volatile gint ref_count;	/*!< Reference count (the slot holds one while published) */
+    guint generation;			/*!< Generation number assigned when the snapshot was published */
+    GDestroyNotify free_func;	/*!< Called to free the snapshot when its last reference is dropped */
+} mchat_snapshot;
+
+
+/*!
+ * \brief Publication point for a snapshot
+ */
+typedef struct mchat_snapshot_slot
+{
+    gpointer current;			/*!< Currently published snapshot (only accessed atomically) */
+    volatile gint readers;		/*!< Readers in the middle of ::mchat_snapshot_acquire */
+    volatile gint generation;	/*!< Generation of the current snapshot */
+    GSList *retired;			/*!< Replaced snapshots that may still be being acquired (writer only) */
+    guint retired_count;		/*!< Length of retired (writer only) */
+} mchat_snapshot_slot;
+
+
+/*!
+ * \brief Initialize the header of a new snapshot object
+ * \param snap Pointer to the snapshot header
+ * \param free_func Function used to free the snapshot object
+ *
+ * \details
+ * The snapshot starts with a single reference, owned by the caller.  Publishing
+ * the snapshot hands that reference over to the slot.
+ */
+void mchat_snapshot_init(mchat_snapshot *snap, GDestroyNotify free_func);
+
+/*!
+ * \brief Take an additional reference to a snapshot
+ * \param snap Pointer to a snapshot object
+ * \return \p snap
+ */
+gpointer mchat_snapshot_ref(gpointer snap);
+
+/*!
+ * \brief Drop a reference to a snapshot, freeing it if it was the last one
+ * \param snap Pointer to a snapshot object
+ */
+void mchat_snapshot_unref(gpointer snap);
+
+/*!
+ * \brief Initialize an empty snapshot slot
+ * \param slot Pointer to the slot
+ */
+void mchat_snapshot_slot_init(mchat_snapshot_slot *slot);
+
+/*!
+ * \brief Release the published snapshot and any retired snapshots
+ * \param slot Pointer to the slot
+ *
+ * \warning No readers or writers may use the slot during or after this call.
+ */
+void mchat_snapshot_slot_clear(mchat_snapshot_slot *slot);
+
+/*!
+ * \brief Publish a new snapshot, replacing the current one
+ * \param slot Pointer to the slot
+ * \param snap Snapshot to publish (the slot takes over the caller's reference)
+ * \return The generation number assigned to \p snap
+ *
+ * \details
+ * Replaced snapshots are kept until no reader can still be acquiring them.  Once
+ * ::MCHAT_SNAPSHOT_MAX_RETIRED have piled up (readers kept arriving at every publish)
+ * this waits for the acquire window to empty, which never takes more than a few
+ * atomic operations per reader, so the list stays bounded.
+ *
+ * \warning Calls to this function must be serialized by the caller.
+ */
+guint mchat_snapshot_publish(mchat_snapshot_slot *slot, gpointer snap);
+
+/*!
+ * \brief Free retired snapshots which can no longer be reached by readers
+ * \param slot Pointer to the slot
+ *
+ * \details
+ * This is called by ::mchat_snapshot_publish, but writers may call it on their own
+ * (with the same serialization) to release memory sooner.
+ */
+void mchat_snapshot_reclaim(mchat_snapshot_slot *slot);
+
+/*!
+ * \brief Get a reference to the currently published snapshot
+ * \param slot Pointer to the slot
+ * \return The current snapshot with a new reference or NULL if none was published
+ *
+ * \details
+ * This function does not lock and does not copy.  The caller must drop the reference
+ * with ::mchat_snapshot_unref when done.
+ */
+gpointer mchat_snapshot_acquire(mchat_snapshot_slot *slot);
+
+/*!
+ * \brief Get the generation of the currently published snapshot
+ * \param slot Pointer to the slot
+ * \return The generation number (0 if nothing has been published)
+ */
+guint mchat_snapshot_slot_generation(mchat_snapshot_slot *slot);
+
+#endif // MCHATV1_SNAPSHOT_H
@@ -13,35 +13,108 @@
 #ifndef MCHATV1_STRUCTS_H
 #define MCHATV1_STRUCTS_H
 
+#include <stdio.h>
 #include <glib.h>
 #include <gio/gio.h>
 #include "mchatv1.h"
 #include "mchatv1_proto.h"
+#include "mchatv1_snapshot.h"
+#include "mchatv1_intern.h"
+
+/*!
+ * \brief Assumed size of a cache line in bytes
+ */
+#define MCHAT_CACHE_LINE_SIZE 64
+
+/*!
+ * \brief Start a struct member on a new cache line
+ *
+ * \details
+ * Members written by different threads are grouped, and each group starts on its own
+ * line, so writes by one thread do not keep invalidating a line another thread reads.
+ * Structs using this must be allocated with ::cache_aligned_alloc0().
+ */
+#if defined(__GNUC__)
+#define MCHAT_CACHE_ALIGNED __attribute__((aligned(MCHAT_CACHE_LINE_SIZE)))
+#else
+#define MCHAT_CACHE_ALIGNED
+#endif
 
 /*!
  * \brief Visible Peers list entry
+ *
+ * \details
+ * The nickname and channel are interned (see mchatv1_intern.h).  Every copy of a
+ * peer entry (snapshots, events) holds its own references to them.
  */
 typedef struct mchat_peer
 {
-    gchar nickname[MCHAT_LIMIT_MAX_NICKNAME_SIZE];		/*!< Nickname of the peer */
-    gchar channel[MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE];	/*!< Channel peer is connected to */
-    guint32 nickname_len;								/*!< Length of the nickname string */
-    guint32 channel_len;								/*!< Length of the channel name string */
-    guint64 last_seen;									/*!< Last time the peer was seen */
-    guint32 source_address;								/*!< The source address of the peer */
+    mchat_istr *nickname;		/*!< Nickname of the peer */
+    mchat_istr *channel;		/*!< Channel peer is connected to */
+    guint64 last_seen;			/*!< Last time the peer was seen */
+    guint32 source_address;		/*!< The source address of the peer */
+    guint32 text_count;			/*!< Number of TEXT messages received from the peer */
+    guint32 ping_count;			/*!< Number of PINGs received from the peer (all channels) */
+    guint32 keepalive_count;	/*!< Number of common channel keepalives counted for loss estimation */
+    guint32 keepalive_lost;		/*!< Estimated number of common channel keepalives lost */
+    guint64 byte_count;			/*!< Total bytes received from the peer */
+    gint64 last_text;			/*!< Time of the last TEXT message (0 if none) */
+    gint64 last_keepalive;		/*!< Arrival time of the last counted keepalive */
+    guint32 jitter;				/*!< Keepalive inter-arrival jitter estimate in microseconds */
 } mchat_peer;
 
 
+/*!
+ * \brief Members of a channel, as seen in peer CHANNEL headers
+ *
+ * \details
+ * Entries of mchat_t.channel_members, kept up to date by the peerlist functions.
+ */
+typedef struct mchat_channel_members
+{
+    mchat_istr *channel;		/*!< Channel name (also the key in mchat_t.channel_members) */
+    GHashTable *members;		/*!< Set of peer source addresses (GUINT_TO_POINTER) */
+} mchat_channel_members;
+
+
 /*!
  * \brief List of peers seen by mchat for use in public API functions
+ *
+ * \details
+ * Peer lists handed out by the public API are immutable snapshots shared by every
+ * reader.  They are built by the receive threads and published into
+ * mchat_t.peerlist_snapshot.
  */
 struct mchat_peerlist_t
 {
+    mchat_snapshot snap;	/*!< Snapshot header (must be first) */
     mchat_peer *list;		/*!< List of peers */
     guint64 length;			/*!< length of list */
 };
 
 
+/*!
+ * \brief Peer change event (see the MCHAT_PEER_EVENT_ constants in mchatv1.h)
+ */
+typedef struct mchat_peer_event
+{
+    guint32 type;			/*!< Event type */
+    gint64 timestamp;		/*!< When the event happened */
+    mchat_peer peer;		/*!< State of the peer after the event (before removal for expiry) */
+} mchat_peer_event;
+
+
+/*!
+ * \brief Batch of peer change events for use in public API functions
+ */
+struct mchat_peer_events_t
+{
+    mchat_peer_event *list;	/*!< List of events, oldest first */
+    guint64 length;			/*!< length of list */
+    guint8 overflowed;		/*!< Set if events were dropped before this batch */
+};
+
+
 /*!
  * \brief MChat message send and receive buffer
  * \details
@@ -60,6 +133,8 @@ struct mchat_message_t
     guint32 nickname_len;		//!< length of nickname
     guint32 body_len;			//!< length of body
     guint32 source_address;		/*!< Source address of the message */
+    gchar channel[MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE];	//!< channel named in the message
+    gchar topic[MCHAT_LIMIT_MAX_TOPIC_SIZE];			//!< sub-topic of the message (empty if none)
     guint32 parser_error;		//!< error associated with message from parser (if any)
     guint32 validation_error;	//!< error associated with message from validation (if any)
 };
@@ -87,27 +162,194 @@ typedef struct mchat_fileio
 } mchat_fileio;
 
 
+/*!
+ * \brief Reactor running the work of many mchat threads as events on one thread
+ *
+ * \see mchatv1_reactor.h
+ */
+struct mchat_reactor_t
+{
+    GMainContext *context;		/*!< Context every event source is attached to */
+    GMainLoop *loop;			/*!< Loop run by thread (NULL if the application runs context) */
+    GThread *thread;			/*!< The reactor thread (NULL if the application runs context) */
+    gint users;					/*!< Number of mchat objects using the reactor (atomic) */
+    gchar *recv_buffer;			/*!< Receive buffer shared by all sockets (reactor thread only) */
+};
+
+
+/*!
+ * \brief Pool of reactors shared by many mchat objects
+ *
+ * \see mchatv1_runtime_new
+ */
+struct mchat_runtime_t
+{
+    mchat_reactor_t **reactors;	/*!< The reactors, one thread each */
+    guint reactor_count;		/*!< Number of reactors */
+    GMutex mutex;				/*!< Serializes reactor selection and destruction */
+};
+
+
+/*!
+ * \brief Length of mchat_identity.channel_address (fits any IPv6 address string)
+ */
+#define MCHAT_IDENTITY_ADDRESS_SIZE 48
+
+/*!
+ * \brief Immutable copy of the state the formatters put into every packet
+ *
+ * \details
+ * Published in mchat_t.identity_snapshot whenever the nickname or the current channel
+ * changes, so the send paths format without locking and writers never wait for them.
+ */
+typedef struct mchat_identity
+{
+    mchat_snapshot snap;									/*!< Snapshot header (must be first) */
+    gchar nickname[MCHAT_LIMIT_MAX_NICKNAME_SIZE];			/*!< Nickname */
+    guint8 nickname_size;									/*!< Length of nickname */
+    guint8 is_connected;									/*!< Set if the channel fields describe the current channel */
+    gchar channel_name[MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE];	/*!< Current channel name (NUL terminated) */
+    gchar channel_address[MCHAT_IDENTITY_ADDRESS_SIZE];		/*!< Current channel address as a string */
+    guint16 channel_portno;									/*!< Current channel port number */
+} mchat_identity;
+
+
+/*!
+ * \brief Disk-backed overflow queue of received messages
+ *
+ * \details
+ * Records (the mchat_message_t, then its nickname and body) are appended at write_pos and
+ * read back from read_pos.  Once emptied, the file is reused from the start, and once
+ * more has been read than is left, the unread records are moved to the start.
+ */
+typedef struct mchat_spill
+{
+    FILE *file;								/*!< Anonymous temporary file */
+    long read_pos;							/*!< Offset of the oldest record */
+    long write_pos;							/*!< Offset after the newest record */
+    long stream_pos;						/*!< Offset of file after the last read, or -1 after a write */
+    guint count;							/*!< Records between read_pos and write_pos */
+} mchat_spill;
+
+
+/*!
+ * \brief Delivery policy and counters of an mchat object or a session
+ */
+typedef struct mchat_delivery
+{
+    gint policy;							/*!< One of MCHAT_DELIVERY_* (atomic) */
+    guint delivered;						/*!< Messages made ready to be taken (atomic) */
+    guint dropped;							/*!< Messages lost to the policy (atomic) */
+    guint spilled;							/*!< Messages written to a spill file (atomic) */
+    guint blocked;							/*!< Waits for a message to be taken (atomic) */
+} mchat_delivery;
+
+
+/*!
+ * \brief Application callback published in a snapshot slot
+ *
+ * \details
+ * The receive threads acquire the published callback for each call, so the
+ * application can replace it while they run.
+ */
+typedef struct mchat_callback
+{
+    mchat_snapshot snap;					/*!< Snapshot header (must be first) */
+    mchat_message_func func;				/*!< Function to call, or NULL */
+    gpointer data;							/*!< User data for func */
+} mchat_callback;
+
+
+/*!
+ * \brief Backlog watermark and its callback, published in a snapshot slot
+ *
+ * \details
+ * The receive threads check a backlog and call func from the same snapshot, so the
+ * three always match even while the application replaces them.
+ */
+typedef struct mchat_watermark
+{
+    mchat_snapshot snap;					/*!< Snapshot header (must be first) */
+    guint high;								/*!< Backlog at which func is called, or 0 */
+    mchat_watermark_func func;				/*!< Function to call */
+    gpointer data;							/*!< User data for func */
+} mchat_watermark;
+
+
+#define MCHAT_TUNING_AFFINITY (1 << 0)		/*!< mchat_thread_tuning.cpus was set */
+#define MCHAT_TUNING_SCHEDULING (1 << 1)	/*!< mchat_thread_tuning.nice and fifo_priority were set */
+#define MCHAT_TUNING_BUSY_POLL (1 << 2)		/*!< mchat_thread_tuning.busy_poll was set */
+
+/*!
+ * \brief CPU affinity and scheduling of one thread role
+ */
+typedef struct mchat_thread_tuning
+{
+    GArray *cpus;							/*!< CPU numbers (gint) the thread may run on, or NULL for any */
+    gint nice;								/*!< Nice value with the normal scheduler */
+    gint fifo_priority;						/*!< SCHED_FIFO priority, or 0 for the normal scheduler */
+    guint busy_poll;						/*!< Microseconds to busy poll before blocking (text recv) */
+    guint configured;						/*!< MCHAT_TUNING_* fields set by the caller */
+} mchat_thread_tuning;
+
+
+/*!
+ * \brief Event sources standing in for the thread of an mchat_thread run by a reactor
+ */
+typedef struct mchat_thread_events
+{
+    mchat_reactor_t *reactor;				/*!< Reactor the sources are attached to */
+    GSocketSourceFunc io_func;				/*!< Handler for readable sockets (NULL for send roles) */
+    GPtrArray *io;							/*!< Socket sources (under mchat_thread.mutex) */
+    GArray *socks;							/*!< mchat_join_socket copies for io if not mchat_thread.sock (multi recv, written under mchat_thread.mutex) */
+    GSource *timer;							/*!< Keepalive or expiry timer (NULL if the role has none) */
+    GSource *cdsc_timer;					/*!< CDSC announcement timer (comm send) */
+    GSource *wakeup;						/*!< Fires when mchat_thread.cancel (multi recv: mchat_t.join_wakeup) is cancelled */
+    gint64 last_cdsc;						/*!< Time of the previous CDSC round (comm send) */
+    gchar *send_buffer;						/*!< Format buffer (text send: under mchat_thread.mutex) */
+    guint8 paused;							/*!< Set while io is detached because the message buffer is full (under mchat_thread.mutex) */
+} mchat_thread_events;
+
+
 /*!
  * \brief MChat Thread Struct
  *
  * \details
  * MChat uses threads for all operations, including sending and receiving
- * text.
+ * text.  When the mchat object uses a reactor, the thread is replaced by the event
+ * sources in mchat_thread.events and thread_id is NULL.
  */
 typedef struct mchat_thread
 {
+    /* Read-mostly: set up before the thread starts */
     mchat_t *mchat;							/*!< pointer to parent mchat_t struct */
     GThread *thread_id;						/*!< pthread id for thread */
-    GMutex mutex;							/*!< thread mutex for buffer access */
-    GCond cond;								/*!< thread condition variable for buffer access */
-    GSocketAddress *addr;					/*!< socket address object */
+    GSocketAddress *addr;					/*!< socket address object (replaced under mutex) */
     GSocket *sock;							/*!< socket object */
     GCancellable *cancel;					/*!< cancel signal to get out of blocked IO operations */
-    guint8 buffer_flag;						/*!< used as a flag to indicate status of message buffer (use varies) */
-    guint8 run_flag;						/*!< used as a flag to indicate if the thread should stay running */
     mchat_message_t *buffer;				/*!< message buffer */
     struct mchat_fileio *fiocfg;			/*!< fileio structure if this thread is for a fileio job */
+    mchat_thread_events *events;			/*!< Event sources if run by a reactor, otherwise NULL */
+    gpointer (*thread_func)(gpointer);		/*!< Function run by thread_id */
+    guint8 role;							/*!< One of MCHAT_THREAD_ROLE_* */
+    gint tid;								/*!< Kernel thread id once thread_id runs, otherwise 0 (under mchat_t.tuning_mutex) */
+    guint busy_poll;						/*!< Microseconds to spin before blocking on sock (atomic) */
+
+    /* Control: written by the API to stop the thread, read by the thread every loop */
+    gint run_flag MCHAT_CACHE_ALIGNED;		/*!< used as a flag to indicate if the thread should stay running (atomic) */
     guint32 thread_exit;					/*!< Exit error of thread */
+
+    /* Handoff: written by both sides of the message buffer */
+    GMutex mutex MCHAT_CACHE_ALIGNED;		/*!< thread mutex for buffer access */
+    GCond cond;								/*!< thread condition variable for buffer access */
+    gint buffer_flag;						/*!< used as a flag to indicate status of message buffer (use varies, atomic, written under mutex) */
+    GSocket *next_sock;						/*!< Socket a text recv thread should switch to (under mutex) */
+    GSocketAddress *send_addr;				/*!< Address for the message in the buffer, if not addr (text send, under mutex) */
+    mchat_identity *identity;				/*!< Identity acquired by the ::mchatv1_format call in progress */
+    const gchar *nickname;					/*!< Nickname to format instead of mchat_t.nickname, or NULL (under mutex) */
+    guint8 nickname_size;					/*!< Length of nickname */
+    mchat_spill *spill;						/*!< Messages received behind the one in buffer, or NULL (under mutex) */
+    guint8 above_watermark;					/*!< Set once the backlog reached the watermark (under mutex) */
 } mchat_thread;
 
 
@@ -128,14 +370,59 @@ typedef struct mchat_channel
     guint16 channel_portno;										/*!< UDP port number for channel */
     guint32 channel_id;											/*!< ID number used for indexing */
     guint64 last_seen;											/*!< if the channel was not added, this is when it was last seen */
+    guint16 shard_count;										/*!< Number of topic shard groups after channel_address (0 if not sharded) */
+    guint table_index;											/*!< Index in mchat_channel_table.list */
+    GList *lru_link;											/*!< Link in mchat_t.cdsc_lru (discovered channels only) */
 } mchat_channel;
 
 
+/*!
+ * \brief Receive socket kept open for a recently used channel
+ *
+ * \see mchatv1_switch_channel
+ */
+typedef struct mchat_warm_socket
+{
+    guint32 channel_id;			/*!< mchat_channel.channel_id of the channel the socket is joined to */
+    GSocket *sock;				/*!< Bound socket with the channel's multicast membership */
+} mchat_warm_socket;
+
+
+/*!
+ * \brief Socket receiving the joined channels that share one UDP port
+ *
+ * \see mchatv1_join_channel
+ */
+typedef struct mchat_join_socket
+{
+    GSocket *sock;				/*!< Socket bound to portno, with one multicast membership per channel */
+    guint16 portno;				/*!< UDP port number */
+    guint channel_count;		/*!< Number of joined channels using this socket */
+} mchat_join_socket;
+
+
+/*!
+ * \brief Channel registry indexed by name and by channel id
+ *
+ * \details
+ * The list owns the channels, the hash tables allow constant time lookups by
+ * channel_name and channel_id.  Channels are appended to the list; removing one
+ * moves the last channel into its place, so removal is constant time as well.
+ */
+typedef struct mchat_channel_table
+{
+    GPtrArray *list;			/*!< Channels (see mchat_channel.table_index) */
+    GHashTable *by_name;		/*!< mchat_channel.channel_name to mchat_channel */
+    GHashTable *by_id;			/*!< mchat_channel.channel_id (GUINT_TO_POINTER) to mchat_channel */
+} mchat_channel_table;
+
+
 /*!
  * \brief List of channels from an mchat object
  */
 struct mchat_chanlist_t
 {
+    mchat_snapshot snap;	/*!< Snapshot header (must be first) */
     mchat_channel *list;	/*!< list of channels */
     guint64 length;			/*!< length of the list */
 };
@@ -158,20 +445,124 @@ struct mchat_t
     mchat_thread *comm_send_thread;			//!< thread used for sending message on common channel
     mchat_thread *comm_recv_thread;			//!< thread used to receive messages on common channel
     mchat_thread *fileio_thread;			//!< thread used for fileio jobs
+    mchat_thread *multi_recv_thread;		//!< thread used to receive text on joined channels
+    mchat_reactor_t *reactor;				//!< Reactor running the threads' work, or NULL for real threads
+    mchat_snapshot_slot message_callback;	//!< Published mchat_callback called when a received message is ready (written under callback_mutex)
+    GMutex callback_mutex;					//!< Serializes publishing the application callbacks
+    mchat_delivery delivery;				//!< Delivery policy and counters of the receive threads
+    mchat_snapshot_slot watermark;			//!< Published mchat_watermark of the backlogs (written under callback_mutex)
     gchar *bind_address;					//!< Optional bind address for mchat traffic
     gchar *nickname;						//!< nickname for mchat connections
     guint8 nickname_size;					//!< nickname size (if that wasn't obvious to you)
-    guint8 is_connected : 1;				/*!< boolean set if the mchat object is connected to a channel */
-    guint8 stealth_mode: 1;					/*!< boolean set if stealth mode is on */
-    guint8 reserved : 6;					/*!< unused boolean flags space */
-    GArray *peerlist;						/*!< List of peers seen (Only used by recv threads) */
+    gint is_connected;						/*!< boolean set if the mchat object is connected to a channel (atomic, changed under channels_mutex while the text threads exist) */
+    gint stealth_mode;						/*!< boolean set if stealth mode is on (atomic) */
+    GArray *peerlist MCHAT_CACHE_ALIGNED;	/*!< List of peers seen (Only used by recv threads) */
     GMutex peerlist_mutex;					/*!< Mutex for write access to peerlist by send/recv threads */
-    GPtrArray *added_channels;				/*!< List of added channels */
-    GPtrArray *cdsc_channels;				/*!< List of channels discovered through CDSC packets */
+    GHashTable *peerlist_index;				/*!< Source address to peerlist index + 1 (under peerlist_mutex) */
+    GHashTable *channel_members;			/*!< Channel name (mchat_istr) to mchat_channel_members (under peerlist_mutex) */
+    mchat_snapshot_slot peerlist_snapshot;	/*!< Published read-only copies of peerlist (written under peerlist_mutex) */
+    guint8 peerlist_dirty;					/*!< Set when peerlist has changes not yet published (under peerlist_mutex) */
+    mchat_peer_event *peer_events;			/*!< Ring buffer of pending peer change events (under peerlist_mutex) */
+    guint32 peer_events_head;				/*!< Index of the oldest pending event */
+    guint32 peer_events_count;				/*!< Number of pending events */
+    guint8 peer_events_overflowed;			/*!< Set when pending events were dropped */
+    mchat_channel_table *added_channels MCHAT_CACHE_ALIGNED;	/*!< Registry of added channels */
+    mchat_channel_table *cdsc_channels;		/*!< Registry of channels discovered through CDSC packets */
+    GQueue cdsc_lru;						/*!< Discovered channels, most recently announced first */
+    mchat_snapshot_slot added_snapshot;		/*!< Published read-only copies of added_channels (under channels_mutex) */
+    mchat_snapshot_slot cdsc_snapshot;		/*!< Published read-only copies of cdsc_channels (under channels_mutex) */
+    guint8 cdsc_dirty;						/*!< Set when cdsc_channels has changes not yet published */
     GMutex channels_mutex;					/*!< Mutex for write access to channels members by send/recv threads */
     mchat_channel *current_channel;			/*!< Current connected channel (Undefined when not connected) */
+    mchat_snapshot_slot identity_snapshot;	/*!< Published mchat_identity (written under channels_mutex) */
+    GHashTable *joined_channels MCHAT_CACHE_ALIGNED;	/*!< Channel name to a copy of each joined channel (under join_mutex) */
+    GPtrArray *join_sockets;				/*!< mchat_join_socket for each port in use by joined channels (under join_mutex) */
+    GCancellable *join_wakeup;				/*!< Cancelled to make multi_recv_thread reload join_sockets */
+    GMutex join_mutex;						/*!< Mutex for the joined channel members */
+    GQueue warm_sockets;					/*!< mchat_warm_socket pool, most recently used first (under channels_mutex) */
+    GHashTable *topic_subscriptions;		/*!< Subscribed topic to shard index on current_channel (under channels_mutex) */
+    guint16 shard_members[MCHAT_LIMIT_MAX_CHANNEL_SHARDS];	/*!< Subscribed topics per shard of current_channel (under channels_mutex) */
+    GHashTable *source_allow;				/*!< Set of allowed source addresses (as in mchat_peer.source_address, under filter_mutex) */
+    GHashTable *source_block;				/*!< Set of blocked source addresses (under filter_mutex) */
+    guint8 source_filter_used;				/*!< Set once any source filter was configured (under filter_mutex) */
+    guint8 kernel_filter;					/*!< Kernel socket filter mode, one of MCHAT_KERNEL_FILTER_* (under filter_mutex) */
+    guint8 kernel_filter_used;				/*!< Set once the kernel filter was enabled, so sockets may have one attached (under filter_mutex) */
+    GMutex filter_mutex;					/*!< Mutex for the source filter lists (taken after any other mutex) */
+    mchat_thread_tuning thread_tuning[MCHAT_THREAD_ROLE_COUNT];	/*!< Tuning of each thread role (under tuning_mutex) */
+    guint parse_workers;					/*!< Parse workers started by the text recv thread, or 0 (atomic) */
+    guint control_coalesced;				/*!< PINGs replaced by a newer one in the control lane (atomic) */
+    guint control_dropped;					/*!< PINGs dropped by a full control lane (atomic) */
+    GMutex tuning_mutex;					/*!< Mutex for thread_tuning and mchat_thread.tid (taken after the thread mutexes) */
+    GPtrArray *sessions MCHAT_CACHE_ALIGNED;	/*!< mchat_session_t attached to this object (under session_mutex) */
+    gint session_count;						/*!< Length of sessions, read atomically by the receive paths */
+    GMutex session_mutex;					/*!< Mutex for sessions and their queues (taken after the thread mutexes) */
+    struct mchat_broadcast *broadcast;		/*!< Ring of messages for readers, allocated with the first reader */
+    gint reader_count;						/*!< Registered readers (atomic) */
+    GMutex broadcast_mutex;					/*!< Mutex serializing writers of broadcast */
+};
+
+
+/*!
+ * \brief MChat virtual session
+ *
+ * \details
+ * A session is an extra identity sharing the sockets and threads of an mchat_t.
+ * Every received text message is parsed once and a copy queued for each session.
+ */
+struct mchat_session_t
+{
+    mchat_t *mchat;										/*!< Object whose sockets the session uses */
+    volatile gint ref_count;							/*!< Held by mchat_t.sessions and by watermark calls in progress */
+    gchar nickname[MCHAT_LIMIT_MAX_NICKNAME_SIZE];		/*!< Nickname of the session (NUL terminated) */
+    guint8 nickname_size;								/*!< Length of nickname */
+    GQueue queue;										/*!< Received mchat_message_t, oldest first (under mchat_t.session_mutex) */
+    mchat_delivery delivery;							/*!< Delivery policy and counters of queue */
+    mchat_spill *spill;									/*!< Messages received behind queue, or NULL (under mchat_t.session_mutex) */
+    guint8 above_watermark;								/*!< Set once the backlog reached the watermark (under mchat_t.session_mutex) */
 };
 
+/*!
+ * \brief Received message published in the broadcast ring
+ *
+ * \details
+ * The nickname and body are stored right after the struct in the same allocation.
+ */
+typedef struct mchat_broadcast_entry
+{
+    mchat_snapshot snap;								/*!< Snapshot header (must be first) */
+    guint32 seq;										/*!< Sequence number of the message */
+    mchat_message_t message;							/*!< The message, shared by every reader */
+} mchat_broadcast_entry;
+
+
+/*!
+ * \brief Broadcast ring of received messages
+ *
+ * \details
+ * The message with sequence number seq is published in slots[seq % MCHAT_LIMIT_MAX_BROADCAST_RING].
+ * Sequence numbers wrap, so they are only ever compared by their difference.
+ */
+typedef struct mchat_broadcast
+{
+    mchat_snapshot_slot slots[MCHAT_LIMIT_MAX_BROADCAST_RING];	/*!< Latest entry for each position */
+    gint head;											/*!< Sequence number of the next message (atomic, written under mchat_t.broadcast_mutex) */
+    gint waiters;										/*!< Readers about to wait on wait_cond (atomic) */
+    GMutex wait_mutex;									/*!< Only used to sleep and wake */
+    GCond wait_cond;									/*!< Broadcast when a message is published while readers wait */
+} mchat_broadcast;
+
+
+/*!
+ * \brief Reader of the broadcast ring
+ */
+struct mchat_reader_t
+{
+    mchat_t *mchat;										/*!< Object whose messages are read */
+    guint32 cursor;										/*!< Sequence number of the next message to read */
+    mchat_broadcast_entry *held;						/*!< Entry of the message last returned, or NULL */
+};
+
+
 /*!
  * \brief MChatv1 Received message parser struct
  *
@@ -19,6 +19,11 @@
 #include "mchatv1_parser.h"
 #include "mchatv1_structs.h"
 #include "mchatv1_threads.h"
+#include "mchatv1_reactor.h"
+#include "mchatv1_session.h"
+#include "mchatv1_delivery.h"
+#include "mchatv1_broadcast.h"
+#include "mchatv1_pipeline.h"
 #include "mchatv1_utils.h"
 
 
@@ -27,6 +32,37 @@ const char *mchatv1_thread_error_strings[] =
     ERROR_STRING_ARRAY(MCHATV1_THREAD_ERRORS_MAP)
 };
 
+
+/*!
+ * \brief Get the role of the thread an mchat object keeps at \p tptr
+ * \return One of the MCHAT_THREAD_ROLE_* values
+ */
+static guint8 mchatv1_thread_role(mchat_t *mchat, mchat_thread **tptr)
+{
+    if (tptr == &mchat->text_send_thread)
+        return MCHAT_THREAD_ROLE_TEXT_SEND;
+    if (tptr == &mchat->text_recv_thread)
+        return MCHAT_THREAD_ROLE_TEXT_RECV;
+    if (tptr == &mchat->comm_send_thread)
+        return MCHAT_THREAD_ROLE_COMM_SEND;
+    if (tptr == &mchat->comm_recv_thread)
+        return MCHAT_THREAD_ROLE_COMM_RECV;
+    if (tptr == &mchat->multi_recv_thread)
+        return MCHAT_THREAD_ROLE_MULTI_RECV;
+    return MCHAT_THREAD_ROLE_FILEIO;
+}
+
+
+/*!
+ * \brief Entry point of every mchat thread: tune the thread, then run its function
+ */
+static gpointer mchatv1_thread_start(gpointer args)
+{
+    mchat_thread *t = (mchat_thread*)args;
+    thread_tuning_attach(t);
+    return t->thread_func(t);
+}
+
 int mchatv1_thread_init(mchat_t 		*mchat,
                         mchat_thread 	**tptr,
                         gchar 			*thread_name,
@@ -35,11 +71,10 @@ int mchatv1_thread_init(mchat_t 		*mchat,
                         gpointer		(*thread_func)(gpointer),
                         mchat_fileio	*fiocfg)
 {
-    mchat_thread *t = g_malloc(sizeof(mchat_thread));
+    mchat_thread *t = cache_aligned_alloc0(sizeof(mchat_thread));
     if (t == NULL)
         return -1;
 
-    memset(t, 0, sizeof(mchat_thread));
     t->sock = sock;
     t->addr = addr;
     t->cancel = g_cancellable_new();
@@ -52,10 +87,15 @@ int mchatv1_thread_init(mchat_t 		*mchat,
         t->fiocfg = fiocfg;
 
     t->mchat = mchat;
+    t->role = mchatv1_thread_role(mchat, tptr);
+    t->thread_func = thread_func;
 
     g_mutex_lock(&t->mutex);
-    t->run_flag = 1;
-    t->thread_id = g_thread_new(thread_name, thread_func, (gpointer)t);
+    g_atomic_int_set(&t->run_flag, 1);
+    if (mchat->reactor != NULL)
+        mchat_reactor_attach(mchat->reactor, t, thread_func);
+    else
+        t->thread_id = g_thread_new(thread_name, mchatv1_thread_start, (gpointer)t);
     *tptr = t;
     return 0;
 }
@@ -64,26 +104,242 @@ int mchatv1_thread_init(mchat_t 		*mchat,
 int mchatv1_thread_destroy(mchat_thread **tptr)
 {
     mchat_thread *t = *tptr;
-    t->run_flag = 0;
+    g_atomic_int_set(&t->run_flag, 0);
     g_cond_broadcast(&t->cond);
     g_cancellable_cancel(t->cancel);
-    g_thread_join(t->thread_id);
-
-    g_socket_close(t->sock, NULL);
+    if (t->events != NULL)
+        mchat_reactor_detach(t);
+    else
+        g_thread_join(t->thread_id);
+    g_mutex_lock(&t->mchat->tuning_mutex);
+    t->tid = 0;
+    g_mutex_unlock(&t->mchat->tuning_mutex);
 
     g_cond_clear(&t->cond);
     g_mutex_clear(&t->mutex);
-    g_object_unref(t->sock);
-    g_object_unref(t->addr);
+    /* The socket is closed with its last reference; a text recv socket may live on
+     * in the warm socket pool */
+    if (t->sock)
+        g_object_unref(t->sock);
+    if (t->next_sock)
+        g_object_unref(t->next_sock);
+    if (t->send_addr)
+        g_object_unref(t->send_addr);
+    if (t->addr)
+        g_object_unref(t->addr);
     g_object_unref(t->cancel);
     g_free(t->buffer);
+    mchat_spill_destroy(t->spill);
     if (t->fiocfg)
         g_free(t->fiocfg);
-    g_free(*tptr);
+    cache_aligned_free(*tptr);
+    *tptr = NULL;
     return 0;
 }
 
 
+void mchatv1_thread_wake(mchat_thread *t)
+{
+    g_cond_broadcast(&t->cond);
+    if (t->events != NULL)
+        mchat_reactor_wake(t);
+}
+
+
+void mchatv1_thread_release(mchat_thread *t)
+{
+    if (t == NULL)
+        return;
+    g_mutex_lock(&t->mutex);
+    if (t->events != NULL)
+        mchat_reactor_resume(t);
+    else
+        g_cond_broadcast(&t->cond);
+    g_mutex_unlock(&t->mutex);
+}
+
+
+void mchatv1_thread_release_recv(mchat_t *mchat)
+{
+    /* The text threads only come and go with mchat_t.is_connected, which changes under
+     * channels_mutex, and the multi recv thread is only started under join_mutex */
+    g_mutex_lock(&mchat->channels_mutex);
+    if (g_atomic_int_get(&mchat->is_connected))
+        mchatv1_thread_release(mchat->text_recv_thread);
+    g_mutex_lock(&mchat->join_mutex);
+    mchatv1_thread_release(mchat->multi_recv_thread);
+    g_mutex_unlock(&mchat->join_mutex);
+    g_mutex_unlock(&mchat->channels_mutex);
+}
+
+
+guint32 mchatv1_thread_source_bytes(GSocketAddress *saddr)
+{
+    /* This Requires some explanation.
+     * The Peers are searched for by a 32 bit integer that is built from the 4 bytes of
+     * the source IP address.  To remove the actual bytes, we first need to exract the
+     * GInetAddress from the GSocketAddress returned by g_socket_receive_from.  We then
+     * get the byte array from the GInetAddress and copy the bytes into an unsigned int.
+     * This is really annoying to do, but it seems to work right now.
+     */
+    guint32 sbytes;
+    GInetAddress *sinet = g_inet_socket_address_get_address((GInetSocketAddress*)saddr);
+    memcpy(&sbytes, g_inet_address_to_bytes(sinet), 4);
+    /* sinet does not need to be unref'ed.  It belongs to saddr */
+    g_object_unref(saddr);
+    return sbytes;
+}
+
+
+void mchatv1_thread_deliver_text(mchat_thread *t, mchat_parser *parser, guint32 sbytes, gint64 recv_time)
+{
+    mchat_t *mchat = t->mchat;
+    /* Sessions must not wait for the mchat object to take its own copy */
+    gboolean shared = mchat_session_fanout(mchat, parser, sbytes, recv_time) > 0;
+    /* Nor may readers, who never take it at all */
+    if (mchat_broadcast_publish(mchat, parser, sbytes, recv_time))
+        shared = TRUE;
+    int policy = g_atomic_int_get(&mchat->delivery.policy);
+    mchat_watermark *wm = mchat_snapshot_acquire(&mchat->watermark);
+    g_mutex_lock(&t->mutex);
+    /* Once messages are spilled, newer ones go behind them to keep the order */
+    gboolean spilling = t->spill != NULL && t->spill->count > 0;
+    /* Parse workers outlive run_flag briefly and must not wait for a consumer then */
+    if (g_atomic_int_get(&t->buffer_flag) && !spilling && policy == MCHAT_DELIVERY_BLOCK &&
+            !shared && g_atomic_int_get(&t->run_flag))
+    {
+        g_atomic_int_inc(&mchat->delivery.blocked);
+        if (mchat_delivery_watermark(wm, 2, &t->above_watermark))
+        {
+            g_mutex_unlock(&t->mutex);
+            wm->func(mchat, NULL, 2, wm->data);
+            g_mutex_lock(&t->mutex);
+        }
+        /* Parse workers share the buffer, so a wake up may find another one filled it
+         * first; keep waiting unless mchatv1_thread_release() ended the block */
+        while (g_atomic_int_get(&t->buffer_flag) && g_atomic_int_get(&t->run_flag) &&
+               g_atomic_int_get(&mchat->delivery.policy) == MCHAT_DELIVERY_BLOCK &&
+               g_atomic_int_get(&mchat->session_count) == 0 &&
+               g_atomic_int_get(&mchat->reader_count) == 0)
+            g_cond_wait(&t->cond, &t->mutex);
+        policy = g_atomic_int_get(&mchat->delivery.policy);
+    }
+
+    gboolean filled = !g_atomic_int_get(&t->buffer_flag) && !spilling;
+    if (filled)
+    {
+        mchatv1_parser_to_message(parser, t->buffer);
+        t->buffer->timestamp = recv_time;
+        t->buffer->source_address = sbytes;
+        g_atomic_int_set(&t->buffer_flag, 1);
+        g_atomic_int_inc(&mchat->delivery.delivered);
+    }
+    else if (policy == MCHAT_DELIVERY_SPILL || spilling)
+    {
+        mchat_message_t m;
+        mchat_delivery_message_view(&m, parser, sbytes, recv_time);
+        if (t->spill == NULL)
+            t->spill = mchat_spill_new();
+        if (t->spill != NULL && mchat_spill_push(t->spill, &m) == 0)
+            g_atomic_int_inc(&mchat->delivery.spilled);
+        else
+            g_atomic_int_inc(&mchat->delivery.dropped);
+    }
+    else if (policy == MCHAT_DELIVERY_DROP_OLDEST)
+    {
+        mchatv1_parser_to_message(parser, t->buffer);
+        t->buffer->timestamp = recv_time;
+        t->buffer->source_address = sbytes;
+        g_atomic_int_inc(&mchat->delivery.delivered);
+        g_atomic_int_inc(&mchat->delivery.dropped);
+    }
+    else
+        g_atomic_int_inc(&mchat->delivery.dropped);
+
+    guint backlog = g_atomic_int_get(&t->buffer_flag) + (t->spill != NULL ? t->spill->count : 0);
+    gboolean crossed = mchat_delivery_watermark(wm, backlog, &t->above_watermark);
+    g_mutex_unlock(&t->mutex);
+
+    /* Called unlocked, so the functions can take the message right away */
+    if (filled)
+    {
+        mchat_callback *cb = mchat_snapshot_acquire(&mchat->message_callback);
+        if (cb != NULL && cb->func != NULL)
+            cb->func(mchat, cb->data);
+        if (cb != NULL)
+            mchat_snapshot_unref(cb);
+    }
+    if (crossed)
+        wm->func(mchat, NULL, backlog, wm->data);
+    if (wm != NULL)
+        mchat_snapshot_unref(wm);
+}
+
+
+void mchatv1_thread_handle_text(mchat_thread *t, gchar *data, gssize len, guint32 sbytes, gint64 recv_time)
+{
+    mchat_parser parser;
+    memset(&parser, 0, sizeof(mchat_parser));
+    if (mchatv1_parse_and_validate(&parser, data, len) != 0)
+        return;
+
+    switch (parser.packet_type)
+    {
+        case MCHATV1_MESSAGE_TYPE_TEXT:
+        {
+            mchatv1_thread_deliver_text(t, &parser, sbytes, recv_time);
+            peerlist_update_peer(t->mchat, parser, sbytes, 0);
+            break;
+        }
+        case MCHATV1_MESSAGE_TYPE_PING:
+        {
+            peerlist_update_peer(t->mchat, parser, sbytes, 0);
+            break;
+        }
+    }
+}
+
+
+void mchatv1_thread_handle_comm(mchat_t *mchat, mchat_parser *parser, guint32 sbytes)
+{
+    switch (parser->packet_type)
+    {
+        case MCHATV1_MESSAGE_TYPE_PING:
+        {
+            peerlist_update_peer(mchat, *parser, sbytes, 1);
+            break;
+        }
+        case MCHATV1_MESSAGE_TYPE_CDSC:
+        {
+            mchat_channel_update(mchat, parser);
+            break;
+        }
+    }
+}
+
+
+gboolean mchatv1_thread_join_accepts(mchat_t *mchat, mchat_parser *parser, guint16 portno)
+{
+    gchar chan_name[MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE];
+    if (parser->packet_type != MCHATV1_MESSAGE_TYPE_TEXT &&
+            parser->packet_type != MCHATV1_MESSAGE_TYPE_PING)
+        return FALSE;
+
+    /* The socket sees every group joined on its port (by anyone on this host),
+     * so only accept channels we have joined on this port */
+    guint32 len = parser->header_len[MCHATV1_HEADER_TYPE_CHANNEL];
+    if (len >= sizeof(chan_name))
+        return FALSE;
+    memcpy(chan_name, parser->header_offset[MCHATV1_HEADER_TYPE_CHANNEL], len);
+    chan_name[len] = '\0';
+    g_mutex_lock(&mchat->join_mutex);
+    mchat_channel *c = g_hash_table_lookup(mchat->joined_channels, chan_name);
+    gboolean joined = c != NULL && c->channel_portno == portno;
+    g_mutex_unlock(&mchat->join_mutex);
+    return joined;
+}
+
+
 gpointer mchatv1_thread_text_send(gpointer args)
 {
     struct mchat_thread *t = (struct mchat_thread *)args;
@@ -97,67 +353,93 @@ gpointer mchatv1_thread_text_send(gpointer args)
     gssize send_len;
 
     // Send out 3 pings to announce to others that we have connected
-    if (!t->mchat->stealth_mode)
+    if (!g_atomic_int_get(&t->mchat->stealth_mode))
     {
         send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_PING);
         if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
         {
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
-            t->run_flag = 0;
+            g_atomic_int_set(&t->run_flag, 0);
         }
         if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
         {
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
-            t->run_flag = 0;
+            g_atomic_int_set(&t->run_flag, 0);
         }
         if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
         {
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
-            t->run_flag = 0;
+            g_atomic_int_set(&t->run_flag, 0);
         }
     }
 
-    while (t->run_flag)
+    while (g_atomic_int_get(&t->run_flag))
     {
         send_len = 0;
         gint64 timeout = g_get_monotonic_time() +
                 (MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND);
         // Make sure we wake up to send a ping if we don't have a message
         g_mutex_lock(&t->mutex);
-        if (!t->buffer_flag)
+        if (!g_atomic_int_get(&t->buffer_flag))
             g_cond_wait_until(&t->cond, &t->mutex, timeout);
 
-        if (t->buffer_flag)
+        if (g_atomic_int_get(&t->buffer_flag))
         {
+            t->nickname = t->buffer->nickname;
+            t->nickname_size = t->buffer->nickname_len;
             send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_TEXT);
-            t->buffer_flag = 0;
+            t->nickname = NULL;
+            g_atomic_int_set(&t->buffer_flag, 0);
             g_cond_broadcast(&t->cond);
         }
+        /* mchatv1_switch_channel() may replace the address at any time, and a topic
+         * message may go to a shard group instead */
+        GSocketAddress *addr;
+        if (send_len && t->send_addr != NULL)
+        {
+            addr = t->send_addr;
+            t->send_addr = NULL;
+        }
+        else
+            addr = g_object_ref(t->addr);
         g_mutex_unlock(&t->mutex);
 
         // If we have a message, send it. If not, send a keepalive ping
         if (send_len)
         {
-            if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
+            if (g_socket_send_to(t->sock, addr, send_buffer, send_len, t->cancel, NULL) != send_len)
             {
-                t->run_flag = 0;
+                g_object_unref(addr);
+                g_atomic_int_set(&t->run_flag, 0);
                 t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
                 break;
             }
         }
         else
         {
-            if (!t->mchat->stealth_mode)
+            if (!g_atomic_int_get(&t->mchat->stealth_mode))
             {
                 send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_PING);
-                if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
+                if (g_socket_send_to(t->sock, addr, send_buffer, send_len, t->cancel, NULL) != send_len)
+                {
+                    g_object_unref(addr);
+                    g_atomic_int_set(&t->run_flag, 0);
+                    t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
+                    break;
+                }
+                g_mutex_lock(&t->mutex);
+                int ret = mchat_session_ping(t, addr, send_buffer);
+                g_mutex_unlock(&t->mutex);
+                if (ret != 0)
                 {
-                    t->run_flag = 0;
+                    g_object_unref(addr);
+                    g_atomic_int_set(&t->run_flag, 0);
                     t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
                     break;
                 }
             }
         }
+        g_object_unref(addr);
     }
     g_free(t->buffer->body);
     g_free(t->buffer->nickname);
@@ -165,6 +447,55 @@ gpointer mchatv1_thread_text_send(gpointer args)
 }
 
 
+/*!
+ * \brief Switch a text recv thread to the socket left in mchat_thread.next_sock
+ * \param t Pointer to the text recv thread
+ * \return TRUE if the thread switched sockets, FALSE if no switch was requested
+ */
+static gboolean mchatv1_thread_retarget(mchat_thread *t)
+{
+    g_mutex_lock(&t->mutex);
+    if (t->next_sock == NULL)
+    {
+        g_mutex_unlock(&t->mutex);
+        return FALSE;
+    }
+    GSocket *old = t->sock;
+    t->sock = t->next_sock;
+    t->next_sock = NULL;
+    g_cancellable_reset(t->cancel);
+    g_mutex_unlock(&t->mutex);
+
+    g_object_unref(old);
+    return TRUE;
+}
+
+
+/*!
+ * \brief Spin until the socket of a text recv thread is readable or the busy poll time is up
+ * \param t Pointer to the text recv thread
+ * \param applied Busy poll time last set on the socket with SO_BUSY_POLL (updated)
+ */
+static void mchatv1_thread_busy_poll(mchat_thread *t, guint *applied)
+{
+    guint usec = g_atomic_int_get(&t->busy_poll);
+    if (usec != *applied)
+    {
+        socket_busy_poll_apply(t->sock, usec);
+        *applied = usec;
+    }
+    if (usec == 0)
+        return;
+
+    gint64 deadline = g_get_monotonic_time() + usec;
+    while (g_atomic_int_get(&t->run_flag) && g_get_monotonic_time() < deadline)
+    {
+        if (g_socket_condition_check(t->sock, G_IO_IN) & G_IO_IN)
+            return;
+    }
+}
+
+
 gpointer mchatv1_thread_text_recv(gpointer args)
 {
     struct mchat_thread *t = (struct mchat_thread *)args;
@@ -177,58 +508,63 @@ gpointer mchatv1_thread_text_recv(gpointer args)
     // Let's be safe and make our buffer larger than a UDP packet can be
     gchar recv_buffer[1 << 16];
     gssize recv_len;
-    gint64 recv_time;
-    mchat_parser parser;
     GSocketAddress *saddr;
-    GInetAddress *sinet;
-    guint32 sbytes;
+    guint busy_poll = 0;
+    gchar *buf = recv_buffer;
+
+    /* With parse workers, this thread only reads datagrams into pipeline slots */
+    mchat_pipeline *pipeline = NULL;
+    mchat_pipeline_slot *slot = NULL;
+    guint workers = g_atomic_int_get(&t->mchat->parse_workers);
+    if (workers)
+        pipeline = mchat_pipeline_new(t, workers);
 
-    while (t->run_flag)
+    while (g_atomic_int_get(&t->run_flag))
     {
         recv_len = 0;
-        memset(recv_buffer, 0, 1 << 16);
-        memset(&parser, 0, sizeof(mchat_parser));
-        if ((recv_len = g_socket_receive_from(t->sock, &saddr, recv_buffer, 1 << 16, t->cancel, NULL)) == -1)
+        if (pipeline != NULL)
+        {
+            if (slot == NULL && (slot = mchat_pipeline_take(pipeline)) == NULL)
+                break;
+            buf = slot->data;
+        }
+        else
+            memset(recv_buffer, 0, 1 << 16);
+        mchatv1_thread_busy_poll(t, &busy_poll);
+        if ((recv_len = g_socket_receive_from(t->sock, &saddr, buf, 1 << 16, t->cancel, NULL)) == -1)
         {
-            t->run_flag = 0;
+            /* mchatv1_switch_channel() cancels the receive to hand us a new socket */
+            if (g_atomic_int_get(&t->run_flag) && mchatv1_thread_retarget(t))
+            {
+                /* The new socket may come from the warm pool with another setting */
+                busy_poll = G_MAXUINT;
+                continue;
+            }
+            g_atomic_int_set(&t->run_flag, 0);
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
             break;
         }
 
-        sinet = g_inet_socket_address_get_address((GInetSocketAddress*)saddr);
-        const gchar *bytes = g_inet_address_to_bytes(sinet);
-        memcpy(&sbytes, bytes, 4);
-        g_object_unref(saddr);
-
-        recv_time = g_get_real_time();
-        if (mchatv1_parse_and_validate(&parser, recv_buffer, recv_len) == 0)
+        guint32 sbytes = mchatv1_thread_source_bytes(saddr);
+        gint64 recv_time = g_get_real_time();
+        if (pipeline != NULL)
         {
-            switch (parser.packet_type)
-            {
-                case MCHATV1_MESSAGE_TYPE_TEXT:
-                {
-                    g_mutex_lock(&t->mutex);
-                    if (t->buffer_flag)
-                        g_cond_wait(&t->cond, &t->mutex);
-
-                    if (!t->buffer_flag)
-                    {
-                        mchatv1_parser_to_message(&parser, t->buffer);
-                        t->buffer->timestamp = recv_time;
-                        t->buffer->source_address = sbytes;
-                        t->buffer_flag = 1;
-                    }
-                    g_mutex_unlock(&t->mutex);
-                    peerlist_update_peer(t->mchat, parser, sbytes);
-                    break;
-                }
-                case MCHATV1_MESSAGE_TYPE_PING:
-                {
-                    peerlist_update_peer(t->mchat, parser, sbytes);
-                    break;
-                }
-            }
+            slot->data[recv_len] = '\0';
+            slot->len = recv_len;
+            slot->sbytes = sbytes;
+            slot->recv_time = recv_time;
+            /* A PING is copied to the control lane and the slot read into again */
+            if (mchat_pipeline_push(pipeline, slot))
+                slot = NULL;
         }
+        else
+            mchatv1_thread_handle_text(t, recv_buffer, recv_len, sbytes, recv_time);
+    }
+    if (pipeline != NULL)
+    {
+        if (slot != NULL)
+            mchat_pipeline_untake(pipeline, slot);
+        mchat_pipeline_destroy(pipeline);
     }
     g_free(t->buffer->body);
     g_free(t->buffer->nickname);
@@ -236,6 +572,47 @@ gpointer mchatv1_thread_text_recv(gpointer args)
 }
 
 
+int mchatv1_thread_send_cdsc(mchat_thread *t, gchar *send_buffer, gint64 since)
+{
+    mchat_chanlist_t *added = mchat_snapshot_acquire(&t->mchat->added_snapshot);
+    if (added == NULL)
+        return 0;
+
+    mchat_channel **announce = g_malloc(sizeof(mchat_channel*) * (added->length + 1));
+    guint count = 0;
+    g_mutex_lock(&t->mchat->channels_mutex);
+    /* The default channel is added first and can never be deleted, so it stays at index 0 */
+    for (guint64 i = 1; i < added->length; i++)
+    {
+        mchat_channel *seen = channel_query_by_id(t->mchat->cdsc_channels, added->list[i].channel_id);
+        if (seen == NULL || seen->last_seen <= since)
+            announce[count++] = &added->list[i];
+    }
+    g_mutex_unlock(&t->mchat->channels_mutex);
+
+    int ret = 0;
+    guint sent = 0;
+    while (sent < count)
+    {
+        guint formatted;
+        gssize send_len = mchatv1_format_cdsc(send_buffer, MCHAT_PROTOCOL_MAX_CDSC_SIZE,
+                                              announce + sent, count - sent, &formatted);
+        if (send_len < 0)
+            break;
+        if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
+        {
+            ret = -1;
+            break;
+        }
+        sent += formatted;
+    }
+
+    g_free(announce);
+    mchat_snapshot_unref(added);
+    return ret;
+}
+
+
 gpointer mchatv1_thread_comm_send(gpointer args)
 {
     mchat_thread *t = (mchat_thread *)args;
@@ -249,60 +626,61 @@ gpointer mchatv1_thread_comm_send(gpointer args)
     guint32 send_len;
 
     /* Send out 3 pings to common channel on start */
-    if (!t->mchat->stealth_mode)
+    if (!g_atomic_int_get(&t->mchat->stealth_mode))
     {
         send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_PING);
         if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
         {
-            t->run_flag = 0;
+            g_atomic_int_set(&t->run_flag, 0);
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
         }
         if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
         {
-            t->run_flag = 0;
+            g_atomic_int_set(&t->run_flag, 0);
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
         }
         if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
         {
-            t->run_flag = 0;
+            g_atomic_int_set(&t->run_flag, 0);
             t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
         }
     }
 
     GTimer *ping_timer = g_timer_new();
     GTimer *cdsc_timer = g_timer_new();
-    while (t->run_flag)
+    /* The first announcement goes out after a random fraction of the interval */
+    gdouble cdsc_interval = MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER * g_random_double();
+    gint64 last_cdsc = g_get_real_time();
+    while (g_atomic_int_get(&t->run_flag))
     {
         g_usleep(100000);	/* sleep for 0.1 seconds */
         send_len = 0;
-        if (!t->mchat->stealth_mode)
+        if (!g_atomic_int_get(&t->mchat->stealth_mode))
         {
             if (g_timer_elapsed(ping_timer, NULL) >= MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER)
             {
                 g_timer_start(ping_timer);
-                g_mutex_lock(&t->mchat->channels_mutex);
                 send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_PING);
-                g_mutex_unlock(&t->mchat->channels_mutex);
                 if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
                 {
-                    t->run_flag = 0;
+                    g_atomic_int_set(&t->run_flag, 0);
                     t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
                     break;
                 }
             }
-            if ((t->mchat->is_connected && t->mchat->current_channel != g_ptr_array_index(t->mchat->added_channels, 0)) &&
-                    g_timer_elapsed(cdsc_timer, NULL) >= MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER)
+            if (g_timer_elapsed(cdsc_timer, NULL) >= cdsc_interval)
             {
                 g_timer_start(cdsc_timer);
-                g_mutex_lock(&t->mchat->channels_mutex);
-                send_len = mchatv1_format(t, send_buffer, MCHATV1_MESSAGE_TYPE_CDSC);
-                g_mutex_unlock(&t->mchat->channels_mutex);
-                if (g_socket_send_to(t->sock, t->addr, send_buffer, send_len, t->cancel, NULL) != send_len)
+                cdsc_interval = MCHAT_PROTOCOL_DEFAULT_CDSC_TIMER *
+                        g_random_double_range(1.0 - MCHAT_PROTOCOL_CDSC_JITTER, 1.0 + MCHAT_PROTOCOL_CDSC_JITTER);
+                gint64 now = g_get_real_time();
+                if (mchatv1_thread_send_cdsc(t, send_buffer, last_cdsc) != 0)
                 {
-                    t->run_flag = 0;
+                    g_atomic_int_set(&t->run_flag, 0);
                     t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
                     break;
                 }
+                last_cdsc = now;
             }
         }
     }
@@ -324,12 +702,10 @@ gpointer mchatv1_thread_comm_recv(gpointer args)
 
     gchar recv_buffer[1 << 16];
     gint64 recv_len;
-    gint64 recv_time;
     mchat_parser parser;
     GSocketAddress *saddr;
-    GInetAddress *sinet;
     guint32 sbytes;
-    while (t->run_flag)
+    while (g_atomic_int_get(&t->run_flag))
     {
         g_usleep(100000); /* Sleep for 0.1 seconds */
         recv_len = 0;
@@ -339,42 +715,16 @@ gpointer mchatv1_thread_comm_recv(gpointer args)
 
         if (recv_len > 0)
         {
-            /* This Requires some explanation.
-             * The Peers are searched for by a 32 bit integer that is built from the 4 bytes of
-             * the source IP address.  To remove the actual bytes, we first need to exract the
-             * GInetAddress from the GSocketAddress returned by g_socket_receive_from.  We then
-             * get the byte array from the GInetAddress and copy the bytes into an unsigned int.
-             * This is really annoying to do, but it seems to work right now.
-             */
-            sinet = g_inet_socket_address_get_address((GInetSocketAddress*)saddr);
-            const gchar *bytes = g_inet_address_to_bytes(sinet);
-            memcpy(&sbytes, bytes, 4);
-            g_object_unref(saddr);
-            /* sinet does not need to be unref'ed.  Its already at zero reference when returned */
-            recv_time = g_get_real_time();
+            sbytes = mchatv1_thread_source_bytes(saddr);
             if (mchatv1_parse_and_validate(&parser, recv_buffer, recv_len) == 0)
-            {
-                switch (parser.packet_type)
-                {
-                    case MCHATV1_MESSAGE_TYPE_PING:
-                    {
-                        peerlist_update_peer(t->mchat, parser, sbytes);
-                        break;
-                    }
-                    case MCHATV1_MESSAGE_TYPE_CDSC:
-                    {
-                        mchat_channel_update(t->mchat, &parser);
-                        break;
-                    }
-                }
-            }
+                mchatv1_thread_handle_comm(t->mchat, &parser, sbytes);
         }
         else
         {
             /* Check that our sibling thread is still awake.  If not, we should exit */
-            if (t->mchat->comm_send_thread->run_flag == 0)
+            if (g_atomic_int_get(&t->mchat->comm_send_thread->run_flag) == 0)
             {
-                t->run_flag = 0;
+                g_atomic_int_set(&t->run_flag, 0);
                 t->thread_exit = MCHATV1_THREAD_ERROR_SOCKET_ERROR;
                 break;
             }
@@ -383,3 +733,97 @@ gpointer mchatv1_thread_comm_recv(gpointer args)
         mchat_channel_expire(t->mchat);
     }
 }
+
+
+/*!
+ * \brief Clear function for the multi recv thread's copy of mchat_t.join_sockets
+ */
+static void mchatv1_thread_join_socket_clear(gpointer data)
+{
+    g_object_unref(((mchat_join_socket*)data)->sock);
+}
+
+
+gpointer mchatv1_thread_multi_recv(gpointer args)
+{
+    mchat_thread *t = (mchat_thread *)args;
+    mchat_t *mchat = t->mchat;
+    // Allocate our message buffers
+    t->buffer->body = g_malloc(sizeof(gchar) * MCHAT_LIMIT_MAX_MESSAGE_SIZE);
+    t->buffer->nickname = g_malloc(sizeof(gchar) * MCHAT_LIMIT_MAX_NICKNAME_SIZE);
+
+    // Mutex is locked until our buffer is allocated
+    g_mutex_unlock(&t->mutex);
+    gchar recv_buffer[1 << 16];
+    gssize recv_len;
+    mchat_parser parser;
+    GSocketAddress *saddr;
+    guint32 sbytes;
+
+    /* Our own references to the sockets, so a part can drop a socket while we poll it */
+    GArray *socks = g_array_new(FALSE, FALSE, sizeof(mchat_join_socket));
+    g_array_set_clear_func(socks, mchatv1_thread_join_socket_clear);
+    GArray *fds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
+    GPollFD cancel_fd, wakeup_fd;
+    g_cancellable_make_pollfd(t->cancel, &cancel_fd);
+    g_cancellable_make_pollfd(mchat->join_wakeup, &wakeup_fd);
+    gboolean reload = TRUE;
+
+    while (g_atomic_int_get(&t->run_flag))
+    {
+        if (reload || g_cancellable_is_cancelled(mchat->join_wakeup))
+        {
+            /* Reset before reading, so a change made during the reload wakes us again */
+            g_cancellable_reset(mchat->join_wakeup);
+            g_array_set_size(socks, 0);
+            g_array_set_size(fds, 0);
+            g_mutex_lock(&mchat->join_mutex);
+            for (guint i = 0; i < mchat->join_sockets->len; i++)
+            {
+                mchat_join_socket js = *(mchat_join_socket*)g_ptr_array_index(mchat->join_sockets, i);
+                g_object_ref(js.sock);
+                g_array_append_val(socks, js);
+                GPollFD pfd = { g_socket_get_fd(js.sock), G_IO_IN, 0 };
+                g_array_append_val(fds, pfd);
+            }
+            g_mutex_unlock(&mchat->join_mutex);
+            g_array_append_val(fds, cancel_fd);
+            g_array_append_val(fds, wakeup_fd);
+            reload = FALSE;
+        }
+
+        if (g_poll((GPollFD*)fds->data, fds->len, -1) < 0)
+            continue;
+
+        for (guint i = 0; i < socks->len && g_atomic_int_get(&t->run_flag); i++)
+        {
+            if (!(g_array_index(fds, GPollFD, i).revents & G_IO_IN))
+                continue;
+            mchat_join_socket *js = &g_array_index(socks, mchat_join_socket, i);
+            memset(&parser, 0, sizeof(mchat_parser));
+            if ((recv_len = g_socket_receive_from(js->sock, &saddr, recv_buffer, (1 << 16) - 1, NULL, NULL)) <= 0)
+                continue;
+            recv_buffer[recv_len] = '\0';
+
+            sbytes = mchatv1_thread_source_bytes(saddr);
+
+            gint64 recv_time = g_get_real_time();
+            if (mchatv1_parse_and_validate(&parser, recv_buffer, recv_len) != 0)
+                continue;
+            if (!mchatv1_thread_join_accepts(mchat, &parser, js->portno))
+                continue;
+
+            if (parser.packet_type == MCHATV1_MESSAGE_TYPE_TEXT)
+                mchatv1_thread_deliver_text(t, &parser, sbytes, recv_time);
+            peerlist_update_peer(mchat, parser, sbytes, 0);
+        }
+    }
+
+    g_cancellable_release_fd(t->cancel);
+    g_cancellable_release_fd(mchat->join_wakeup);
+    g_array_free(fds, TRUE);
+    g_array_free(socks, TRUE);
+    g_free(t->buffer->body);
+    g_free(t->buffer->nickname);
+    return NULL;
+}
@@ -71,15 +71,117 @@ int mchatv1_thread_init(mchat_t *mchat, mchat_thread **tptr, gchar *thread_name,
  * \return Always 0 (for now)
  *
  * \details
- * This function tears down an mchat_thread struct.
+ * This function tears down an mchat_thread struct and sets \p *tptr to NULL.
  *
  * \warning This function assumes a number of things, including
  * that the message buffer has been initialized and that the
  * mchat_thread struct has been initialized by mchat_thread_init().
+ * The socket and address may be NULL.
  * Use with caution if these things have not been done.
  */
 int mchatv1_thread_destroy(struct mchat_thread **tptr);
 
+/*!
+ * \brief Wake a thread waiting for a message or for its next keepalive
+ * \param t Pointer to an mchat_thread struct (mutex held)
+ *
+ * \details
+ * For a thread run by a reactor, its timer fires right away instead.
+ */
+void mchatv1_thread_wake(mchat_thread *t);
+
+/*!
+ * \brief Stop a receive thread waiting for its message buffer to be taken
+ * \param t Pointer to a text recv or multi recv thread, or NULL
+ *
+ * \details
+ * Used once a full buffer should no longer hold the receive path back (sessions or
+ * readers were attached, or the delivery policy changed).  With a reactor, the
+ * sockets are watched again.
+ */
+void mchatv1_thread_release(mchat_thread *t);
+
+/*!
+ * \brief Release the text recv and multi recv threads of an mchat object, if running
+ * \param mchat Pointer to an mchat object (no locks held)
+ * \see mchatv1_thread_release
+ */
+void mchatv1_thread_release_recv(mchat_t *mchat);
+
+/*! @} */
+
+
+/*!
+ * \name MChat Message Handling
+ * \brief Per-datagram work shared by the threads and the reactor (see mchatv1_reactor.h)
+ * @{
+ */
+
+/*!
+ * \brief Get the source address of a received datagram as in mchat_peer.source_address
+ * \param saddr Address returned by g_socket_receive_from (unreferenced by this function)
+ * \return The 4 address bytes
+ */
+guint32 mchatv1_thread_source_bytes(GSocketAddress *saddr);
+
+/*!
+ * \brief Put a parsed TEXT message into a receive thread's buffer
+ * \param t Pointer to a text recv or multi recv thread
+ * \param parser Parsed message
+ * \param sbytes Source address of the message
+ * \param recv_time Time the message arrived
+ *
+ * \details
+ * The message goes to the sessions and broadcast readers first.  If the buffer is full,
+ * applies mchat_t.delivery.policy: ::MCHAT_DELIVERY_BLOCK waits once for the buffer to be
+ * taken (unless sessions or readers exist) and drops the message if it is still full.
+ */
+void mchatv1_thread_deliver_text(mchat_thread *t, mchat_parser *parser, guint32 sbytes, gint64 recv_time);
+
+/*!
+ * \brief Parse a datagram from the current channel, then deliver it and update the peer list
+ * \param t Pointer to the text recv thread
+ * \param data The datagram
+ * \param len Length of \p data
+ * \param sbytes Source address of the datagram
+ * \param recv_time Time the datagram arrived
+ *
+ * \details
+ * Run by the text recv thread itself, or by its parse workers (see mchatv1_pipeline.h).
+ */
+void mchatv1_thread_handle_text(mchat_thread *t, gchar *data, gssize len, guint32 sbytes, gint64 recv_time);
+
+/*!
+ * \brief Handle a parsed message that arrived on the common channel
+ * \param mchat Pointer to an mchat object
+ * \param parser Parsed message
+ * \param sbytes Source address of the message
+ */
+void mchatv1_thread_handle_comm(mchat_t *mchat, mchat_parser *parser, guint32 sbytes);
+
+/*!
+ * \brief Check that a message on a join socket names a channel joined on its port
+ * \param mchat Pointer to an mchat object
+ * \param parser Parsed message
+ * \param portno Port of the join socket the message arrived on
+ * \return TRUE if the message is a TEXT or PING for a joined channel
+ */
+gboolean mchatv1_thread_join_accepts(mchat_t *mchat, mchat_parser *parser, guint16 portno);
+
+/*!
+ * \brief Announce the added channels on the common channel
+ * \param t Pointer to the comm send thread
+ * \param send_buffer Buffer to format the CDSC messages in
+ * \param since Time of the previous announcement round
+ * \return 0 on success or -1 on a socket error
+ *
+ * \details
+ * Every added channel except the default one is listed, as many per datagram as fit in
+ * ::MCHAT_PROTOCOL_MAX_CDSC_SIZE.  A channel another peer has announced since \p since
+ * is skipped; that peer's announcement already keeps it alive in everyone's cache.
+ */
+int mchatv1_thread_send_cdsc(mchat_thread *t, gchar *send_buffer, gint64 since);
+
 /*! @} */
 
 
@@ -125,6 +227,19 @@ gpointer mchatv1_thread_comm_send(gpointer args);
  *
  */
 gpointer mchatv1_thread_comm_recv(gpointer args);
+
+/*!
+ * \brief Thread used to receive messages on every joined channel
+ * \param args Void pointer to mchat_thread struct
+ * \returns NULL (Technically no one listens for it, so it is irrelevant)
+ *
+ * \details
+ * This thread polls all of mchat_t.join_sockets at once and reloads the set whenever
+ * mchat_t.join_wakeup is cancelled.  Messages are only delivered if the channel they
+ * name is joined on the port they arrived on.  The thread has no socket of its own, so
+ * mchat_thread.sock and mchat_thread.addr are NULL.
+ */
+gpointer mchatv1_thread_multi_recv(gpointer args);
 /*! @} */
 
 #endif // MCHATV1_THREADS_H
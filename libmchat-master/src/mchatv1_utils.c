@@ -9,52 +9,168 @@
  * \todo This documentation
  */
 
+/* setsourcefilter(), the MCAST_* filter modes and the CPU_* macros are not part of C99 */
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 #include <gio/gio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 #include "mchatv1.h"
 #include "mchatv1_structs.h"
+#include "mchatv1_proto.h"
 #include "mchatv1_utils.h"
+#include "mchatv1_intern.h"
+
+
+mchat_channel_table *channel_table_new(void)
+{
+    mchat_channel_table *table = g_malloc(sizeof(mchat_channel_table));
+    table->list = g_ptr_array_new();
+    g_ptr_array_set_free_func(table->list, mchat_channel_destroy);
+    table->by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    table->by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+    return table;
+}
+
+
+void channel_table_destroy(mchat_channel_table *table)
+{
+    g_hash_table_destroy(table->by_name);
+    g_hash_table_destroy(table->by_id);
+    g_ptr_array_free(table->list, TRUE);
+    g_free(table);
+}
+
+
+int channel_table_add(mchat_channel_table *table, mchat_channel *chan)
+{
+    if (g_hash_table_contains(table->by_name, chan->channel_name) ||
+            g_hash_table_contains(table->by_id, GUINT_TO_POINTER(chan->channel_id)))
+        return -1;
+
+    chan->table_index = table->list->len;
+    g_ptr_array_add(table->list, chan);
+    g_hash_table_insert(table->by_name, chan->channel_name, chan);
+    g_hash_table_insert(table->by_id, GUINT_TO_POINTER(chan->channel_id), chan);
+    return 0;
+}
 
 
-mchat_channel *channel_query_by_name(GPtrArray *array, char *channel_name)
+int channel_table_remove(mchat_channel_table *table, mchat_channel *chan)
 {
-    int channel_length = strlen(channel_name);
-    for (int i = 0; i < array->len; i++)
+    if (g_hash_table_lookup(table->by_id, GUINT_TO_POINTER(chan->channel_id)) != chan)
+        return -1;
+
+    g_hash_table_remove(table->by_name, chan->channel_name);
+    g_hash_table_remove(table->by_id, GUINT_TO_POINTER(chan->channel_id));
+    guint last = table->list->len - 1;
+    if (chan->table_index != last)
     {
-        mchat_channel *c = g_ptr_array_index(array, i);
-        if (strlen(c->channel_name) == channel_length)
-        {
-            if (strncmp(channel_name, c->channel_name, channel_length) == 0)
-                return c;
-        }
+        mchat_channel *moved = g_ptr_array_index(table->list, last);
+        moved->table_index = chan->table_index;
     }
-    return NULL;
+    g_ptr_array_remove_index_fast(table->list, chan->table_index);	/* frees chan */
+    return 0;
 }
 
 
-mchat_channel *channel_query_by_id(GPtrArray *array, unsigned int channel_id)
+mchat_channel *channel_query_by_name(mchat_channel_table *table, char *channel_name)
 {
-    for (int i = 0; i < array->len; i++)
+    return g_hash_table_lookup(table->by_name, channel_name);
+}
+
+
+mchat_channel *channel_query_by_id(mchat_channel_table *table, unsigned int channel_id)
+{
+    return g_hash_table_lookup(table->by_id, GUINT_TO_POINTER(channel_id));
+}
+
+
+int peerlist_query(mchat_t *mchat, guint32 address)
+{
+    /* Indexes are stored off by one so that index 0 is not a NULL pointer */
+    guint index = GPOINTER_TO_UINT(g_hash_table_lookup(mchat->peerlist_index, GUINT_TO_POINTER(address)));
+    return (int)index - 1;
+}
+
+
+void channel_members_destroy(gpointer data)
+{
+    mchat_channel_members *m = (mchat_channel_members*)data;
+    g_hash_table_destroy(m->members);
+    mchat_istr_unref(m->channel);
+    g_free(m);
+}
+
+
+/*!
+ * \brief Add a peer to the membership index of a channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Channel the peer is in
+ * \param address Source address of the peer
+ */
+static void channel_members_add(mchat_t *mchat, mchat_istr *channel, guint32 address)
+{
+    mchat_channel_members *m = g_hash_table_lookup(mchat->channel_members, channel);
+    if (m == NULL)
     {
-        mchat_channel *c = g_ptr_array_index(array, i);
-        if (c->channel_id == channel_id)
-            return c;
+        m = g_malloc(sizeof(mchat_channel_members));
+        m->channel = mchat_istr_ref(channel);
+        m->members = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_hash_table_insert(mchat->channel_members, m->channel, m);
     }
-    return NULL;
+    g_hash_table_add(m->members, GUINT_TO_POINTER(address));
 }
 
 
-int peerlist_query(mchat_t *mchat, guint32 address)
+/*!
+ * \brief Remove a peer from the membership index of a channel
+ * \param mchat Pointer to an mchat object
+ * \param channel Channel the peer was in
+ * \param address Source address of the peer
+ */
+static void channel_members_remove(mchat_t *mchat, mchat_istr *channel, guint32 address)
 {
-    for (int i = 0; i < mchat->peerlist->len; i++)
+    mchat_channel_members *m = g_hash_table_lookup(mchat->channel_members, channel);
+    if (m == NULL)
+        return;
+    g_hash_table_remove(m->members, GUINT_TO_POINTER(address));
+    if (g_hash_table_size(m->members) == 0)
+        g_hash_table_remove(mchat->channel_members, channel);	/* frees m */
+}
+
+
+/*!
+ * \brief Remove a peer from the peer list and its indexes
+ * \param mchat Pointer to an mchat object
+ * \param index Index of the peer in the peer list
+ */
+static void peerlist_remove_index(mchat_t *mchat, guint index)
+{
+    mchat_peer *p = &g_array_index(mchat->peerlist, mchat_peer, index);
+    guint last = mchat->peerlist->len - 1;
+
+    channel_members_remove(mchat, p->channel, p->source_address);
+    g_hash_table_remove(mchat->peerlist_index, GUINT_TO_POINTER(p->source_address));
+    if (index != last)
     {
-        mchat_peer *p = &g_array_index(mchat->peerlist, mchat_peer, i);
-        if (p->source_address == address)
-            return i;
+        /* g_array_remove_index_fast moves the last peer into this slot */
+        mchat_peer *moved = &g_array_index(mchat->peerlist, mchat_peer, last);
+        g_hash_table_insert(mchat->peerlist_index, GUINT_TO_POINTER(moved->source_address),
+                            GUINT_TO_POINTER(index + 1));
     }
-    return -1;
+    g_array_remove_index_fast(mchat->peerlist, index);
 }
 
 
@@ -62,21 +178,89 @@ int peerlist_expire(mchat_t *mchat)
 {
     gint64 now = g_get_real_time();
     g_mutex_lock(&mchat->peerlist_mutex);
-    if (mchat->peerlist->len)
+    for (int i = 0; i < mchat->peerlist->len; i++)
     {
-        for (int i = 0; i < mchat->peerlist->len; i++)
+        mchat_peer *p = &g_array_index(mchat->peerlist, mchat_peer, i);
+        if (now - p->last_seen > MCHAT_PROTOCOL_DEFAULT_EXPIRE_INTERVAL * G_TIME_SPAN_SECOND)
         {
-            mchat_peer *p = &g_array_index(mchat->peerlist, mchat_peer, i);
-            if (now - p->last_seen > MCHAT_PROTOCOL_DEFAULT_EXPIRE_INTERVAL * G_TIME_SPAN_SECOND)
-                g_array_remove_index_fast(mchat->peerlist, i);
+            peerlist_push_event(mchat, MCHAT_PEER_EVENT_EXPIRED, p);
+            peerlist_remove_index(mchat, i);
+            i--;	/* The last peer was moved into this index */
+            mchat->peerlist_dirty = 1;
         }
     }
+
+    /* Timestamp-only updates are batched up and published here */
+    if (mchat->peerlist_dirty)
+        peerlist_publish(mchat);
+    else
+        mchat_snapshot_reclaim(&mchat->peerlist_snapshot);
     g_mutex_unlock(&mchat->peerlist_mutex);
+    return 0;
+}
+
+
+/*!
+ * \brief Update the traffic statistics of a peer entry
+ * \param p Pointer to the peer entry
+ * \param parsed_message Pointer to the parsed message
+ * \param now Arrival time of the message
+ * \param common Non-zero if the message was received on the common channel
+ */
+static void peerlist_update_stats(mchat_peer *p, mchat_parser *parsed_message, gint64 now, int common)
+{
+    const gint64 interval = MCHAT_PROTOCOL_DEFAULT_KEEPALIVE_TIMER * G_TIME_SPAN_SECOND;
+
+    p->byte_count += parsed_message->total_size;
+    if (parsed_message->packet_type == MCHATV1_MESSAGE_TYPE_TEXT)
+    {
+        p->text_count++;
+        p->last_text = now;
+        return;
+    }
+
+    p->ping_count++;
+    if (!common)
+        return;
+
+    /* Peers send a burst of PINGs when they start; only keepalives that are
+     * roughly an interval apart are used for jitter and loss */
+    if (p->keepalive_count == 0)
+    {
+        p->last_keepalive = now;
+        p->keepalive_count = 1;
+    }
+    else if (now - p->last_keepalive >= interval / 2)
+    {
+        /* A gap of about n intervals means n - 1 keepalives went missing.  Rounding
+         * per gap keeps the sender's timer drift from adding up to fake loss. */
+        gint64 gap = now - p->last_keepalive;
+        p->keepalive_lost += (gap + interval / 2) / interval - 1;
+
+        /* Same estimator RTP uses (RFC 3550 section 6.4.1) */
+        gint64 d = gap - interval;
+        gint64 j = p->jitter;
+        if (d < 0)
+            d = -d;
+        j += (d - j) / 16;
+        p->jitter = j;
+        p->last_keepalive = now;
+        p->keepalive_count++;
+    }
 }
 
 
-int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 address)
+int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 address, int common)
 {
+    guint32 nickname_len = parsed_message.header_len[MCHATV1_HEADER_TYPE_NICKNAME];
+    guint32 channel_len = parsed_message.header_len[MCHATV1_HEADER_TYPE_CHANNEL];
+    gchar *nickname = parsed_message.header_offset[MCHATV1_HEADER_TYPE_NICKNAME];
+    gchar *channel = parsed_message.header_offset[MCHATV1_HEADER_TYPE_CHANNEL];
+    /* Hashing is done before taking the lock; for a keepalive from a known peer
+     * it is all the work needed to see that nothing changed */
+    guint32 nickname_hash = mchat_intern_hash(nickname, nickname_len);
+    guint32 channel_hash = mchat_intern_hash(channel, channel_len);
+
     g_mutex_lock(&mchat->peerlist_mutex);
     int index = peerlist_query(mchat, address);
 
@@ -84,22 +268,47 @@ int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 ad
     {
         mchat_peer p;
         memset(&p, 0, sizeof(p));
-        p.nickname_len = parsed_message.header_len[MCHATV1_HEADER_TYPE_NICKNAME];
-        memcpy(p.nickname, parsed_message.header_offset[MCHATV1_HEADER_TYPE_NICKNAME], p.nickname_len);
-        p.channel_len = parsed_message.header_len[MCHATV1_HEADER_TYPE_CHANNEL];
-        memcpy(p.channel, parsed_message.header_offset[MCHATV1_HEADER_TYPE_CHANNEL], p.channel_len);
+        p.nickname = mchat_intern(nickname, nickname_len, nickname_hash);
+        p.channel = mchat_intern(channel, channel_len, channel_hash);
         p.last_seen = g_get_real_time();
         p.source_address = address;
+        peerlist_update_stats(&p, &parsed_message, p.last_seen, common);
         g_array_append_val(mchat->peerlist, p);
+        g_hash_table_insert(mchat->peerlist_index, GUINT_TO_POINTER(address),
+                            GUINT_TO_POINTER(mchat->peerlist->len));
+        channel_members_add(mchat, p.channel, address);
+        peerlist_push_event(mchat, MCHAT_PEER_EVENT_JOINED, &p);
+        peerlist_publish(mchat);
     }
     else
     {
         mchat_peer *p = &g_array_index(mchat->peerlist, mchat_peer, index);
-        p->nickname_len = parsed_message.header_len[MCHATV1_HEADER_TYPE_NICKNAME];
-        memcpy(p->nickname, parsed_message.header_offset[MCHATV1_HEADER_TYPE_NICKNAME], p->nickname_len);
-        p->channel_len = parsed_message.header_len[MCHATV1_HEADER_TYPE_CHANNEL];
-        memcpy(p->channel, parsed_message.header_offset[MCHATV1_HEADER_TYPE_CHANNEL], p->channel_len);
+        gboolean nickname_changed = !mchat_istr_equal(p->nickname, nickname, nickname_len, nickname_hash);
+        gboolean channel_changed = !mchat_istr_equal(p->channel, channel, channel_len, channel_hash);
+        gboolean changed = nickname_changed || channel_changed;
         p->last_seen = g_get_real_time();
+        peerlist_update_stats(p, &parsed_message, p->last_seen, common);
+        if (nickname_changed)
+        {
+            mchat_istr_unref(p->nickname);
+            p->nickname = mchat_intern(nickname, nickname_len, nickname_hash);
+            peerlist_push_event(mchat, MCHAT_PEER_EVENT_NICKNAME_CHANGED, p);
+        }
+        if (channel_changed)
+        {
+            channel_members_remove(mchat, p->channel, address);
+            mchat_istr_unref(p->channel);
+            p->channel = mchat_intern(channel, channel_len, channel_hash);
+            channel_members_add(mchat, p->channel, address);
+            peerlist_push_event(mchat, MCHAT_PEER_EVENT_CHANNEL_CHANGED, p);
+        }
+
+        /* Joins and renames are published right away, keepalives are batched
+         * by peerlist_expire() */
+        if (changed)
+            peerlist_publish(mchat);
+        else
+            mchat->peerlist_dirty = 1;
     }
     g_mutex_unlock(&mchat->peerlist_mutex);
 
@@ -107,37 +316,117 @@ int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 ad
 }
 
 
-unsigned int mchat_channel_hash_struct(mchat_channel *chan)
+void peerlist_peer_ref(mchat_peer *peer)
 {
-    guint32 hash = MCHAT_CHANNEL_HASH_FNV_OFFSET;
+    mchat_istr_ref(peer->nickname);
+    mchat_istr_ref(peer->channel);
+}
 
-    // First, hash the channel_name
-    for (int i = 0; i < strlen(chan->channel_name); i++)
-        hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ chan->channel_name[i];
 
-    // Next, the address
-    guchar *addr = g_inet_address_to_string(chan->channel_address);
-    for (int i = 0; i < strlen(addr); i++)
-         hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ addr[i];
-    g_free(addr);
+void peerlist_peer_clear(gpointer data)
+{
+    mchat_peer *p = (mchat_peer*)data;
+    mchat_istr_unref(p->nickname);
+    mchat_istr_unref(p->channel);
+    p->nickname = NULL;
+    p->channel = NULL;
+}
 
-    // Finally, add the port number
-    guchar *port_bytes = (guchar*)&chan->channel_portno;
-    hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ port_bytes[0];
-    hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ port_bytes[1];
 
-    return hash;
+void peerlist_push_event(mchat_t *mchat, guint32 type, mchat_peer *peer)
+{
+    guint32 tail;
+    if (mchat->peer_events_count == MCHAT_LIMIT_MAX_PEER_EVENTS)
+    {
+        /* Drop the oldest event, the consumer will have to resync */
+        peerlist_peer_clear(&mchat->peer_events[mchat->peer_events_head].peer);
+        mchat->peer_events_head = (mchat->peer_events_head + 1) % MCHAT_LIMIT_MAX_PEER_EVENTS;
+        mchat->peer_events_count--;
+        mchat->peer_events_overflowed = 1;
+    }
+    tail = (mchat->peer_events_head + mchat->peer_events_count) % MCHAT_LIMIT_MAX_PEER_EVENTS;
+    mchat_peer_event *e = &mchat->peer_events[tail];
+    e->type = type;
+    e->timestamp = g_get_real_time();
+    memcpy(&e->peer, peer, sizeof(mchat_peer));
+    peerlist_peer_ref(&e->peer);
+    mchat->peer_events_count++;
 }
 
 
-unsigned int mchat_channel_hash_params(guchar *name, guchar *addr, guint16 portno)
+static void peerlist_snapshot_free(gpointer data)
+{
+    mchat_peerlist_t *l = (mchat_peerlist_t*)data;
+    for (guint64 i = 0; i < l->length; i++)
+        peerlist_peer_clear(&l->list[i]);
+    g_free(l->list);
+    g_free(l);
+}
+
+
+mchat_peerlist_t *peerlist_snapshot_new(guint64 length)
+{
+    mchat_peerlist_t *l = g_malloc(sizeof(mchat_peerlist_t));
+    memset(l, 0, sizeof(mchat_peerlist_t));
+    mchat_snapshot_init(&l->snap, peerlist_snapshot_free);
+    if (length)
+        l->list = g_malloc(sizeof(mchat_peer) * length);
+    return l;
+}
+
+
+guint peerlist_publish(mchat_t *mchat)
+{
+    mchat_peerlist_t *l = peerlist_snapshot_new(mchat->peerlist->len);
+    l->length = mchat->peerlist->len;
+    if (l->length)
+    {
+        memcpy(l->list, mchat->peerlist->data, sizeof(mchat_peer) * l->length);
+        for (guint64 i = 0; i < l->length; i++)
+            peerlist_peer_ref(&l->list[i]);
+    }
+    mchat->peerlist_dirty = 0;
+    return mchat_snapshot_publish(&mchat->peerlist_snapshot, l);
+}
+
+
+guint identity_publish(mchat_t *mchat)
+{
+    mchat_identity *id = g_malloc0(sizeof(mchat_identity));
+    mchat_snapshot_init(&id->snap, g_free);
+    memcpy(id->nickname, mchat->nickname, mchat->nickname_size);
+    id->nickname_size = mchat->nickname_size;
+
+    mchat_channel *c = mchat->current_channel;
+    if (c != NULL)
+    {
+        id->is_connected = 1;
+        g_strlcpy(id->channel_name, c->channel_name, sizeof(id->channel_name));
+        gchar *addr = g_inet_address_to_string(c->channel_address);
+        g_strlcpy(id->channel_address, addr, sizeof(id->channel_address));
+        g_free(addr);
+        id->channel_portno = c->channel_portno;
+    }
+    return mchat_snapshot_publish(&mchat->identity_snapshot, id);
+}
+
+
+/*!
+ * \brief Hash a channel's name, raw address bytes and port number
+ * \param name NUL terminated channel name
+ * \param addr Raw address bytes (network byte order)
+ * \param addr_len Length of \p addr (4 for IPv4, 16 for IPv6)
+ * \param portno Port number of the channel
+ * \return The hash value
+ */
+static guint32 mchat_channel_hash_bytes(const guchar *name, const guint8 *addr, gsize addr_len, guint16 portno)
 {
     guint32 hash = MCHAT_CHANNEL_HASH_FNV_OFFSET;
 
-    for (int i = 0; i < strlen(name); i++)
-        hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ name[i];
+    for (const guchar *c = name; *c != '\0'; c++)
+        hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ *c;
 
-    for (int i = 0; i < strlen(addr); i++)
+    for (gsize i = 0; i < addr_len; i++)
         hash = (hash * MCHAT_CHANNEL_HASH_FNV_PRIME) ^ addr[i];
 
     guchar *port_bytes = (guchar*)&portno;
@@ -148,6 +437,29 @@ unsigned int mchat_channel_hash_params(guchar *name, guchar *addr, guint16 portn
 }
 
 
+unsigned int mchat_channel_hash_struct(mchat_channel *chan)
+{
+    return mchat_channel_hash_bytes((guchar*)chan->channel_name,
+                                    g_inet_address_to_bytes(chan->channel_address),
+                                    g_inet_address_get_native_size(chan->channel_address),
+                                    chan->channel_portno);
+}
+
+
+unsigned int mchat_channel_hash_params(guchar *name, guchar *addr, guint16 portno)
+{
+    guint8 bytes[16];
+
+    if (inet_pton(AF_INET, (char*)addr, bytes) == 1)
+        return mchat_channel_hash_bytes(name, bytes, 4, portno);
+    if (inet_pton(AF_INET6, (char*)addr, bytes) == 1)
+        return mchat_channel_hash_bytes(name, bytes, 16, portno);
+
+    /* Not an address we can parse; hash the string so we still get a stable id */
+    return mchat_channel_hash_bytes(name, addr, strlen((char*)addr), portno);
+}
+
+
 void mchat_channel_destroy(gpointer data)
 {
     mchat_channel *c = (mchat_channel*)data;
@@ -160,62 +472,852 @@ mchat_channel *mchat_channel_copy(mchat_channel *src)
     mchat_channel *dst = g_malloc(sizeof(mchat_channel));
     memset(dst, 0, sizeof(mchat_channel));
     memcpy(dst->channel_name, src->channel_name, strlen(src->channel_name));
-    guchar *addr = g_inet_address_to_string(src->channel_address);
-    dst->channel_address = g_inet_address_new_from_string(addr);
-    g_free(addr);
+    /* GInetAddress objects are immutable, so the copy can share it */
+    dst->channel_address = g_object_ref(src->channel_address);
     dst->channel_portno = src->channel_portno;
     dst->channel_id = src->channel_id;
+    dst->shard_count = src->shard_count;
 
     return dst;
 }
 
-int mchat_channel_update(mchat_t *mchat, mchat_parser *parsed_message)
+/*!
+ * \brief Drop a discovered channel from the CDSC cache
+ * \param mchat Pointer to an mchat object
+ * \param c Channel to remove (freed)
+ */
+static void mchat_channel_forget(mchat_t *mchat, mchat_channel *c)
+{
+    g_queue_delete_link(&mchat->cdsc_lru, c->lru_link);
+    channel_table_remove(mchat->cdsc_channels, c);
+}
+
+
+/*!
+ * \brief Record one announced channel in the CDSC cache
+ * \param mchat Pointer to an mchat object
+ * \param name Channel name (not NUL terminated)
+ * \param name_len Length of \p name
+ * \param address Channel address string (not NUL terminated)
+ * \param addr_len Length of \p address
+ * \param portno Channel port number
+ * \param now Time the announcement was received
+ * \return 1 if a channel was added, 0 if a known channel was refreshed or -1 if invalid
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+static int mchat_channel_seen(mchat_t *mchat, const gchar *name, guint32 name_len,
+                              const gchar *address, guint32 addr_len, guint16 portno, gint64 now)
 {
     char chan_name[MCHAT_LIMIT_MAX_CHANNEL_NAME_SIZE];
     char chan_addr[40];
-    memcpy(chan_name,
-           parsed_message->header_offset[MCHATV1_HEADER_TYPE_CHANNEL],
-           parsed_message->header_len[MCHATV1_HEADER_TYPE_CHANNEL]);
-    memcpy(chan_addr,
-           parsed_message->header_offset[MCHATV1_HEADER_TYPE_ADDRESS],
-           parsed_message->header_len[MCHATV1_HEADER_TYPE_ADDRESS]);
-    chan_name[parsed_message->header_len[MCHATV1_HEADER_TYPE_CHANNEL]] = '\0';
-    chan_addr[parsed_message->header_len[MCHATV1_HEADER_TYPE_ADDRESS]] = '\0';
-    guint16 portno = strtol(parsed_message->header_offset[MCHATV1_HEADER_TYPE_PORT],
-                                   NULL, 10);
+    if (name_len == 0 || name_len >= sizeof(chan_name) ||
+        addr_len == 0 || addr_len >= sizeof(chan_addr))
+        return -1;
+
+    memcpy(chan_name, name, name_len);
+    memcpy(chan_addr, address, addr_len);
+    chan_name[name_len] = '\0';
+    chan_addr[addr_len] = '\0';
     guint32 id = mchat_channel_hash_params(chan_name, chan_addr, portno);
-    g_mutex_lock(&mchat->channels_mutex);
+
     mchat_channel *c = channel_query_by_id(mchat->cdsc_channels, id);
-    if (c == NULL)
+    if (c != NULL)
     {
-        c = g_malloc(sizeof(mchat_channel));
-        memset(c, 0, sizeof(mchat_channel));
-        c->channel_address = g_inet_address_new_from_string(chan_addr);
-        c->channel_id = id;
-        c->channel_portno = portno;
-        memcpy(c->channel_name, chan_name,
-               parsed_message->header_len[MCHATV1_HEADER_TYPE_CHANNEL]);
+        /* Known channel: refresh it and move it to the front of the LRU list.
+         * Publishing the new time is left to mchat_channel_expire(). */
+        c->last_seen = now;
+        g_queue_unlink(&mchat->cdsc_lru, c->lru_link);
+        g_queue_push_head_link(&mchat->cdsc_lru, c->lru_link);
+        mchat->cdsc_dirty = 1;
+        return 0;
+    }
+
+    GInetAddress *addr = g_inet_address_new_from_string(chan_addr);
+    if (addr == NULL)
+        return -1;
+
+    /* The name now points somewhere else; the newest announcement wins */
+    mchat_channel *old = channel_query_by_name(mchat->cdsc_channels, chan_name);
+    if (old != NULL)
+        mchat_channel_forget(mchat, old);
+
+    /* Make room by dropping the channel announced longest ago */
+    if (mchat->cdsc_channels->list->len >= MCHAT_LIMIT_MAX_CDSC_CHANNELS)
+        mchat_channel_forget(mchat, g_queue_peek_tail(&mchat->cdsc_lru));
+
+    c = g_malloc(sizeof(mchat_channel));
+    memset(c, 0, sizeof(mchat_channel));
+    c->channel_address = addr;
+    c->channel_id = id;
+    c->channel_portno = portno;
+    memcpy(c->channel_name, chan_name, name_len);
+    c->last_seen = now;
+    channel_table_add(mchat->cdsc_channels, c);
+    g_queue_push_head(&mchat->cdsc_lru, c);
+    c->lru_link = g_queue_peek_head_link(&mchat->cdsc_lru);
+    return 1;
+}
+
+
+/*!
+ * \brief Parse a decimal port number
+ * \param ptr Pointer to the digits
+ * \param len Number of characters available at \p ptr
+ * \return The port number or -1 if \p ptr is not a valid port number
+ */
+static gint32 mchat_channel_parse_port(const gchar *ptr, gsize len)
+{
+    gint32 port = 0;
+    if (len == 0 || len > 5)
+        return -1;
+    for (gsize i = 0; i < len; i++)
+    {
+        if (!g_ascii_isdigit(ptr[i]))
+            return -1;
+        port = port * 10 + (ptr[i] - '0');
+    }
+    return port <= G_MAXUINT16 ? port : -1;
+}
+
+
+int mchat_channel_update(mchat_t *mchat, mchat_parser *parsed_message)
+{
+    gint32 portno = mchat_channel_parse_port(parsed_message->header_offset[MCHATV1_HEADER_TYPE_PORT],
+                                             parsed_message->header_len[MCHATV1_HEADER_TYPE_PORT]);
+    if (portno < 0)
+        return -1;
+    gint64 now = g_get_real_time();
+
+    g_mutex_lock(&mchat->channels_mutex);
+    int ret = mchat_channel_seen(mchat, parsed_message->header_offset[MCHATV1_HEADER_TYPE_CHANNEL],
+                                 parsed_message->header_len[MCHATV1_HEADER_TYPE_CHANNEL],
+                                 parsed_message->header_offset[MCHATV1_HEADER_TYPE_ADDRESS],
+                                 parsed_message->header_len[MCHATV1_HEADER_TYPE_ADDRESS],
+                                 portno, now);
+    gboolean added = ret > 0;
+
+    /* An aggregated CDSC lists more channels in its body, one "name address port"
+     * line each.  Malformed lines are skipped. */
+    if (parsed_message->body != NULL && parsed_message->header_offset[MCHATV1_HEADER_TYPE_LENGTH] != NULL)
+    {
+        const gchar *cur = parsed_message->body;
+        const gchar *end = cur + parsed_message->body_size;
+        while (cur < end)
+        {
+            const gchar *eol = memchr(cur, '\n', end - cur);
+            if (eol == NULL)
+                eol = end;
+            const gchar *line_end = (eol > cur && eol[-1] == '\r') ? eol - 1 : eol;
+
+            const gchar *name = cur;
+            const gchar *name_end = memchr(name, ' ', line_end - name);
+            const gchar *addr = name_end ? name_end + 1 : NULL;
+            const gchar *addr_end = addr ? memchr(addr, ' ', line_end - addr) : NULL;
+            if (addr_end != NULL)
+            {
+                gint32 port = mchat_channel_parse_port(addr_end + 1, line_end - addr_end - 1);
+                if (port >= 0 && mchat_channel_seen(mchat, name, name_end - name,
+                                                    addr, addr_end - addr, port, now) > 0)
+                    added = TRUE;
+            }
+            cur = eol + 1;
+        }
+    }
+
+    if (added)
+    {
+        chanlist_publish(mchat->cdsc_channels, &mchat->cdsc_snapshot);
+        mchat->cdsc_dirty = 0;
     }
-    c->last_seen = g_get_real_time();
     g_mutex_unlock(&mchat->channels_mutex);
-    return 0;
+    return ret < 0 ? -1 : 0;
 }
 
 
 int mchat_channel_expire(mchat_t *mchat)
 {
+    gint64 now = g_get_real_time();
+    gboolean removed = FALSE;
+
     g_mutex_lock(&mchat->channels_mutex);
-    for (int i = 0; i < mchat->cdsc_channels->len; i++)
+    /* The LRU list is ordered by last_seen, so only expired channels are visited */
+    mchat_channel *c;
+    while ((c = g_queue_peek_tail(&mchat->cdsc_lru)) != NULL &&
+           now - c->last_seen > MCHAT_PROTOCOL_DEFAULT_CDSC_EXPIRE * G_TIME_SPAN_SECOND)
+    {
+        mchat_channel_forget(mchat, c);
+        removed = TRUE;
+    }
+
+    if (removed || mchat->cdsc_dirty)
+    {
+        chanlist_publish(mchat->cdsc_channels, &mchat->cdsc_snapshot);
+        mchat->cdsc_dirty = 0;
+    }
+    else
+        mchat_snapshot_reclaim(&mchat->cdsc_snapshot);
+    g_mutex_unlock(&mchat->channels_mutex);
+    return 0;
+}
+
+
+static void chanlist_snapshot_free(gpointer data)
+{
+    mchat_chanlist_t *l = (mchat_chanlist_t*)data;
+    for (guint64 i = 0; i < l->length; i++)
+        g_object_unref(l->list[i].channel_address);
+    g_free(l->list);
+    g_free(l);
+}
+
+
+guint chanlist_publish(mchat_channel_table *table, mchat_snapshot_slot *slot)
+{
+    mchat_chanlist_t *l = g_malloc(sizeof(mchat_chanlist_t));
+    memset(l, 0, sizeof(mchat_chanlist_t));
+    mchat_snapshot_init(&l->snap, chanlist_snapshot_free);
+    l->length = table->list->len;
+    if (l->length)
     {
-        mchat_channel *c = g_ptr_array_index(mchat->cdsc_channels, i);
-        if (g_get_real_time() - c->last_seen > MCHAT_PROTOCOL_DEFAULT_CDSC_EXPIRE * G_TIME_SPAN_SECOND)
+        l->list = g_malloc(sizeof(mchat_channel) * l->length);
+        for (guint64 i = 0; i < l->length; i++)
         {
-            g_ptr_array_remove_fast(mchat->cdsc_channels, c);
-            i--;	/* g_ptr_array_remove_fast moves the last element
-                      of the array into the space removed, so we need to
-                      inspect that index again. */
+            memcpy(&l->list[i], g_ptr_array_index(table->list, i), sizeof(mchat_channel));
+            g_object_ref(l->list[i].channel_address);
+            l->list[i].lru_link = NULL;
         }
     }
+    return mchat_snapshot_publish(slot, l);
+}
+
+
+guint mchat_channel_topic_shard(mchat_channel *chan, const gchar *topic)
+{
+    guint32 hash = MCHAT_CHANNEL_HASH_FNV_OFFSET;
+    for (const guchar *p = (const guchar*)chan->channel_name; *p; p++)
+        hash = (hash ^ *p) * MCHAT_CHANNEL_HASH_FNV_PRIME;
+    hash = (hash ^ '\n') * MCHAT_CHANNEL_HASH_FNV_PRIME;	/* keep "#a"+"bc" apart from "#ab"+"c" */
+    for (const guchar *p = (const guchar*)topic; *p; p++)
+        hash = (hash ^ *p) * MCHAT_CHANNEL_HASH_FNV_PRIME;
+    return hash % chan->shard_count;
+}
+
+
+GInetAddress *mchat_channel_shard_address(mchat_channel *chan, guint shard)
+{
+    guint8 bytes[16];
+    gsize len = g_inet_address_get_native_size(chan->channel_address);
+    memcpy(bytes, g_inet_address_to_bytes(chan->channel_address), len);
+
+    /* Add shard + 1 to the address as a big endian number (carrying into the upper bytes) */
+    guint carry = shard + 1;
+    for (gsize i = len; i-- > 0 && carry; )
+    {
+        carry += bytes[i];
+        bytes[i] = carry & 0xff;
+        carry >>= 8;
+    }
+    return g_inet_address_new_from_bytes(bytes, g_inet_address_get_family(chan->channel_address));
+}
+
+
+/*!
+ * \brief Get how many addresses one multicast group is after another
+ * \param a First address
+ * \param b Second address
+ * \param offset Set to b - a
+ * \return FALSE if the addresses are too far apart (or of different families) to compare
+ */
+static gboolean inet_address_offset(GInetAddress *a, GInetAddress *b, gint64 *offset)
+{
+    if (g_inet_address_get_family(a) != g_inet_address_get_family(b))
+        return FALSE;
+
+    /* Only the low 64 bits take part; shard ranges are far smaller than that */
+    gsize len = g_inet_address_get_native_size(a);
+    gsize low = MIN(len, 8);
+    const guint8 *ab = g_inet_address_to_bytes(a);
+    const guint8 *bb = g_inet_address_to_bytes(b);
+    if (memcmp(ab, bb, len - low) != 0)
+        return FALSE;
+
+    guint64 av = 0, bv = 0;
+    for (gsize i = len - low; i < len; i++)
+    {
+        av = (av << 8) | ab[i];
+        bv = (bv << 8) | bb[i];
+    }
+    *offset = (gint64)(bv - av);
+    return TRUE;
+}
+
+
+gboolean channel_table_shards_overlap(mchat_channel_table *table, mchat_channel *chan, guint shard_count)
+{
+    for (guint i = 0; i < table->list->len; i++)
+    {
+        mchat_channel *o = g_ptr_array_index(table->list, i);
+        gint64 d;
+        if (o == chan || o->channel_portno != chan->channel_portno ||
+                !inet_address_offset(chan->channel_address, o->channel_address, &d))
+            continue;
+        /* chan occupies its address plus the next shard_count, o likewise.  Sharing the
+         * channel address itself is the user's choice and was allowed before sharding. */
+        if ((d > 0 && d <= shard_count) || (d < 0 && -d <= o->shard_count))
+            return TRUE;
+        if (d == 0 && shard_count > 0 && o->shard_count > 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+void topic_unsubscribe_all(mchat_t *mchat, GSocket *sock)
+{
+    mchat_channel *c = mchat->current_channel;
+    for (guint i = 0; c != NULL && i < c->shard_count; i++)
+    {
+        if (mchat->shard_members[i] == 0)
+            continue;
+        GInetAddress *group = mchat_channel_shard_address(c, i);
+        g_socket_leave_multicast_group(sock, group, FALSE, NULL, NULL);
+        g_object_unref(group);
+        mchat->shard_members[i] = 0;
+    }
+    g_hash_table_remove_all(mchat->topic_subscriptions);
+}
+
+
+int source_filter_key(char *address, guint32 *key)
+{
+#ifdef MCAST_INCLUDE
+    struct in_addr in;
+    if (address == NULL || inet_pton(AF_INET, address, &in) != 1)
+        return -1;
+    memcpy(key, &in, 4);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+int source_filter_apply(mchat_t *mchat, GSocket *sock, GInetAddress *group)
+{
+#ifdef MCAST_INCLUDE
+    if (g_inet_address_get_family(group) != G_SOCKET_FAMILY_IPV4)
+        return -1;
+
+    g_mutex_lock(&mchat->filter_mutex);
+    if (!mchat->source_filter_used)
+    {
+        g_mutex_unlock(&mchat->filter_mutex);
+        return 0;
+    }
+    /* A non-empty allow list wins (a sender is never on both lists) */
+    gboolean include = g_hash_table_size(mchat->source_allow) != 0;
+    GHashTable *list = include ? mchat->source_allow : mchat->source_block;
+    struct sockaddr_storage *sources = g_malloc0(sizeof(struct sockaddr_storage) *
+                                                 (g_hash_table_size(list) + 1));
+    guint32 count = 0;
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, list);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in*)&sources[count++];
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = GPOINTER_TO_UINT(key);	/* already in network order */
+    }
+    g_mutex_unlock(&mchat->filter_mutex);
+
+    struct sockaddr_in grp;
+    memset(&grp, 0, sizeof(grp));
+    grp.sin_family = AF_INET;
+    memcpy(&grp.sin_addr, g_inet_address_to_bytes(group), 4);
+    int ret = setsourcefilter(g_socket_get_fd(sock), 0, (struct sockaddr*)&grp, sizeof(grp),
+                              include ? MCAST_INCLUDE : MCAST_EXCLUDE, count, sources);
+    g_free(sources);
+    return ret == 0 ? 0 : -1;
+#else
+    return 0;
+#endif
+}
+
+
+int source_filter_update(mchat_t *mchat)
+{
+#ifndef MCAST_INCLUDE
+    return -1;
+#endif
+    /* Keep going after a failure, so every other membership is still updated */
+    int ret = 0;
+    g_mutex_lock(&mchat->channels_mutex);
+    if (g_atomic_int_get(&mchat->is_connected))
+    {
+        mchat_thread *recv = mchat->text_recv_thread;
+        mchat_channel *c = mchat->current_channel;
+        g_mutex_lock(&recv->mutex);
+        GSocket *sock = recv->next_sock ? recv->next_sock : recv->sock;
+        if (source_filter_apply(mchat, sock, c->channel_address) == -1)
+            ret = -1;
+        for (guint i = 0; i < c->shard_count; i++)
+        {
+            if (mchat->shard_members[i] == 0)
+                continue;
+            GInetAddress *group = mchat_channel_shard_address(c, i);
+            if (source_filter_apply(mchat, sock, group) == -1)
+                ret = -1;
+            g_object_unref(group);
+        }
+        g_mutex_unlock(&recv->mutex);
+    }
+
+    g_mutex_lock(&mchat->join_mutex);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, mchat->joined_channels);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        mchat_channel *c = (mchat_channel*)value;
+        mchat_join_socket *js = join_socket_lookup(mchat, c->channel_portno);
+        if (source_filter_apply(mchat, js->sock, c->channel_address) == -1)
+            ret = -1;
+    }
+    g_mutex_unlock(&mchat->join_mutex);
+    g_mutex_unlock(&mchat->channels_mutex);
+    return ret;
+}
+
+
+#ifdef __linux__
+/*!
+ * \brief Load a big endian word from the datagram; a UDP socket filter sees the UDP header first
+ */
+#define KERNEL_FILTER_LOAD(size, offset) BPF_STMT(BPF_LD | size | BPF_ABS, 8 + (offset))
+
+/*!
+ * \brief Pack four characters into the word BPF loads from the packet
+ */
+#define KERNEL_FILTER_WORD(s) \
+    ((guint32)(guchar)(s)[0] << 24 | (guint32)(guchar)(s)[1] << 16 | \
+     (guint32)(guchar)(s)[2] << 8 | (guint32)(guchar)(s)[3])
+
+/*!
+ * \brief Bits to OR into every loaded letter, folding it to lower case like the parser's
+ * case-insensitive compares (other bytes may fold too; the parser still checks them)
+ */
+#define KERNEL_FILTER_FOLD 0x20202020
+
+/*!
+ * \brief Append "A |= fold"
+ */
+static void kernel_filter_fold(GArray *prog, guint32 fold)
+{
+    struct sock_filter insn = BPF_STMT(BPF_ALU | BPF_OR | BPF_K, fold);
+    g_array_append_val(prog, insn);
+}
+
+/*!
+ * \brief Append "drop unless A == k"
+ */
+static void kernel_filter_require(GArray *prog, guint32 k)
+{
+    struct sock_filter insn[] = {
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, k, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    g_array_append_vals(prog, insn, 2);
+}
+#endif
+
+
+int kernel_filter_apply(mchat_t *mchat, GSocket *sock, guint types)
+{
+#ifdef __linux__
+    int fd = g_socket_get_fd(sock);
+    g_mutex_lock(&mchat->filter_mutex);
+    guint8 mode = mchat->kernel_filter;
+    if (mode == MCHAT_KERNEL_FILTER_OFF)
+    {
+        guint8 used = mchat->kernel_filter_used;
+        g_mutex_unlock(&mchat->filter_mutex);
+        /* Fails harmlessly with ENOENT if this socket never had one attached */
+        if (used)
+        {
+            /* The option value is ignored, but Linux refuses one shorter than an int */
+            int none = 0;
+            setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &none, sizeof(none));
+        }
+        return 0;
+    }
+
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(struct sock_filter));
+    struct sock_filter insn;
+
+    /* "TYPE MCHAT/": one of the wanted 4 character types ... */
+    insn = (struct sock_filter)KERNEL_FILTER_LOAD(BPF_W, 0);
+    g_array_append_val(prog, insn);
+    kernel_filter_fold(prog, KERNEL_FILTER_FOLD);
+    guint wanted = 0;
+    for (guint t = 0; t < MCHATV1_MESSAGE_TYPES_COUNT; t++)
+        wanted += (types >> t) & 1;
+    for (guint t = 0; t < MCHATV1_MESSAGE_TYPES_COUNT; t++)
+    {
+        if (!((types >> t) & 1))
+            continue;
+        /* On a match, jump past the remaining compares and the drop */
+        insn = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                KERNEL_FILTER_WORD(mchatv1_message_type_strings[t]) | KERNEL_FILTER_FOLD, wanted, 0);
+        g_array_append_val(prog, insn);
+        wanted--;
+    }
+    insn = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    g_array_append_val(prog, insn);
+
+    /* ... followed by the protocol signature */
+    insn = (struct sock_filter)KERNEL_FILTER_LOAD(BPF_W, 4);
+    g_array_append_val(prog, insn);
+    kernel_filter_fold(prog, KERNEL_FILTER_FOLD & 0x00FFFFFF);	/* not the space */
+    kernel_filter_require(prog, KERNEL_FILTER_WORD(" mch"));
+    insn = (struct sock_filter)KERNEL_FILTER_LOAD(BPF_H, 8);
+    g_array_append_val(prog, insn);
+    kernel_filter_fold(prog, KERNEL_FILTER_FOLD & 0xFFFF);
+    kernel_filter_require(prog, (guint32)'a' << 8 | 't');
+    insn = (struct sock_filter)KERNEL_FILTER_LOAD(BPF_B, 10);
+    g_array_append_val(prog, insn);
+    kernel_filter_require(prog, '/');
+
+    if (mode == MCHAT_KERNEL_FILTER_SOURCES && g_hash_table_size(mchat->source_block))
+    {
+        /* IPv4 source address, read from the network header */
+        insn = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+        g_array_append_val(prog, insn);
+        GHashTableIter iter;
+        gpointer key;
+        g_hash_table_iter_init(&iter, mchat->source_block);
+        while (g_hash_table_iter_next(&iter, &key, NULL) && prog->len < BPF_MAXINSNS - 3)
+        {
+            struct sock_filter block[] = {
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, g_ntohl(GPOINTER_TO_UINT(key)), 0, 1),
+                BPF_STMT(BPF_RET | BPF_K, 0),
+            };
+            g_array_append_vals(prog, block, 2);
+        }
+    }
+    g_mutex_unlock(&mchat->filter_mutex);
+
+    insn = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+    g_array_append_val(prog, insn);
+
+    struct sock_fprog fprog = { .len = prog->len, .filter = (struct sock_filter*)prog->data };
+    int ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+    g_array_free(prog, TRUE);
+    return ret == 0 ? 0 : -1;
+#else
+    return 0;
+#endif
+}
+
+
+int kernel_filter_update(mchat_t *mchat)
+{
+#ifndef __linux__
+    return -1;
+#endif
+    int ret = 0;
+    g_mutex_lock(&mchat->channels_mutex);
+    ret |= kernel_filter_apply(mchat, mchat->comm_recv_thread->sock, MCHAT_KERNEL_FILTER_COMMON_TYPES);
+    if (g_atomic_int_get(&mchat->is_connected))
+    {
+        mchat_thread *recv = mchat->text_recv_thread;
+        g_mutex_lock(&recv->mutex);
+        ret |= kernel_filter_apply(mchat, recv->sock, MCHAT_KERNEL_FILTER_CHANNEL_TYPES);
+        if (recv->next_sock != NULL)
+            ret |= kernel_filter_apply(mchat, recv->next_sock, MCHAT_KERNEL_FILTER_CHANNEL_TYPES);
+        g_mutex_unlock(&recv->mutex);
+    }
+
+    g_mutex_lock(&mchat->join_mutex);
+    for (guint i = 0; i < mchat->join_sockets->len; i++)
+    {
+        mchat_join_socket *js = g_ptr_array_index(mchat->join_sockets, i);
+        ret |= kernel_filter_apply(mchat, js->sock, MCHAT_KERNEL_FILTER_CHANNEL_TYPES);
+    }
+    g_mutex_unlock(&mchat->join_mutex);
     g_mutex_unlock(&mchat->channels_mutex);
+    return ret;
+}
+
+
+void multicast_socket_isolate(GSocket *sock)
+{
+#ifdef IP_MULTICAST_ALL
+    int all = 0;
+    setsockopt(g_socket_get_fd(sock), IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+}
+
+
+mchat_join_socket *join_socket_new(guint16 portno)
+{
+    GSocket *sock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+                                 G_SOCKET_PROTOCOL_UDP, NULL);
+    if (sock == NULL)
+        return NULL;
+
+    GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *addr = g_inet_socket_address_new(any, portno);
+    gboolean bound = g_socket_bind(sock, addr, TRUE, NULL);
+    g_object_unref(addr);
+    g_object_unref(any);
+    if (!bound)
+    {
+        g_object_unref(sock);
+        return NULL;
+    }
+    g_socket_set_multicast_loopback(sock, FALSE);
+    multicast_socket_isolate(sock);
+    g_socket_set_blocking(sock, FALSE);
+
+    mchat_join_socket *js = g_malloc(sizeof(mchat_join_socket));
+    js->sock = sock;
+    js->portno = portno;
+    js->channel_count = 0;
+    return js;
+}
+
+
+void join_socket_destroy(gpointer data)
+{
+    mchat_join_socket *js = (mchat_join_socket*)data;
+    g_object_unref(js->sock);
+    g_free(js);
+}
+
+
+mchat_join_socket *join_socket_lookup(mchat_t *mchat, guint16 portno)
+{
+    for (guint i = 0; i < mchat->join_sockets->len; i++)
+    {
+        mchat_join_socket *js = g_ptr_array_index(mchat->join_sockets, i);
+        if (js->portno == portno)
+            return js;
+    }
+    return NULL;
+}
+
+
+gboolean join_membership_shared(mchat_t *mchat, mchat_channel *chan)
+{
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, mchat->joined_channels);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        mchat_channel *c = (mchat_channel*)value;
+        if (c != chan && c->channel_portno == chan->channel_portno &&
+                g_inet_address_equal(c->channel_address, chan->channel_address))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+/*!
+ * \brief Find the pool link holding a channel's warm socket
+ */
+static GList *warm_socket_find(mchat_t *mchat, guint32 channel_id)
+{
+    for (GList *l = g_queue_peek_head_link(&mchat->warm_sockets); l != NULL; l = l->next)
+    {
+        if (((mchat_warm_socket*)l->data)->channel_id == channel_id)
+            return l;
+    }
+    return NULL;
+}
+
+
+GSocket *warm_socket_take(mchat_t *mchat, mchat_channel *chan)
+{
+    GSocket *sock;
+    GList *link = warm_socket_find(mchat, chan->channel_id);
+    if (link != NULL)
+    {
+        mchat_warm_socket *ws = link->data;
+        g_queue_delete_link(&mchat->warm_sockets, link);
+        sock = ws->sock;
+        g_free(ws);
+
+        /* Throw away what arrived while nobody was listening, a datagram per receive */
+        gchar *discard = g_malloc(MCHAT_LIMIT_MAX_MESSAGE_SIZE);
+        g_socket_set_blocking(sock, FALSE);
+        while (g_socket_receive(sock, discard, MCHAT_LIMIT_MAX_MESSAGE_SIZE, NULL, NULL) >= 0)
+            ;
+        g_socket_set_blocking(sock, TRUE);
+        g_free(discard);
+        kernel_filter_apply(mchat, sock, MCHAT_KERNEL_FILTER_CHANNEL_TYPES);
+        if (source_filter_apply(mchat, sock, chan->channel_address) == 0)
+            return sock;
+        /* Start over with a new socket rather than one that lets blocked senders in */
+        g_object_unref(sock);
+    }
+
+    sock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+                        G_SOCKET_PROTOCOL_UDP, NULL);
+    if (sock == NULL)
+        return NULL;
+
+    GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *addr = g_inet_socket_address_new(any, chan->channel_portno);
+    g_socket_set_multicast_loopback(sock, FALSE);
+    multicast_socket_isolate(sock);
+    /* Before the bind, so nothing unwanted is queued in between */
+    kernel_filter_apply(mchat, sock, MCHAT_KERNEL_FILTER_CHANNEL_TYPES);
+    g_socket_join_multicast_group(sock, chan->channel_address, FALSE, NULL, NULL);
+    gboolean bound = g_socket_bind(sock, addr, TRUE, NULL);
+    g_object_unref(addr);
+    g_object_unref(any);
+    if (!bound || source_filter_apply(mchat, sock, chan->channel_address) == -1)
+    {
+        g_object_unref(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+
+void warm_socket_put(mchat_t *mchat, mchat_channel *chan, GSocket *sock)
+{
+    warm_socket_drop(mchat, chan->channel_id);
+
+    mchat_warm_socket *ws = g_malloc(sizeof(mchat_warm_socket));
+    ws->channel_id = chan->channel_id;
+    ws->sock = g_object_ref(sock);
+    g_queue_push_head(&mchat->warm_sockets, ws);
+
+    /* Closing the socket also drops its multicast membership */
+    while (g_queue_get_length(&mchat->warm_sockets) > MCHAT_LIMIT_MAX_WARM_CHANNELS)
+        warm_socket_destroy(g_queue_pop_tail(&mchat->warm_sockets));
+}
+
+
+void warm_socket_drop(mchat_t *mchat, guint32 channel_id)
+{
+    GList *link = warm_socket_find(mchat, channel_id);
+    if (link == NULL)
+        return;
+    warm_socket_destroy(link->data);
+    g_queue_delete_link(&mchat->warm_sockets, link);
+}
+
+
+void warm_socket_destroy(gpointer data)
+{
+    mchat_warm_socket *ws = (mchat_warm_socket*)data;
+    g_object_unref(ws->sock);
+    g_free(ws);
+}
+
+
+int thread_tuning_apply(mchat_thread *t, const mchat_thread_tuning *tuning, guint fields)
+{
+    if ((fields & MCHAT_TUNING_BUSY_POLL) && t->role == MCHAT_THREAD_ROLE_TEXT_RECV)
+        g_atomic_int_set(&t->busy_poll, tuning->busy_poll);
+#ifdef __linux__
+    /* On Linux, these all take a thread id in place of a process id */
+    if (fields & MCHAT_TUNING_AFFINITY)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (tuning->cpus == NULL)
+        {
+            for (int i = 0; i < CPU_SETSIZE; i++)
+                CPU_SET(i, &set);
+        }
+        else
+        {
+            for (guint i = 0; i < tuning->cpus->len; i++)
+                CPU_SET(g_array_index(tuning->cpus, gint, i), &set);
+        }
+        if (sched_setaffinity(t->tid, sizeof(cpu_set_t), &set) == -1)
+            return -1;
+    }
+
+    if (fields & MCHAT_TUNING_SCHEDULING)
+    {
+        struct sched_param old_param;
+        int old_policy = sched_getscheduler(t->tid);
+        if (old_policy == -1 || sched_getparam(t->tid, &old_param) == -1)
+            return -1;
+
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = tuning->fifo_priority;
+        if (sched_setscheduler(t->tid, tuning->fifo_priority ? SCHED_FIFO : SCHED_OTHER, &param) == -1)
+            return -1;
+        if (!tuning->fifo_priority && setpriority(PRIO_PROCESS, t->tid, tuning->nice) == -1)
+        {
+            sched_setscheduler(t->tid, old_policy, &old_param);
+            return -1;
+        }
+    }
     return 0;
+#else
+    return -1;
+#endif
+}
+
+
+gboolean thread_tuning_cpu_valid(gint cpu)
+{
+#ifdef __linux__
+    return cpu >= 0 && cpu < CPU_SETSIZE;
+#else
+    return FALSE;
+#endif
+}
+
+
+void thread_tuning_attach(mchat_thread *t)
+{
+    mchat_t *mchat = t->mchat;
+    g_mutex_lock(&mchat->tuning_mutex);
+#ifdef __linux__
+    t->tid = (gint)syscall(SYS_gettid);
+    mchat_thread_tuning *tuning = &mchat->thread_tuning[t->role];
+    /* Threads start untuned; only touch what the caller configured for the role */
+    if (tuning->configured)
+        thread_tuning_apply(t, tuning, tuning->configured);
+#endif
+    g_mutex_unlock(&mchat->tuning_mutex);
+}
+
+
+int socket_busy_poll_apply(GSocket *sock, guint usec)
+{
+#ifdef SO_BUSY_POLL
+    int value = (int)usec;
+    return setsockopt(g_socket_get_fd(sock), SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value));
+#else
+    return usec ? -1 : 0;
+#endif
+}
+
+
+gpointer cache_aligned_alloc0(gsize size)
+{
+    gpointer mem = NULL;
+    if (posix_memalign(&mem, MCHAT_CACHE_LINE_SIZE, size) != 0)
+        return NULL;
+    memset(mem, 0, size);
+    return mem;
+}
+
+
+void cache_aligned_free(gpointer mem)
+{
+    free(mem);
 }
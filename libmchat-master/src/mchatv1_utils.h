@@ -18,37 +18,67 @@
 #define MCHAT_CHANNEL_HASH_FNV_OFFSET 0x811C9DC5
 
 /*!
- * \brief Find a channel in an mchat object by id (Internal Function)
- * \param array Pointer to the array to traverse
+ * \brief Create an empty channel registry
+ * \return A new channel table
+ */
+mchat_channel_table *channel_table_new(void);
+
+/*!
+ * \brief Free a channel registry and all the channels in it
+ * \param table Pointer to the channel table
+ */
+void channel_table_destroy(mchat_channel_table *table);
+
+/*!
+ * \brief Add a channel to a registry
+ * \param table Pointer to the channel table
+ * \param chan Channel to add (the table takes ownership)
+ * \return 0 on success or -1 if a channel with the same name or id is already in \p table
+ */
+int channel_table_add(mchat_channel_table *table, mchat_channel *chan);
+
+/*!
+ * \brief Remove a channel from a registry and free it
+ * \param table Pointer to the channel table
+ * \param chan Channel to remove
+ * \return 0 on success or -1 if \p chan was not in \p table
+ */
+int channel_table_remove(mchat_channel_table *table, mchat_channel *chan);
+
+/*!
+ * \brief Find a channel in a channel registry by name (Internal Function)
+ * \param table Pointer to the registry to search
  * \param channel_name Character array of the channel name
  * \return A pointer to an mchat_channel object if found, or NULL if not
- *
- * \note This function is a lot less efficient than ::channel_query_by_id, so use
- * that whenever possible.
- *
  */
-mchat_channel *channel_query_by_name(GPtrArray *array, char *channel_name);
+mchat_channel *channel_query_by_name(mchat_channel_table *table, char *channel_name);
 
 /*!
- * \brief Find a channel in an mchat object by id (Internal Function)
- * \param array Pointer to the array to traverse
+ * \brief Find a channel in a channel registry by id (Internal Function)
+ * \param table Pointer to the registry to search
  * \param channel_id The channel id number (hash)
  * \return A pointer to an mchat_channel object if found, or NULL if not
  *
  */
-mchat_channel *channel_query_by_id(GPtrArray *array, unsigned int channel_id);
+mchat_channel *channel_query_by_id(mchat_channel_table *table, unsigned int channel_id);
 
 /*!
- * \brief Find a peer by nickname in the peer-list
+ * \brief Find a peer by source address in the peer-list
  * \param mchat Pointer to an mchat object
  * \param address Source address of the peer case to an unsigned integer
- * \return 0 or a positive number if the nickname is found, -1 if not
+ * \return 0 or a positive number if the peer is found, -1 if not
  *
  * \warning
  * This function is not Thread-safe.  Callers need to do their own locking.
  */
 int peerlist_query(mchat_t *mchat, guint32 address);
 
+/*!
+ * \brief Free function for mchat_t.channel_members values
+ * \param data Pointer to an mchat_channel_members struct
+ */
+void channel_members_destroy(gpointer data);
+
 /*!
  * \brief Update peer_list, removing peers not seen for the timeout interval
  * \param mchat Pointer to an mchat object
@@ -61,9 +91,63 @@ int peerlist_expire(mchat_t *mchat);
  * \param mchat Pointer to an mchat object
  * \param parsed_message Parsed message struct
  * \param address IPv4 address converted into an unsiged 32 bit integer
+ * \param common Non-zero if the message was received on the common channel
  * \return 0 on success or -1 on error
+ *
+ * \details
+ * Besides the nickname and channel, this keeps the peer's traffic statistics.
+ * Keepalive PINGs on the common channel are sent at a fixed interval, so their
+ * arrival times are used to estimate jitter and loss.
+ */
+int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 address, int common);
+
+/*!
+ * \brief Take references to the interned strings of a copied peer entry
+ * \param peer Pointer to the copy
+ */
+void peerlist_peer_ref(mchat_peer *peer);
+
+/*!
+ * \brief Drop the references held by a peer entry
+ * \param data Pointer to the peer entry (GArray clear function)
+ */
+void peerlist_peer_clear(gpointer data);
+
+/*!
+ * \brief Queue a peer change event for ::mchatv1_get_peer_events
+ * \param mchat Pointer to an mchat object
+ * \param type One of the MCHAT_PEER_EVENT_ constants
+ * \param peer Pointer to the peer the event is about
+ *
+ * \details
+ * The queue is bounded; when it is full the oldest event is dropped and the
+ * overflow flag is set.
+ *
+ * \warning
+ * The caller must hold mchat_t.peerlist_mutex.
+ */
+void peerlist_push_event(mchat_t *mchat, guint32 type, mchat_peer *peer);
+
+/*!
+ * \brief Allocate an empty peer list snapshot
+ * \param length Number of peers to allocate room for
+ * \return A new snapshot with one reference and mchat_peerlist_t.length set to 0
+ *
+ * \details
+ * Peers copied into the snapshot must have their references taken with
+ * ::peerlist_peer_ref; they are dropped when the snapshot is freed.
+ */
+mchat_peerlist_t *peerlist_snapshot_new(guint64 length);
+
+/*!
+ * \brief Publish the current peer list as a new read-only snapshot
+ * \param mchat Pointer to an mchat object
+ * \return The generation number of the new snapshot
+ *
+ * \warning
+ * The caller must hold mchat_t.peerlist_mutex.
  */
-int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 address);
+guint peerlist_publish(mchat_t *mchat);
 
 /*!
  * \brief Hash as channel struct to a channel ID number
@@ -72,7 +156,8 @@ int peerlist_update_peer(mchat_t *mchat, mchat_parser parsed_message, guint32 ad
  *
  * \details
  * Channel storage and updates are done via a ID lookup.  This id is generated by
- * using the Fowler/Noll/Vo (FNV) hash method.
+ * using the Fowler/Noll/Vo (FNV) hash method over the channel name, the raw bytes
+ * of the address and the port number.
  */
 unsigned int mchat_channel_hash_struct(mchat_channel *chan);
 
@@ -82,6 +167,10 @@ unsigned int mchat_channel_hash_struct(mchat_channel *chan);
  * \param addr Character array of the channel IP address
  * \param portno Port number of the channel
  * \return  The hash value
+ *
+ * \details
+ * \p addr is converted to its raw bytes on the stack, so this gives the same
+ * value as ::mchat_channel_hash_struct without allocating.
  */
 unsigned int mchat_channel_hash_params(guchar *name, guchar *addr, guint16 portno);
 
@@ -103,6 +192,12 @@ mchat_channel *mchat_channel_copy(mchat_channel *src);
  * \param mchat Pointer to an mchat object
  * \param parsed_message Pointer to mchat parser object
  * \return 0 on success or -1 on error
+ *
+ * \details
+ * Both the channel in the headers and any extra channels listed in the body of an
+ * aggregated CDSC are recorded.  The discovery cache (mchat_t.cdsc_channels) holds at most
+ * ::MCHAT_LIMIT_MAX_CDSC_CHANNELS channels.  When it is full, the channel that was
+ * announced longest ago is dropped to make room.
  */
 int mchat_channel_update(mchat_t *mchat, mchat_parser *parsed_message);
 
@@ -110,7 +205,291 @@ int mchat_channel_update(mchat_t *mchat, mchat_parser *parsed_message);
  * \brief Update the cdsc_channels list, removing entries that have expired
  * \param mchat Pointer to an mchat object
  * \return 0 on success or -1 on error
+ *
+ * \details
+ * This also publishes batched last seen updates made by ::mchat_channel_update.
  */
 int mchat_channel_expire(mchat_t *mchat);
 
+/*!
+ * \brief Publish the nickname and current channel for the formatters
+ * \param mchat Pointer to an mchat object
+ * \return The generation number of the new identity
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+guint identity_publish(mchat_t *mchat);
+
+/*!
+ * \brief Publish the channels in a registry as a new read-only chanlist snapshot
+ * \param table Pointer to the channel table
+ * \param slot Slot to publish the snapshot into
+ * \return The generation number of the new snapshot
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+guint chanlist_publish(mchat_channel_table *table, mchat_snapshot_slot *slot);
+
+/*!
+ * \brief Find the shard of a sharded channel that carries a topic
+ * \param chan Channel with mchat_channel.shard_count set
+ * \param topic NUL terminated topic
+ * \return The shard index (0 to shard_count - 1)
+ *
+ * \details
+ * This hashes the channel name and the topic with FNV-1a, not the FNV-1 order
+ * ::mchat_channel_hash_params uses.  FNV-1 ends by xoring in the last byte, so a
+ * small shard count would mostly pick the shard from a topic's last character.
+ */
+guint mchat_channel_topic_shard(mchat_channel *chan, const gchar *topic);
+
+/*!
+ * \brief Get the multicast group of a channel shard
+ * \param chan The channel
+ * \param shard Shard index
+ * \return A new GInetAddress, shard + 1 addresses after mchat_channel.channel_address
+ */
+GInetAddress *mchat_channel_shard_address(mchat_channel *chan, guint shard);
+
+/*!
+ * \brief Check whether a channel's shard groups collide with another channel
+ * \param table Channels to check against
+ * \param chan Channel in \p table or about to be added to it
+ * \param shard_count Shard count \p chan has or is about to get
+ * \return TRUE if a shard group of \p chan is the address or a shard group of another
+ *         channel on the same port, or the other way around
+ *
+ * \details
+ * Shard groups follow the channel address, so two channels with nearby addresses would
+ * otherwise receive each other's traffic.
+ */
+gboolean channel_table_shards_overlap(mchat_channel_table *table, mchat_channel *chan, guint shard_count);
+
+/*!
+ * \brief Leave every subscribed shard group and forget the topic subscriptions
+ * \param mchat Pointer to an mchat object
+ * \param sock The receive socket of mchat_t.current_channel
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+void topic_unsubscribe_all(mchat_t *mchat, GSocket *sock);
+
+/*!
+ * \brief Parse a sender address into the key used by the source lists
+ * \param address IPv4 address string
+ * \param key Set to the address bytes, as stored in mchat_peer.source_address
+ * \return 0 on success or -1 on error or if source filters are not supported
+ */
+int source_filter_key(char *address, guint32 *key);
+
+/*!
+ * \brief Apply the allow/block source lists to a multicast membership
+ * \param mchat Pointer to an mchat object
+ * \param sock Socket that has joined \p group
+ * \param group Multicast group
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * This sets the complete filter state, so it can be called again whenever the lists
+ * change.  Nothing is done until a filter has been configured.
+ */
+int source_filter_apply(mchat_t *mchat, GSocket *sock, GInetAddress *group);
+
+/*!
+ * \brief Apply the source lists to every filtered membership
+ * \param mchat Pointer to an mchat object
+ * \return 0 on success or -1 if source filters are not supported or any membership failed
+ *
+ * \details
+ * This covers the connected channel, its subscribed topic shards and the joined channels.
+ * Warm sockets are updated when they are taken from the pool.
+ */
+int source_filter_update(mchat_t *mchat);
+
+/*!
+ * \brief Message types let through on the common channel by the kernel filter
+ */
+#define MCHAT_KERNEL_FILTER_COMMON_TYPES \
+    (1 << MCHATV1_MESSAGE_TYPE_PING | 1 << MCHATV1_MESSAGE_TYPE_CDSC)
+
+/*!
+ * \brief Message types let through on chat channels by the kernel filter
+ *
+ * \details
+ * PINGs arrive on chat channels too and keep the peers' channel membership current.
+ */
+#define MCHAT_KERNEL_FILTER_CHANNEL_TYPES \
+    (1 << MCHATV1_MESSAGE_TYPE_PING | 1 << MCHATV1_MESSAGE_TYPE_TEXT | 1 << MCHATV1_MESSAGE_TYPE_FILE)
+
+/*!
+ * \brief Attach (or detach) the kernel filter on a receive socket
+ * \param mchat Pointer to an mchat object
+ * \param sock Receive socket
+ * \param types Bit mask of the ::mchatv1_type values to let through
+ * \return 0 on success or -1 on error
+ *
+ * \details
+ * Nothing is done while the filter has never been enabled.
+ */
+int kernel_filter_apply(mchat_t *mchat, GSocket *sock, guint types);
+
+/*!
+ * \brief Re-attach the kernel filter on every receive socket
+ * \param mchat Pointer to an mchat object
+ * \return 0 on success or -1 if socket filters are not supported
+ *
+ * \details
+ * Warm sockets are updated when they are taken from the pool.
+ */
+int kernel_filter_update(mchat_t *mchat);
+
+/*!
+ * \brief Limit a receive socket to the multicast groups it joined itself
+ * \param sock Socket bound to a channel port
+ *
+ * \details
+ * Linux otherwise hands a socket bound to the wildcard address every group joined by
+ * any socket on its port, such as the warm sockets of other channels.
+ */
+void multicast_socket_isolate(GSocket *sock);
+
+/*!
+ * \brief Create a non-blocking socket bound to a port for joined channels
+ * \param portno UDP port number
+ * \return A new mchat_join_socket with no memberships or NULL on error
+ */
+mchat_join_socket *join_socket_new(guint16 portno);
+
+/*!
+ * \brief Free an mchat_join_socket (GDestroyNotify for mchat_t.join_sockets)
+ * \param data Pointer to the mchat_join_socket
+ */
+void join_socket_destroy(gpointer data);
+
+/*!
+ * \brief Find the join socket bound to a port
+ * \param mchat Pointer to an mchat object
+ * \param portno UDP port number
+ * \return The join socket or NULL if no joined channel uses \p portno
+ *
+ * \warning
+ * The caller must hold mchat_t.join_mutex.
+ */
+mchat_join_socket *join_socket_lookup(mchat_t *mchat, guint16 portno);
+
+/*!
+ * \brief Check if another joined channel already uses a channel's multicast membership
+ * \param mchat Pointer to an mchat object
+ * \param chan The channel
+ * \return TRUE if a joined channel other than \p chan has the same address and port
+ *
+ * \warning
+ * The caller must hold mchat_t.join_mutex.
+ */
+gboolean join_membership_shared(mchat_t *mchat, mchat_channel *chan);
+
+/*!
+ * \brief Get a receive socket for a channel, reusing a warm one if there is one
+ * \param mchat Pointer to an mchat object
+ * \param chan Channel to receive
+ * \return A blocking socket bound to the channel port and joined to its group, or NULL on error
+ *
+ * \details
+ * A socket taken from the pool is removed from it, and datagrams queued on it while it
+ * was unused are discarded.  The caller owns the returned reference.
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+GSocket *warm_socket_take(mchat_t *mchat, mchat_channel *chan);
+
+/*!
+ * \brief Keep a channel's receive socket open for a later ::warm_socket_take
+ * \param mchat Pointer to an mchat object
+ * \param chan Channel \p sock is joined to
+ * \param sock The socket (a new reference is taken)
+ *
+ * \details
+ * If the pool is full, the least recently used socket is closed.
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+void warm_socket_put(mchat_t *mchat, mchat_channel *chan, GSocket *sock);
+
+/*!
+ * \brief Close the warm socket of a channel, if there is one
+ * \param mchat Pointer to an mchat object
+ * \param channel_id mchat_channel.channel_id of the channel
+ *
+ * \warning
+ * The caller must hold mchat_t.channels_mutex.
+ */
+void warm_socket_drop(mchat_t *mchat, guint32 channel_id);
+
+/*!
+ * \brief Free an mchat_warm_socket
+ * \param data Pointer to the mchat_warm_socket
+ */
+void warm_socket_destroy(gpointer data);
+
+/*!
+ * \brief Apply part of the tuning of a role to a running thread
+ * \param t Pointer to an mchat_thread whose mchat_thread.tid is set
+ * \param tuning Tuning of the thread's role
+ * \param fields MCHAT_TUNING_* fields of tuning to apply
+ * \return 0 on success or -1 on error (or if the platform does not support it)
+ *
+ * \details
+ * Sets only the requested affinity, scheduling or busy poll time of the thread, so
+ * changing one never resets another the caller left to the system.  If the nice value
+ * cannot be set the previous scheduler is restored.  The caller must hold
+ * mchat_t.tuning_mutex.
+ */
+int thread_tuning_apply(mchat_thread *t, const mchat_thread_tuning *tuning, guint fields);
+
+/*!
+ * \brief Check that a CPU number can be put in an affinity mask
+ * \param cpu CPU number
+ * \return TRUE if cpu fits in a cpu_set_t
+ *
+ * \details
+ * CPU numbers need not be contiguous (offline or hot-plugged CPUs leave gaps), so they
+ * are bounded by the size of the set rather than by the number of online processors.
+ */
+gboolean thread_tuning_cpu_valid(gint cpu);
+
+/*!
+ * \brief Record the kernel id of the calling thread and apply its role's tuning
+ * \param t Pointer to the mchat_thread run by the calling thread
+ */
+void thread_tuning_attach(mchat_thread *t);
+
+/*!
+ * \brief Set SO_BUSY_POLL on a socket
+ * \param sock Socket to set
+ * \param usec Busy poll time in microseconds (0 turns it off)
+ * \return 0 on success or -1 on error
+ */
+int socket_busy_poll_apply(GSocket *sock, guint usec);
+
+/*!
+ * \brief Allocate zeroed memory starting on a cache line
+ * \param size Number of bytes
+ * \return The memory (free it with ::cache_aligned_free()) or NULL on error
+ *
+ * \details
+ * For structs with MCHAT_CACHE_ALIGNED members, which g_malloc() does not align.
+ */
+gpointer cache_aligned_alloc0(gsize size);
+
+/*!
+ * \brief Free memory from ::cache_aligned_alloc0()
+ * \param mem Pointer to the memory or NULL
+ */
+void cache_aligned_free(gpointer mem);
+
 #endif // MCHATV1_UTILS_H
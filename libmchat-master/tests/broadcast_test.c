@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <mchatv1.h>
+#include <mchatv1_structs.h>
+#include <mchatv1_broadcast.h>
+
+const char *name = "sean\0";
+const char *chan = "#mchat\0";
+const guint32 addr = 0x0a000001;
+
+/* Publish a TEXT message whose body is its sequence number */
+static void publish(mchat_t *mchat, guint seq)
+{
+	gchar body[16];
+	mchat_parser parser;
+	memset(&parser, 0, sizeof(mchat_parser));
+	g_snprintf(body, sizeof(body), "%u", seq);
+	parser.packet_type = MCHATV1_MESSAGE_TYPE_TEXT;
+	parser.body = body;
+	parser.body_size = strlen(body);
+	parser.header_offset[MCHATV1_HEADER_TYPE_NICKNAME] = (gchar *)name;
+	parser.header_len[MCHATV1_HEADER_TYPE_NICKNAME] = strlen(name);
+	parser.header_offset[MCHATV1_HEADER_TYPE_CHANNEL] = (gchar *)chan;
+	parser.header_len[MCHATV1_HEADER_TYPE_CHANNEL] = strlen(chan);
+	g_assert(mchat_broadcast_publish(mchat, &parser, addr, g_get_real_time()));
+}
+
+static guint body_seq(const mchat_message_t *m)
+{
+	return (guint)strtoul(m->body, NULL, 10);
+}
+
+static gpointer late_publisher(gpointer data)
+{
+	g_usleep(G_TIME_SPAN_MILLISECOND * 50);
+	publish((mchat_t *)data, 4242);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	mchat_t *mchat = mchatv1_init(NULL);
+	const mchat_message_t *m, *m2;
+	unsigned int missed;
+
+	mchat_reader_t *r = mchatv1_reader_new(mchat);
+	mchat_reader_t *r2 = mchatv1_reader_new(mchat);
+	g_assert(r != NULL && r2 != NULL);
+	g_assert_cmpint(mchatv1_reader_next(r, &m, &missed), ==, 0);
+	g_assert_cmpuint(missed, ==, 0);
+
+	/* Every reader sees every message, in order, sharing one copy */
+	for (guint i = 0; i < 3; i++)
+		publish(mchat, i);
+	for (guint i = 0; i < 3; i++)
+	{
+		g_assert_cmpint(mchatv1_reader_next(r, &m, &missed), ==, 1);
+		g_assert_cmpuint(missed, ==, 0);
+		g_assert_cmpuint(body_seq(m), ==, i);
+		g_assert_cmpstr(m->nickname, ==, name);
+		g_assert_cmpuint(m->source_address, ==, addr);
+		g_assert_cmpint(mchatv1_reader_next(r2, &m2, &missed), ==, 1);
+		g_assert(m == m2);
+	}
+	g_assert_cmpint(mchatv1_reader_next(r, &m, &missed), ==, 0);
+	g_assert_cmpint(mchatv1_reader_next(r2, &m2, &missed), ==, 0);
+
+	/* A reader lapped by the ring is told how many messages it lost */
+	const guint extra = 10;
+	for (guint i = 0; i < MCHAT_LIMIT_MAX_BROADCAST_RING + extra; i++)
+		publish(mchat, 100 + i);
+	g_assert_cmpint(mchatv1_reader_next(r, &m, &missed), ==, 1);
+	g_assert_cmpuint(missed, ==, extra);
+	g_assert_cmpuint(body_seq(m), ==, 100 + extra);
+	for (guint i = 1; i < MCHAT_LIMIT_MAX_BROADCAST_RING; i++)
+	{
+		g_assert_cmpint(mchatv1_reader_next(r, &m, &missed), ==, 1);
+		g_assert_cmpuint(missed, ==, 0);
+		g_assert_cmpuint(body_seq(m), ==, 100 + extra + i);
+	}
+	g_assert_cmpint(mchatv1_reader_next(r, &m, &missed), ==, 0);
+	g_print("Lapped reader missed %u messages\n", extra);
+
+	/* Waiting: a timeout with nothing published, then a wake up by the publisher */
+	gint64 start = g_get_monotonic_time();
+	g_assert_cmpint(mchatv1_reader_wait(r, &m, &missed, G_TIME_SPAN_MILLISECOND * 20), ==, 0);
+	g_assert_cmpint(g_get_monotonic_time() - start, >=, G_TIME_SPAN_MILLISECOND * 20);
+	GThread *thread = g_thread_new("Publisher", late_publisher, mchat);
+	g_assert_cmpint(mchatv1_reader_wait(r, &m, &missed, -1), ==, 1);
+	g_assert_cmpuint(body_seq(m), ==, 4242);
+	g_thread_join(thread);
+
+	mchatv1_reader_destroy(&r);
+	mchatv1_reader_destroy(&r2);
+	g_assert(r == NULL);
+	g_print("Broadcast: ok\n");
+	mchatv1_destroy(&mchat);
+	return 0;
+}
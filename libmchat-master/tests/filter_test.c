@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <mchatv1.h>
+#include <mchatv1_structs.h>
+#include <mchatv1_utils.h>
+
+const char *ping = "PING MCHAT/1.1\r\nNickname: sean\r\nChannel: #mchat\r\n\r\n";
+const char *text = "TEXT MCHAT/1.1\r\nNickname: sean\r\nLength: 5\r\nChannel: #mchat\r\n\r\nHello";
+const char *cdsc = "CDSC MCHAT/1.1\r\nChannel: #other\r\nAddress: 239.0.0.2\r\nPort: 9010\r\n\r\n";
+const char *junk = "JUNK MCHAT/1.1\r\nNickname: sean\r\n\r\n";
+const char *badproto = "PING HTTP/1.1\r\nNickname: sean\r\n\r\n";
+const char *lowping = "ping mchat/1.1\r\nNickname: sean\r\nChannel: #mchat\r\n\r\n";
+const char *mixedtext = "Text McHaT/1.1\r\nNickname: sean\r\nLength: 5\r\nChannel: #mchat\r\n\r\nHello";
+
+/* Send each datagram to the receiver and return which ones got through the filter */
+static guint deliver(GSocket *sender, GSocket *receiver, const char **datagrams, guint count)
+{
+	GSocketAddress *dest = g_socket_get_local_address(receiver, NULL);
+	for (guint i = 0; i < count; i++)
+		g_assert_cmpint(g_socket_send_to(sender, dest, datagrams[i], strlen(datagrams[i]), NULL, NULL), ==, strlen(datagrams[i]));
+
+	/* Loopback delivers in order, so a second PING (which always passes) ends the batch */
+	g_assert_cmpint(g_socket_send_to(sender, dest, ping, strlen(ping), NULL, NULL), >, 0);
+	g_object_unref(dest);
+	guint passed = 0;
+	while (1)
+	{
+		gchar buf[512];
+		gssize len = g_socket_receive(receiver, buf, sizeof(buf) - 1, NULL, NULL);
+		g_assert_cmpint(len, >, 0);
+		buf[len] = '\0';
+		guint i;
+		for (i = 0; i < count; i++)
+			if (!(passed & 1 << i) && strcmp(buf, datagrams[i]) == 0)
+				break;
+		if (i == count)
+			break;	/* the marker */
+		passed |= 1 << i;
+	}
+	return passed;
+}
+
+int main(int argc, char *argv[])
+{
+	mchat_t *mchat = mchatv1_init(NULL);
+	const char *datagrams[] = { ping, text, cdsc, junk, badproto, lowping, mixedtext };
+	const guint count = G_N_ELEMENTS(datagrams);
+
+	GInetAddress *lo = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	GSocketAddress *any = g_inet_socket_address_new(lo, 0);
+	GSocket *receiver = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, NULL);
+	GSocket *sender = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, NULL);
+	g_assert(g_socket_bind(receiver, any, FALSE, NULL));
+	g_assert(g_socket_bind(sender, any, FALSE, NULL));
+	g_socket_set_timeout(receiver, 2);
+
+	/* Never enabled: nothing is attached, everything passes */
+	g_assert_cmpint(kernel_filter_apply(mchat, receiver, MCHAT_KERNEL_FILTER_CHANNEL_TYPES), ==, 0);
+	g_assert_cmpuint(deliver(sender, receiver, datagrams, count), ==, 0x7f);
+
+	/* Chat channels: PING and TEXT with the MCHAT signature only, in any case */
+	g_assert_cmpint(mchatv1_set_kernel_filter(mchat, MCHAT_KERNEL_FILTER_ON), ==, 0);
+	g_assert_cmpint(kernel_filter_apply(mchat, receiver, MCHAT_KERNEL_FILTER_CHANNEL_TYPES), ==, 0);
+	g_assert_cmpuint(deliver(sender, receiver, datagrams, count), ==, 0x63);
+
+	/* Common channel: PING and CDSC */
+	g_assert_cmpint(kernel_filter_apply(mchat, receiver, MCHAT_KERNEL_FILTER_COMMON_TYPES), ==, 0);
+	g_assert_cmpuint(deliver(sender, receiver, datagrams, count), ==, 0x25);
+
+	/* Blocked senders are dropped in the kernel too; with nothing left to end the
+	 * batch, check that the receive times out */
+	g_assert_cmpint(mchatv1_set_kernel_filter(mchat, MCHAT_KERNEL_FILTER_SOURCES), ==, 0);
+	g_assert_cmpint(mchatv1_source_block(mchat, "127.0.0.1"), ==, 0);
+	g_assert_cmpint(kernel_filter_apply(mchat, receiver, MCHAT_KERNEL_FILTER_CHANNEL_TYPES), ==, 0);
+	GSocketAddress *dest = g_socket_get_local_address(receiver, NULL);
+	g_assert_cmpint(g_socket_send_to(sender, dest, ping, strlen(ping), NULL, NULL), >, 0);
+	g_object_unref(dest);
+	g_socket_set_timeout(receiver, 1);
+	gchar buf[512];
+	GError *error = NULL;
+	g_assert_cmpint(g_socket_receive(receiver, buf, sizeof(buf), NULL, &error), ==, -1);
+	g_assert(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT));
+	g_error_free(error);
+	g_assert_cmpint(mchatv1_source_forget(mchat, "127.0.0.1"), ==, 0);
+
+	/* Turning it off detaches it again */
+	g_socket_set_timeout(receiver, 2);
+	g_assert_cmpint(mchatv1_set_kernel_filter(mchat, MCHAT_KERNEL_FILTER_OFF), ==, 0);
+	g_assert_cmpint(kernel_filter_apply(mchat, receiver, MCHAT_KERNEL_FILTER_CHANNEL_TYPES), ==, 0);
+	g_assert_cmpuint(deliver(sender, receiver, datagrams, count), ==, 0x7f);
+
+	g_object_unref(sender);
+	g_object_unref(receiver);
+	g_object_unref(any);
+	g_object_unref(lo);
+	g_print("Kernel filter: ok\n");
+	mchatv1_destroy(&mchat);
+	return 0;
+}
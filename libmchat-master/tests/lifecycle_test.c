@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <mchatv1.h>
+#include <mchatv1_structs.h>
+#include <mchatv1_session.h>
+
+const char *name = "sean\0";
+const char *chan = "#mchat\0";
+
+static mchat_session_t *watched;
+static int watermark_calls;
+
+/* Destroying the session from its own watermark call must not free it under the call */
+static void destroy_watched(mchat_t *mchat, mchat_session_t *session, unsigned int backlog, void *user_data)
+{
+	char buf[32];
+	watermark_calls++;
+	g_assert(session == watched);
+	g_assert_cmpint(mchatv1_session_destroy(&watched), ==, 0);
+	g_assert_cmpint(mchatv1_session_get_nickname(session, buf, sizeof(buf)), >, 0);
+	g_assert_cmpstr(buf, ==, "bob");
+}
+
+/* Hand a TEXT message to the sessions the way the receive threads do */
+static void fanout(mchat_t *mchat)
+{
+	mchat_parser parser;
+	memset(&parser, 0, sizeof(mchat_parser));
+	parser.packet_type = MCHATV1_MESSAGE_TYPE_TEXT;
+	parser.body = "Hello";
+	parser.body_size = 5;
+	parser.header_offset[MCHATV1_HEADER_TYPE_NICKNAME] = (gchar *)name;
+	parser.header_len[MCHATV1_HEADER_TYPE_NICKNAME] = strlen(name);
+	parser.header_offset[MCHATV1_HEADER_TYPE_CHANNEL] = (gchar *)chan;
+	parser.header_len[MCHATV1_HEADER_TYPE_CHANNEL] = strlen(chan);
+	mchat_session_fanout(mchat, &parser, 0x0a000001, g_get_real_time());
+}
+
+int main(int argc, char *argv[])
+{
+	mchat_t *mchat = mchatv1_init(NULL);
+
+	/* Connecting and disconnecting frees the text threads ... */
+	for (int i = 0; i < 2; i++)
+	{
+		g_assert_cmpint(mchatv1_connect(mchat, NULL), ==, 0);
+		g_assert(mchat->text_recv_thread != NULL);
+		g_assert_cmpint(mchatv1_disconnect(mchat), ==, 0);
+		g_assert(mchat->text_recv_thread == NULL);
+		g_assert(mchat->text_send_thread == NULL);
+	}
+
+	/* ... so nothing may use them after that */
+	mchat_session_t *s = mchatv1_session_new(mchat, "alice");
+	g_assert(s != NULL);
+	g_assert_cmpint(mchatv1_session_destroy(&s), ==, 0);
+	g_print("Session after disconnect: ok\n");
+
+	const int cpu = 0;
+	g_assert_cmpint(mchatv1_set_thread_affinity(mchat, MCHAT_THREAD_ROLE_TEXT_RECV, &cpu, 1), ==, 0);
+	g_assert_cmpint(mchatv1_set_thread_scheduling(mchat, MCHAT_THREAD_ROLE_TEXT_SEND, 0, 0), ==, 0);
+	g_print("Tuning after disconnect: ok\n");
+
+	g_assert_cmpint(mchatv1_set_delivery_policy(mchat, MCHAT_DELIVERY_DROP_OLDEST), ==, 0);
+	g_assert_cmpint(mchatv1_set_delivery_policy(mchat, MCHAT_DELIVERY_BLOCK), ==, 0);
+	g_print("Policy after disconnect: ok\n");
+
+	mchat_reader_t *r = mchatv1_reader_new(mchat);
+	g_assert(r != NULL);
+	g_assert_cmpint(mchatv1_reader_destroy(&r), ==, 0);
+	g_print("Reader after disconnect: ok\n");
+
+	/* The watermark can be replaced while the receive threads run */
+	g_assert_cmpint(mchatv1_connect(mchat, NULL), ==, 0);
+	g_assert_cmpint(mchatv1_set_delivery_watermark(mchat, 2, destroy_watched, NULL), ==, 0);
+	g_assert_cmpint(mchatv1_set_delivery_watermark(mchat, 0, NULL, NULL), ==, 0);
+	g_assert_cmpint(mchatv1_disconnect(mchat), ==, 0);
+	g_print("Watermark while connected: ok\n");
+
+	g_assert_cmpint(mchatv1_set_delivery_watermark(mchat, 1, destroy_watched, NULL), ==, 0);
+	watched = mchatv1_session_new(mchat, "bob");
+	fanout(mchat);
+	g_assert_cmpint(watermark_calls, ==, 1);
+	g_assert(watched == NULL);
+	g_print("Session destroyed by its watermark call: ok\n");
+
+	mchatv1_destroy(&mchat);
+	return 0;
+}
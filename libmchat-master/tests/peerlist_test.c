@@ -6,33 +6,104 @@
 #include <mchatv1.h>
 #include <mchatv1_structs.h>
 #include <mchatv1_utils.h>
+#include <mchatv1_intern.h>
 
 const char *name = "sean\0";
 const char *chan = "#mchat\0";
+const char *name2 = "alice\0";
+const char *chan2 = "#other\0";
+
+/* Build just enough of a parsed PING for peerlist_update_peer */
+static mchat_parser make_ping(const char *nickname, const char *channel)
+{
+	mchat_parser parser;
+	memset(&parser, 0, sizeof(mchat_parser));
+	parser.packet_type = MCHATV1_MESSAGE_TYPE_PING;
+	parser.total_size = 64;
+	parser.header_offset[MCHATV1_HEADER_TYPE_NICKNAME] = (gchar *)nickname;
+	parser.header_len[MCHATV1_HEADER_TYPE_NICKNAME] = strlen(nickname);
+	parser.header_offset[MCHATV1_HEADER_TYPE_CHANNEL] = (gchar *)channel;
+	parser.header_len[MCHATV1_HEADER_TYPE_CHANNEL] = strlen(channel);
+	return parser;
+}
 
 int main(int argc, char *argv[])
 {
 	mchat_t *mchat = mchatv1_init(NULL);
-	mchat_peer p;
-	memset(&p, 0, sizeof(mchat_peer));
-	memcpy(p.nickname, name, strlen(name));
-	p.nickname_len = strlen(name);
-	memcpy(p.channel, chan, strlen(chan));
-	p.channel_len = strlen(chan);
-	p.last_seen = g_get_real_time();
+	const guint32 addr1 = 0x0a000001, addr2 = 0x0a000002, addr3 = 0x0a000003;
 
-	g_array_append_val(mchat->peerlist, p);
+	/* Peers go in through the same path as received PINGs, which keeps the indexes */
+	peerlist_update_peer(mchat, make_ping(name, chan), addr1, 0);
+	peerlist_update_peer(mchat, make_ping(name2, chan2), addr2, 0);
+	peerlist_update_peer(mchat, make_ping(name2, chan), addr3, 0);
+
+	g_mutex_lock(&mchat->peerlist_mutex);
+	int i1 = peerlist_query(mchat, addr1);
+	int i3 = peerlist_query(mchat, addr3);
+	g_assert_cmpint(i1, >=, 0);
+	g_assert_cmpint(i3, >=, 0);
+	g_assert_cmpint(peerlist_query(mchat, 0x0a0000ff), ==, -1);
+	mchat_peer q = g_array_index(mchat->peerlist, mchat_peer, i1);
+	g_assert_cmpuint(q.source_address, ==, addr1);
+	g_assert_cmpstr(q.nickname->str, ==, name);
+	g_assert_cmpuint(g_array_index(mchat->peerlist, mchat_peer, i3).source_address, ==, addr3);
+	guint gen = peerlist_publish(mchat);
+	g_mutex_unlock(&mchat->peerlist_mutex);
 
 	mchat_peerlist_t *pl;
 	mchatv1_get_peerlist(mchat, &pl);
 
 	int s = mchatv1_peerlist_get_size(pl);
-	mchat_peer q = g_array_index(mchat->peerlist, mchat_peer, 0);
+	g_assert_cmpint(s, ==, 3);
 	g_print("Peerlist is %d long\n", s);
-	g_print("Nickname in mchat: %s (%d)\n", q.nickname, q.nickname_len);
-	g_print("Nickname: %s (%d)\n", pl->list[0].nickname, pl->list[0].nickname_len);
-	g_print("Channel: %s (%d)\n", pl->list[0].channel, pl->list[0].channel_len);
-	g_print("Channel Length here: %d\n", strlen(chan));
-	g_print("Last seen %ld\n", pl->list[0].last_seen);
+	g_print("Nickname in mchat: %s (%d)\n", q.nickname->str, q.nickname->len);
+	g_print("Nickname: %s (%d)\n", pl->list[i1].nickname->str, pl->list[i1].nickname->len);
+	g_print("Channel: %s (%d)\n", pl->list[i1].channel->str, pl->list[i1].channel->len);
+	g_print("Interned strings shared: %s\n", q.nickname == pl->list[i1].nickname ? "yes" : "no");
+	g_print("Peer entry size: %u bytes\n", (unsigned int)sizeof(mchat_peer));
+	g_print("Channel Length here: %d\n", (int)strlen(chan));
+	g_print("Last seen %ld\n", (long)pl->list[i1].last_seen);
+	g_print("Generation: %u (published %u, current %u)\n", mchatv1_peerlist_get_generation(pl),
+			gen, mchatv1_peerlist_generation(mchat));
+
+	/* A second reader shares the same snapshot */
+	mchat_peerlist_t *pl2;
+	mchatv1_get_peerlist(mchat, &pl2);
+	g_assert(pl == pl2);
+	g_print("Shared snapshot: %s\n", pl == pl2 ? "yes" : "no");
+	mchatv1_peerlist_destroy(&pl2);
+	mchatv1_peerlist_destroy(&pl);
+
+	/* Channel membership comes from the membership index */
+	g_assert_cmpint(mchatv1_channel_member_count(mchat, (char *)chan), ==, 2);
+	g_assert_cmpint(mchatv1_channel_member_count(mchat, (char *)chan2), ==, 1);
+	g_assert_cmpint(mchatv1_get_channel_peerlist(mchat, (char *)chan, &pl), ==, 1);
+	g_assert_cmpint(mchatv1_peerlist_get_size(pl), ==, 2);
+	mchatv1_peerlist_destroy(&pl);
+
+	/* A peer changing channel moves between memberships */
+	peerlist_update_peer(mchat, make_ping(name2, chan2), addr3, 0);
+	g_assert_cmpint(mchatv1_channel_member_count(mchat, (char *)chan), ==, 1);
+	g_assert_cmpint(mchatv1_channel_member_count(mchat, (char *)chan2), ==, 2);
+
+	/* Expiring a peer moves the last one into its slot; the index must follow */
+	g_mutex_lock(&mchat->peerlist_mutex);
+	i1 = peerlist_query(mchat, addr1);
+	g_array_index(mchat->peerlist, mchat_peer, i1).last_seen = 0;
+	g_mutex_unlock(&mchat->peerlist_mutex);
+	peerlist_expire(mchat);
+
+	g_mutex_lock(&mchat->peerlist_mutex);
+	g_assert_cmpint(peerlist_query(mchat, addr1), ==, -1);
+	g_assert_cmpuint(mchat->peerlist->len, ==, 2);
+	int i2 = peerlist_query(mchat, addr2);
+	i3 = peerlist_query(mchat, addr3);
+	g_assert_cmpuint(g_array_index(mchat->peerlist, mchat_peer, i2).source_address, ==, addr2);
+	g_assert_cmpuint(g_array_index(mchat->peerlist, mchat_peer, i3).source_address, ==, addr3);
+	g_mutex_unlock(&mchat->peerlist_mutex);
+	g_assert_cmpint(mchatv1_channel_member_count(mchat, (char *)chan), ==, 0);
+
+	g_print("Peer index: ok\n");
+	mchatv1_destroy(&mchat);
 	return 0;
 }
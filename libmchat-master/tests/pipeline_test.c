@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <mchatv1.h>
+#include <mchatv1_structs.h>
+#include <mchatv1_utils.h>
+#include <mchatv1_pipeline.h>
+
+#define TEXTS 2000
+#define SENDERS 8
+#define PINGS_PER_SENDER 200
+#define RESERVED_PINGS 50
+
+const char *junk = "JUNK MCHAT/1.1\r\nNickname: nobody\r\n\r\n";
+const char *text = "TEXT MCHAT/1.1\r\nNickname: sean\r\nLength: 5\r\nChannel: #mchat\r\n\r\nHello";
+
+/* Read a datagram into a pipeline slot the way the text recv thread does */
+static mchat_pipeline_slot *feed(mchat_pipeline *p, mchat_pipeline_slot *slot, const char *data, guint32 sbytes)
+{
+	if (slot == NULL)
+		slot = mchat_pipeline_take(p);
+	g_assert(slot != NULL);
+	slot->len = strlen(data);
+	memcpy(slot->data, data, slot->len + 1);
+	slot->sbytes = sbytes;
+	slot->recv_time = g_get_real_time();
+	/* The control lane copies the datagram out, so the slot can be reused */
+	return mchat_pipeline_push(p, slot) ? NULL : slot;
+}
+
+/* PINGs handled by the peer list so far */
+static guint64 pings_seen(mchat_t *mchat)
+{
+	guint64 seen = 0;
+	g_mutex_lock(&mchat->peerlist_mutex);
+	for (guint i = 0; i < mchat->peerlist->len; i++)
+		seen += g_array_index(mchat->peerlist, mchat_peer, i).ping_count;
+	g_mutex_unlock(&mchat->peerlist_mutex);
+	return seen;
+}
+
+/* Wait until the control lane has handled or coalesced the given number of PINGs */
+static guint64 wait_pings(mchat_t *mchat, guint64 total)
+{
+	unsigned int coalesced, dropped;
+	gint64 deadline = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+	do
+	{
+		g_usleep(G_TIME_SPAN_MILLISECOND);
+		g_assert_cmpint(mchatv1_get_control_counters(mchat, &coalesced, &dropped), ==, 0);
+	}
+	while (pings_seen(mchat) + coalesced < total && g_get_monotonic_time() < deadline);
+	g_assert_cmpuint(dropped, ==, 0);
+	return pings_seen(mchat) + coalesced;
+}
+
+static guint expected = TEXTS;
+static unsigned int taken = 0;
+static mchat_pipeline *fed_pipeline;
+static mchat_pipeline_slot *fed_slot;
+
+/* Fill every slot with TEXTs and then some, so the last take waits for a free slot */
+static gpointer feed_all(gpointer data)
+{
+	guint count = GPOINTER_TO_UINT(data);
+	for (guint i = 0; i < count; i++)
+		fed_slot = feed(fed_pipeline, fed_slot, text, 0x0a000001 + (i % 8));
+	return NULL;
+}
+
+/* Take messages out of the buffer the way mchatv1_recv_message does, until every one
+ * was either taken or dropped */
+static gpointer consume(gpointer data)
+{
+	mchat_thread *t = data;
+	unsigned int delivered, dropped;
+	do
+	{
+		g_usleep(50);
+		g_mutex_lock(&t->mutex);
+		if (g_atomic_int_get(&t->buffer_flag))
+		{
+			g_atomic_int_set(&t->buffer_flag, 0);
+			g_cond_broadcast(&t->cond);
+			taken++;
+		}
+		g_mutex_unlock(&t->mutex);
+		mchatv1_get_delivery_counters(t->mchat, &delivered, &dropped, NULL, NULL);
+	}
+	while (taken < delivered || delivered + dropped < expected);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	mchat_t *mchat = mchatv1_init(NULL);
+	mchat_thread *t = cache_aligned_alloc0(sizeof(mchat_thread));
+	t->mchat = mchat;
+	t->role = MCHAT_THREAD_ROLE_TEXT_RECV;
+	t->run_flag = 1;
+	g_mutex_init(&t->mutex);
+	g_cond_init(&t->cond);
+	t->buffer = g_malloc0(sizeof(mchat_message_t));
+	t->buffer->body = g_malloc(MCHAT_LIMIT_MAX_MESSAGE_SIZE);
+	t->buffer->nickname = g_malloc(MCHAT_LIMIT_MAX_NICKNAME_SIZE);
+
+	const guint workers = 2;
+	mchat_pipeline *p = mchat_pipeline_new(t, workers);
+	mchat_pipeline_slot *slot = NULL;
+
+	/* Many times more datagrams than slots: the workers must hand every slot back
+	 * through their done rings */
+	const guint total = 50 * workers * MCHAT_PIPELINE_SLOTS_PER_WORKER;
+	for (guint i = 0; i < total; i++)
+		slot = feed(p, slot, junk, 0x0a000100 + (i % 64));
+	g_print("Recycled %u slots %u times each\n", workers * MCHAT_PIPELINE_SLOTS_PER_WORKER, 50);
+
+	/* PINGs go through the control lane: each is either handled or coalesced into a
+	 * newer PING of the same sender */
+	for (guint i = 0; i < PINGS_PER_SENDER; i++)
+	{
+		for (guint s = 0; s < SENDERS; s++)
+		{
+			gchar ping[128];
+			g_snprintf(ping, sizeof(ping), "PING MCHAT/1.1\r\nNickname: peer%u\r\nChannel: #mchat\r\n\r\n", s);
+			slot = feed(p, slot, ping, 0x0a000001 + s);
+		}
+	}
+	g_assert_cmpuint(wait_pings(mchat, SENDERS * PINGS_PER_SENDER), ==, SENDERS * PINGS_PER_SENDER);
+	g_assert_cmpuint(mchat->peerlist->len, ==, SENDERS);
+	g_assert_cmpint(mchatv1_channel_member_count(mchat, "#mchat"), ==, SENDERS);
+	g_print("Control lane: %u PINGs handled\n", (unsigned int)pings_seen(mchat));
+
+	/* Under BLOCK, a worker woken after another one refilled the buffer goes back to
+	 * waiting; nothing is dropped however the workers race */
+	unsigned int delivered, dropped;
+	g_assert_cmpint(mchatv1_set_delivery_policy(mchat, MCHAT_DELIVERY_BLOCK), ==, 0);
+	GThread *consumer = g_thread_new("Consumer", consume, t);
+	for (guint i = 0; i < TEXTS; i++)
+		slot = feed(p, slot, text, 0x0a000001 + (i % 8));	/* senders spread over the workers */
+	g_thread_join(consumer);
+	g_assert_cmpint(mchatv1_get_delivery_counters(mchat, &delivered, &dropped, NULL, NULL), ==, 0);
+	g_assert_cmpuint(dropped, ==, 0);
+	g_assert_cmpuint(delivered, ==, TEXTS);
+	g_print("Blocked %u messages over %u workers: none dropped\n", TEXTS, workers);
+
+	/* With every slot held by an untaken TEXT, PINGs on the socket are still read
+	 * through the reserved slot, and the TEXT sent after them waits in the socket */
+	GInetAddress *lo = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	GSocketAddress *any = g_inet_socket_address_new(lo, 0);
+	GSocket *sender = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, NULL);
+	t->sock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, NULL);
+	g_assert(g_socket_bind(t->sock, any, FALSE, NULL));
+	GSocketAddress *dest = g_socket_get_local_address(t->sock, NULL);
+	guint64 before = wait_pings(mchat, 0);
+	const guint held = workers * MCHAT_PIPELINE_SLOTS_PER_WORKER + workers + 1;
+	fed_pipeline = p;
+	fed_slot = slot;
+	GThread *feeder = g_thread_new("Feeder", feed_all, GUINT_TO_POINTER(held));
+	const char *ping = "PING MCHAT/1.1\r\nNickname: local\r\nChannel: #mchat\r\n\r\n";
+	for (guint i = 0; i < RESERVED_PINGS; i++)
+		g_assert_cmpint(g_socket_send_to(sender, dest, ping, strlen(ping), NULL, NULL), >, 0);
+	g_assert_cmpint(g_socket_send_to(sender, dest, text, strlen(text), NULL, NULL), >, 0);
+	g_assert_cmpuint(wait_pings(mchat, before + RESERVED_PINGS), ==, before + RESERVED_PINGS);
+	g_assert(g_socket_condition_check(t->sock, G_IO_IN) & G_IO_IN);
+	g_assert_cmpint(mchatv1_get_delivery_counters(mchat, NULL, &dropped, NULL, NULL), ==, 0);
+	g_assert_cmpuint(dropped, ==, 0);
+	g_print("Read %u PINGs with every slot held\n", RESERVED_PINGS);
+
+	expected = TEXTS + held;
+	consumer = g_thread_new("Consumer", consume, t);
+	g_thread_join(feeder);
+	g_thread_join(consumer);
+	slot = fed_slot;
+	g_object_unref(dest);
+	g_object_unref(t->sock);
+	t->sock = NULL;
+	g_object_unref(sender);
+	g_object_unref(any);
+	g_object_unref(lo);
+
+	if (slot != NULL)
+		mchat_pipeline_untake(p, slot);
+	g_atomic_int_set(&t->run_flag, 0);
+	mchat_pipeline_destroy(p);
+	g_free(t->buffer->body);
+	g_free(t->buffer->nickname);
+	g_free(t->buffer);
+	g_cond_clear(&t->cond);
+	g_mutex_clear(&t->mutex);
+	cache_aligned_free(t);
+	g_print("Pipeline: ok\n");
+	mchatv1_destroy(&mchat);
+	return 0;
+}
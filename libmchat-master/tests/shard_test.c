@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <mchatv1.h>
+#include <mchatv1_structs.h>
+#include <mchatv1_utils.h>
+
+/* Check the address of a shard of a channel */
+static void check_shard_address(const char *address, guint shard, const char *expected)
+{
+	mchat_channel chan;
+	memset(&chan, 0, sizeof(mchat_channel));
+	chan.channel_address = g_inet_address_new_from_string(address);
+	GInetAddress *group = mchat_channel_shard_address(&chan, shard);
+	gchar *s = g_inet_address_to_string(group);
+	g_assert_cmpstr(s, ==, expected);
+	g_free(s);
+	g_object_unref(group);
+	g_object_unref(chan.channel_address);
+}
+
+int main(int argc, char *argv[])
+{
+	mchat_t *mchat = mchatv1_init(NULL);
+
+	/* Shard groups follow the channel address, carrying into the upper bytes */
+	check_shard_address("239.10.0.10", 0, "239.10.0.11");
+	check_shard_address("239.10.0.10", 3, "239.10.0.14");
+	check_shard_address("239.10.0.255", 0, "239.10.1.0");
+	check_shard_address("ff15::ff", 1, "ff15::101");
+
+	/* #a owns 239.10.0.10 and its shards .11 to .14 */
+	g_assert_cmpint(mchatv1_add_channel(mchat, "#a", "239.10.0.10", 7000), ==, 0);
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#a", 4), ==, 0);
+	g_assert_cmpint(mchatv1_get_channel_shards(mchat, "#a"), ==, 4);
+
+	/* A channel on a shard group of #a is refused, just past them or on another port it is not */
+	g_assert_cmpint(mchatv1_add_channel(mchat, "#b", "239.10.0.12", 7000), ==, -1);
+	g_assert_cmpint(mchatv1_add_channel(mchat, "#b", "239.10.0.15", 7000), ==, 0);
+	g_assert_cmpint(mchatv1_add_channel(mchat, "#c", "239.10.0.12", 7001), ==, 0);
+
+	/* Growing #a onto #b is refused and leaves it as it was */
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#a", 5), ==, -1);
+	g_assert_cmpint(mchatv1_get_channel_shards(mchat, "#a"), ==, 4);
+
+	/* Nor may a channel below #a grow its shards onto it */
+	g_assert_cmpint(mchatv1_add_channel(mchat, "#d", "239.10.0.8", 7000), ==, 0);
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#d", 1), ==, 0);
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#d", 2), ==, -1);
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#d", MCHAT_LIMIT_MAX_CHANNEL_SHARDS + 1), ==, -1);
+
+	/* Unsharding #a frees its shard groups */
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#a", 0), ==, 0);
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#d", 2), ==, -1);	/* .10 is still #a itself */
+	g_assert_cmpint(mchatv1_add_channel(mchat, "#e", "239.10.0.12", 7000), ==, 0);
+
+	/* A topic always maps to the same shard in range */
+	g_assert_cmpint(mchatv1_set_channel_shards(mchat, "#b", 8), ==, 0);
+	g_mutex_lock(&mchat->channels_mutex);
+	mchat_channel *c = channel_query_by_name(mchat->added_channels, "#b");
+	guint seen = 0;
+	for (guint i = 0; i < 64; i++)
+	{
+		gchar topic[16];
+		g_snprintf(topic, sizeof(topic), "topic%u", i);
+		guint shard = mchat_channel_topic_shard(c, topic);
+		g_assert_cmpuint(shard, <, 8);
+		g_assert_cmpuint(mchat_channel_topic_shard(c, topic), ==, shard);
+		seen |= 1 << shard;
+	}
+	g_mutex_unlock(&mchat->channels_mutex);
+	g_assert_cmpuint(seen, >, 1);
+	g_print("Topics spread over shards 0x%02x\n", seen);
+
+	g_print("Shards: ok\n");
+	mchatv1_destroy(&mchat);
+	return 0;
+}
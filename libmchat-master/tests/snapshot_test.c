@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <mchatv1_snapshot.h>
+#include <mchatv1_intern.h>
+
+typedef struct test_snapshot
+{
+	mchat_snapshot snap;
+	int value;
+} test_snapshot;
+
+static int freed = 0;
+
+static void test_snapshot_free(gpointer data)
+{
+	freed++;
+	g_free(data);
+}
+
+static test_snapshot *test_snapshot_new(int value)
+{
+	test_snapshot *s = g_malloc0(sizeof(test_snapshot));
+	mchat_snapshot_init(&s->snap, test_snapshot_free);
+	s->value = value;
+	return s;
+}
+
+static gpointer leave_acquire(gpointer data)
+{
+	g_usleep(G_TIME_SPAN_MILLISECOND * 20);
+	g_atomic_int_add(&((mchat_snapshot_slot*)data)->readers, -1);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	mchat_snapshot_slot slot;
+	mchat_snapshot_slot_init(&slot);
+	g_assert(mchat_snapshot_acquire(&slot) == NULL);
+	g_assert_cmpuint(mchat_snapshot_slot_generation(&slot), ==, 0);
+
+	/* Readers share the published snapshot */
+	g_assert_cmpuint(mchat_snapshot_publish(&slot, test_snapshot_new(1)), ==, 1);
+	test_snapshot *a = mchat_snapshot_acquire(&slot);
+	test_snapshot *b = mchat_snapshot_acquire(&slot);
+	g_assert(a != NULL && a == b);
+	g_assert_cmpint(a->value, ==, 1);
+	g_assert_cmpuint(a->snap.generation, ==, 1);
+	mchat_snapshot_unref(b);
+
+	/* A replaced snapshot lives on until its last reader lets go */
+	g_assert_cmpuint(mchat_snapshot_publish(&slot, test_snapshot_new(2)), ==, 2);
+	g_assert_cmpint(freed, ==, 0);
+	g_assert_cmpint(a->value, ==, 1);
+	b = mchat_snapshot_acquire(&slot);
+	g_assert_cmpint(b->value, ==, 2);
+	g_assert_cmpuint(mchat_snapshot_slot_generation(&slot), ==, 2);
+	mchat_snapshot_unref(a);
+	g_assert_cmpint(freed, ==, 1);
+
+	/* The slot's reference goes on clear, the reader's on unref */
+	mchat_snapshot_slot_clear(&slot);
+	g_assert_cmpint(freed, ==, 1);
+	g_assert_cmpint(b->value, ==, 2);
+	mchat_snapshot_unref(b);
+	g_assert_cmpint(freed, ==, 2);
+	g_print("Snapshot: ok\n");
+
+	/* A reader stuck in the acquire window holds back reclaiming ... */
+	mchat_snapshot_slot_init(&slot);
+	freed = 0;
+	g_atomic_int_inc(&slot.readers);
+	for (int i = 0; i < MCHAT_SNAPSHOT_MAX_RETIRED; i++)
+		mchat_snapshot_publish(&slot, test_snapshot_new(i));
+	g_assert_cmpuint(slot.retired_count, ==, MCHAT_SNAPSHOT_MAX_RETIRED - 1);
+	g_assert_cmpint(freed, ==, 0);
+
+	/* ... but only up to the limit, where publishing waits for it to leave */
+	GThread *thread = g_thread_new("Reader", leave_acquire, &slot);
+	mchat_snapshot_publish(&slot, test_snapshot_new(MCHAT_SNAPSHOT_MAX_RETIRED));
+	g_assert_cmpuint(slot.retired_count, ==, 0);
+	g_assert_cmpint(freed, ==, MCHAT_SNAPSHOT_MAX_RETIRED);
+	g_thread_join(thread);
+	mchat_snapshot_slot_clear(&slot);
+	g_assert_cmpint(freed, ==, MCHAT_SNAPSHOT_MAX_RETIRED + 1);
+	g_print("Retired: ok\n");
+	/* Equal strings intern to one shared, NUL terminated entry */
+	const char *line = "#mchat topic";
+	const char *chan = "#mchat";
+	mchat_istr *s1 = mchat_intern(line, 6, mchat_intern_hash(line, 6));
+	mchat_istr *s2 = mchat_intern(chan, strlen(chan), mchat_intern_hash(chan, strlen(chan)));
+	g_assert(s1 == s2);
+	g_assert_cmpuint(s1->len, ==, 6);
+	g_assert_cmpstr(s1->str, ==, chan);
+	g_assert_cmpint(s1->ref_count, ==, 2);
+	g_assert(mchat_istr_equal(s1, line, 6, mchat_intern_hash(line, 6)));
+	g_assert(!mchat_istr_equal(s1, line, 7, mchat_intern_hash(line, 7)));
+
+	mchat_istr *other = mchat_intern(line, strlen(line), mchat_intern_hash(line, strlen(line)));
+	g_assert(other != s1);
+	g_assert(!mchat_istr_equal_func(s1, other));
+
+	/* Lookup keys find interned entries without interning */
+	mchat_istr key;
+	MCHAT_ISTR_KEY_INIT(&key, chan, strlen(chan));
+	g_assert(mchat_istr_equal_func(&key, s1));
+	g_assert_cmpuint(mchat_istr_hash_func(&key), ==, mchat_istr_hash_func(s1));
+
+	g_assert(mchat_istr_ref(s1) == s1);
+	g_assert_cmpint(s1->ref_count, ==, 3);
+	mchat_istr_unref(s1);
+	mchat_istr_unref(s1);
+	mchat_istr_unref(s2);
+	mchat_istr_unref(other);
+	g_print("Intern: ok\n");
+	return 0;
+}
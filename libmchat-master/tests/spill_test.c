@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <mchatv1.h>
+#include <mchatv1_structs.h>
+#include <mchatv1_delivery.h>
+
+static gchar body[1 << 14];
+static gchar nickname[] = "sean";
+
+/* A large message whose body starts with its sequence number */
+static mchat_message_t make_message(guint seq)
+{
+	mchat_message_t m;
+	memset(&m, 0, sizeof(mchat_message_t));
+	memset(body, 'x', sizeof(body));
+	g_snprintf(body, 16, "%015u", seq);
+	m.body = body;
+	m.body_len = sizeof(body);
+	m.nickname = nickname;
+	m.nickname_len = strlen(nickname);
+	m.packet_type = MCHATV1_MESSAGE_TYPE_TEXT;
+	return m;
+}
+
+static void check_pop(mchat_spill *spill, guint seq)
+{
+	gchar expected[16];
+	guint lost;
+	g_snprintf(expected, sizeof(expected), "%015u", seq);
+	mchat_message_t *m = mchat_spill_pop(spill, &lost);
+	g_assert(m != NULL);
+	g_assert_cmpuint(lost, ==, 0);
+	g_assert_cmpuint(m->body_len, ==, sizeof(body));
+	g_assert(memcmp(m->body, expected, 15) == 0);
+	g_assert_cmpstr(m->nickname, ==, nickname);
+	mchatv1_message_destroy(&m);
+}
+
+int main(int argc, char *argv[])
+{
+	const long record = sizeof(mchat_message_t) + sizeof(body) + strlen(nickname);
+	mchat_spill *spill = mchat_spill_new();
+	g_assert(spill != NULL);
+
+	guint lost;
+	g_assert(mchat_spill_pop(spill, &lost) == NULL);
+	g_assert_cmpuint(lost, ==, 0);
+
+	/* Records come back in order and an emptied spill starts over */
+	for (guint i = 0; i < 3; i++)
+	{
+		mchat_message_t m = make_message(i);
+		g_assert_cmpint(mchat_spill_push(spill, &m), ==, 0);
+	}
+	for (guint i = 0; i < 3; i++)
+		check_pop(spill, i);
+	g_assert(mchat_spill_pop(spill, &lost) == NULL);
+	g_assert_cmpint(spill->write_pos, ==, 0);
+
+	/* A reader that keeps up but never empties the spill: far more than the limit
+	 * goes through, so read space must be reclaimed */
+	guint pushed = 0, popped = 0;
+	const guint total = 4 * (MCHAT_LIMIT_MAX_SPILL_SIZE / record);
+	while (pushed < total)
+	{
+		mchat_message_t m = make_message(pushed);
+		g_assert_cmpint(mchat_spill_push(spill, &m), ==, 0);
+		pushed++;
+		if (pushed - popped > 100)
+			check_pop(spill, popped++);
+		g_assert_cmpint(spill->write_pos, <=, MCHAT_LIMIT_MAX_SPILL_SIZE);
+	}
+	g_print("Streamed %u messages (%ld MB) through the spill\n", pushed, (long)pushed * record >> 20);
+
+	/* Filling up: at least half the limit holds unread messages */
+	while (1)
+	{
+		mchat_message_t m = make_message(pushed);
+		if (mchat_spill_push(spill, &m) != 0)
+			break;
+		pushed++;
+	}
+	g_assert_cmpuint(spill->count, ==, pushed - popped);
+	g_assert_cmpint((long)spill->count * record, >=, MCHAT_LIMIT_MAX_SPILL_SIZE / 2);
+	g_print("Full with %u messages unread\n", spill->count);
+
+	while (popped < pushed)
+		check_pop(spill, popped++);
+	g_assert(mchat_spill_pop(spill, &lost) == NULL);
+
+	mchat_spill_destroy(spill);
+	g_print("Spill: ok\n");
+	return 0;
+}